@@ -55,6 +55,8 @@ enum ExceptionType {
     AuthenticationError,
 
     InvalidMessageSize,
+
+    Timeout,  // A Deadline passed
     Undefined = 100,  // Any undefined error
 };
 
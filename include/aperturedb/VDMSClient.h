@@ -30,11 +30,18 @@
 
 #pragma once
 
+#include <chrono>
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "util/Macros.h"
+#include "comm/Capabilities.h"
+#include "comm/Deadline.h"
 #include "comm/Protocol.h"
 
 namespace comm
@@ -48,6 +55,7 @@ class ConnMetrics;
 namespace VDMS
 {
 
+class QueryPipeline;
 class VDMSClientImpl;
 
 constexpr int VDMS_PORT{55555};
@@ -59,23 +67,70 @@ struct Response {
     std::vector< std::string > blobs{};
 };
 
+// Path of the file the blob at 'index' in a response is written to.
+using BlobPath = std::function< std::string(std::size_t index) >;
+
+// Response that refers to json and blobs in place, inside the message
+// received from the server, instead of copying them out. The views stay
+// valid for as long as the ResponseView (or a copy of it) is alive.
+struct ResponseView {
+    std::string_view json{};
+    std::vector< std::string_view > blobs{};
+
+    // Owns the received message the views point into.
+    std::shared_ptr< const std::basic_string< uint8_t > > message{};
+
+    // Owns the json instead, when the server sent it compressed.
+    std::shared_ptr< const std::string > json_buffer{};
+
+    Response to_response() const;
+};
+
 struct VDMSClientConfig {
+    // Host name, or "unix:<path>" for a server listening on a Unix domain
+    // socket on the same host.
     std::string addr{"localhost"};
     int port{VDMS_PORT};
     Protocol protocols{Protocol::Any};
     std::string ca_certificate{""};
     comm::ConnMetrics* metrics{nullptr};
-
-    VDMSClientConfig(std::string addr_           = "localhost",
-                     int port_                   = VDMS_PORT,
-                     Protocol protocols_         = Protocol::Any,
-                     std::string ca_certificate_ = "",
-                     comm::ConnMetrics* metrics_ = nullptr)
+    std::size_t max_queries_in_flight{16};  // See query_async()
+    // File holding a zstd dictionary (see comm::CompressionDictionary) to
+    // compress query json with, if the server loaded the same one.
+    std::string json_dictionary{""};
+    // See comm::ConnClientConfig::connect_timeout_ms.
+    unsigned connect_timeout_ms{0};
+    // Codecs offered to the server for the messages both ways.
+    comm::Compression compression{comm::Compression::None};
+    // Time a query may take to be sent, and then again for its response to
+    // be received, once the responses ahead of it are in. Past it the query
+    // throws Timeout, and the connection is shut down. 0 waits forever.
+    unsigned query_timeout_ms{0};
+    // See comm::ConnClientConfig::max_message_size.
+    uint64_t max_message_size{0};
+
+    VDMSClientConfig(std::string addr_                  = "localhost",
+                     int port_                          = VDMS_PORT,
+                     Protocol protocols_                = Protocol::Any,
+                     std::string ca_certificate_        = "",
+                     comm::ConnMetrics* metrics_        = nullptr,
+                     std::size_t max_queries_in_flight_ = 16,
+                     std::string json_dictionary_       = "",
+                     unsigned connect_timeout_ms_       = 0,
+                     comm::Compression compression_     = comm::Compression::None,
+                     unsigned query_timeout_ms_         = 0,
+                     uint64_t max_message_size_         = 0)
         : addr(std::move(addr_))
         , port(port_)
         , protocols(protocols_)
         , ca_certificate(std::move(ca_certificate_))
         , metrics(metrics_)
+        , max_queries_in_flight(max_queries_in_flight_)
+        , json_dictionary(std::move(json_dictionary_))
+        , connect_timeout_ms(connect_timeout_ms_)
+        , compression(compression_)
+        , query_timeout_ms(query_timeout_ms_)
+        , max_message_size(max_message_size_)
     {
     }
 
@@ -93,6 +148,26 @@ class TokenBasedVDMSClient
     std::unique_ptr< comm::ConnClient > _client;
     std::shared_ptr< comm::Connection > _connection;
 
+    // Started by the first query_async() call, from whichever thread.
+    std::size_t _max_queries_in_flight;
+    std::mutex _pipeline_mutex;
+    std::unique_ptr< QueryPipeline > _pipeline;
+
+    // See VDMSClientConfig::query_timeout_ms.
+    std::chrono::milliseconds _query_timeout;
+
+    // From now, or none without a query timeout.
+    comm::Deadline query_deadline() const;
+
+    // The pipeline, started first if 'start' is set, or null if not running.
+    QueryPipeline* pipeline(bool start);
+
+    void send_query(const std::string& json_query,
+                    const std::vector< std::string* >& blobs,
+                    const std::string& token,
+                    const comm::Deadline& deadline);
+    VDMS::ResponseView receive_response(const comm::Deadline& deadline);
+
    public:
     explicit TokenBasedVDMSClient(const VDMSClientConfig& config);
     ~TokenBasedVDMSClient();
@@ -101,6 +176,27 @@ class TokenBasedVDMSClient
     VDMS::Response query(const std::string& json_query,
                          const std::vector< std::string* > blobs = {},
                          const std::string& token                = "");
+
+    // Blocking call, blobs are not copied out of the response
+    VDMS::ResponseView query_view(const std::string& json_query,
+                                  const std::vector< std::string* > blobs = {},
+                                  const std::string& token                = "");
+
+    // Non-blocking call: the query is sent before returning, so the blobs
+    // can be released right away, and the response is delivered through
+    // the future. Up to max_queries_in_flight queries share the connection,
+    // and their responses arrive in the order the queries were sent.
+    std::future< VDMS::ResponseView > query_async(const std::string& json_query,
+                                                  const std::vector< std::string* > blobs = {},
+                                                  const std::string& token = "");
+
+    // Blocking call, for responses too large to hold in memory: blobs are
+    // written to files while they are being received, and only the json
+    // is returned.
+    std::string query_to_files(const std::string& json_query,
+                               const BlobPath& blob_path,
+                               const std::vector< std::string* > blobs = {},
+                               const std::string& token                = "");
 };
 
 class VDMSClient
@@ -128,6 +224,19 @@ class VDMSClient
     VDMS::Response query(const std::string& json_query,
                          const std::vector< std::string* > blobs = {});
 
+    // Blocking call, blobs are not copied out of the response
+    VDMS::ResponseView query_view(const std::string& json_query,
+                                  const std::vector< std::string* > blobs = {});
+
+    // Non-blocking call, see TokenBasedVDMSClient::query_async()
+    std::future< VDMS::ResponseView > query_async(const std::string& json_query,
+                                                  const std::vector< std::string* > blobs = {});
+
+    // Blocking call, see TokenBasedVDMSClient::query_to_files()
+    std::string query_to_files(const std::string& json_query,
+                               const BlobPath& blob_path,
+                               const std::vector< std::string* > blobs = {});
+
    private:
     std::unique_ptr< VDMSClientImpl > _impl;
 };
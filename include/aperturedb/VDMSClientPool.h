@@ -0,0 +1,121 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "aperturedb/VDMSClient.h"
+#include "util/Macros.h"
+
+namespace VDMS
+{
+
+class Session;
+
+class VDMSClientPoolMetrics
+{
+   public:
+    virtual ~VDMSClientPoolMetrics() = 0;
+
+    // Time a thread spent waiting for a free connection.
+    virtual void observe_wait_time(std::chrono::nanoseconds wait_time);
+};
+
+// A fixed set of authenticated connections to the same server, that threads
+// borrow one at a time. All connections share a single session: the user
+// authenticates once, and token refreshes are done by whichever connection
+// first finds the token expired.
+//
+// Leasing and returning connections is lock-free as long as a connection
+// is free; a thread that finds none sleeps until one is returned.
+class VDMSClientPool
+{
+   public:
+    // Exclusive use of one connection of the pool, returned when destroyed.
+    class Lease
+    {
+       public:
+        ~Lease();
+
+        Lease(Lease&& other) noexcept;
+        Lease& operator=(Lease&& other) noexcept;
+        NOT_COPYABLE(Lease);
+
+        // Blocking call. Throws ConnectionError on a moved-from lease.
+        VDMS::Response query(const std::string& json_query,
+                             const std::vector< std::string* > blobs = {});
+
+        // Blocking call, blobs are not copied out of the response
+        VDMS::ResponseView query_view(const std::string& json_query,
+                                      const std::vector< std::string* > blobs = {});
+
+       private:
+        friend class VDMSClientPool;
+
+        Lease(VDMSClientPool* pool, uint32_t index);
+
+        void release();
+
+        VDMSClientPool* _pool{nullptr};
+        uint32_t _index{0};
+    };
+
+    VDMSClientPool(std::string username,
+                   std::string password,
+                   std::size_t size,
+                   const VDMSClientConfig& config  = {},
+                   VDMSClientPoolMetrics* metrics = nullptr);
+    VDMSClientPool(std::string api_key,
+                   std::size_t size,
+                   const VDMSClientConfig& config  = {},
+                   VDMSClientPoolMetrics* metrics = nullptr);
+    ~VDMSClientPool();
+
+    NOT_COPYABLE(VDMSClientPool);
+    NOT_MOVEABLE(VDMSClientPool);
+
+    // Blocks until a connection is free.
+    Lease lease();
+
+    // Blocking call, on any free connection
+    VDMS::Response query(const std::string& json_query,
+                         const std::vector< std::string* > blobs = {});
+
+    std::size_t size() const;
+
+   private:
+    VDMSClientPool(std::unique_ptr< Session > session,
+                   std::size_t size,
+                   const VDMSClientConfig& config,
+                   VDMSClientPoolMetrics* metrics);
+
+    uint32_t pop();
+    bool try_pop(uint32_t& index);
+    void push(uint32_t index);
+
+    std::unique_ptr< Session > _session;
+    std::vector< std::unique_ptr< TokenBasedVDMSClient > > _clients;
+    VDMSClientPoolMetrics* _metrics;
+
+    // Free list: a stack of connection indices, linked through _next.
+    // The upper half of _head counts updates, so that a stale head is
+    // never mistaken for the current one (ABA).
+    std::unique_ptr< std::atomic< uint32_t >[] > _next;
+    std::atomic< uint64_t > _head;
+
+    // Only used while the free list is empty.
+    std::atomic< int > _waiters{0};
+    std::mutex _wait_mutex;
+    std::condition_variable _wait_cv;
+};
+
+};  // namespace VDMS
@@ -9,9 +9,20 @@
 namespace comm
 {
 
+// Addresses of the form "unix:<path>" name a Unix domain socket, and have
+// no port.
+const char UNIX_ADDRESS_PREFIX[] = "unix:";
+
 struct Address {
     std::string addr;
     int port;
+
+    bool is_unix() const
+    {
+        return addr.compare(0, sizeof(UNIX_ADDRESS_PREFIX) - 1, UNIX_ADDRESS_PREFIX) == 0;
+    }
+
+    std::string unix_path() const { return addr.substr(sizeof(UNIX_ADDRESS_PREFIX) - 1); }
 };
 
 };  // namespace comm
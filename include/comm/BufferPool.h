@@ -0,0 +1,77 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "util/Macros.h"
+
+namespace comm
+{
+
+// Process-wide pool of message buffers shared by all connections.
+//
+// Buffers are grouped in power-of-two size classes, so a connection that
+// alternates between small replies and large blobs keeps drawing from the
+// same few allocations. The total amount of memory held by the pool is
+// capped by a high-water mark; when it is exceeded, the largest idle
+// buffers are freed first.
+class BufferPool
+{
+   public:
+    using Buffer = std::basic_string< uint8_t >;
+
+    // Buffer acquired for the length of a scope, and released when it ends,
+    // even when it ends with an exception.
+    class Lease
+    {
+       public:
+        explicit Lease(std::size_t size) : _buffer(instance().acquire(size)) {}
+        ~Lease() { instance().release(std::move(_buffer)); }
+
+        NOT_COPYABLE(Lease);
+        NOT_MOVEABLE(Lease);
+
+        Buffer& buffer() { return _buffer; }
+
+       private:
+        Buffer _buffer;
+    };
+
+    static BufferPool& instance();
+
+    NOT_COPYABLE(BufferPool);
+    NOT_MOVEABLE(BufferPool);
+
+    // Returns an empty buffer whose capacity is at least 'size' bytes.
+    Buffer acquire(std::size_t size);
+
+    // Hands a buffer back to the pool. The buffer may be freed right away
+    // if keeping it would push the pool above its high-water mark.
+    void release(Buffer&& buffer);
+
+    void set_high_water_mark(std::size_t bytes);
+    std::size_t high_water_mark() const;
+    std::size_t pooled_bytes() const;
+
+    // Frees every idle buffer.
+    void clear();
+
+   private:
+    BufferPool();
+
+    static std::size_t size_class(std::size_t size);
+    void trim(std::size_t limit);
+
+    mutable std::mutex _mutex;
+    std::vector< std::vector< Buffer > > _free_buffers;
+    std::size_t _pooled_bytes{0};
+    std::size_t _high_water_mark;
+};
+
+};  // namespace comm
@@ -0,0 +1,60 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "comm/Enum.h"
+#include "util/Macros.h"
+
+namespace comm
+{
+
+ENUM_FLAGS(Compression, uint32_t){None = 0, LZ4 = 1 << 0, Zstd = 1 << 1};
+
+// Optional features a peer offers during the handshake. Each connection
+// ends up with the ones both peers offered; peers that predate capability
+// negotiation offer none. A value of 0 means the peer has no preference.
+struct Capabilities {
+    // Codecs the peer can decode.
+    Compression compression{Compression::None};
+    // Largest message, in bytes, the peer is willing to receive.
+    uint64_t max_frame_size{0};
+    // Requests a client may have in flight before reading responses.
+    uint32_t pipelining_depth{0};
+    // Interval between keepalive probes on an idle connection.
+    uint32_t keepalive_ms{0};
+    // Id of the CompressionDictionary the peer loaded. Set by ConnClient
+    // and ConnServer from their configuration.
+    uint32_t dictionary_id{0};
+    // Whether the peer accepts messages split over several frames. Set by
+    // ConnClient and ConnServer, which always offer it.
+    bool chunked_messages{false};
+    // Whether the peer can carry the connection over shared memory. Set by
+    // ConnClient and ConnServer, when configured to, on Unix domain sockets.
+    bool shared_memory{false};
+
+    Capabilities() = default;
+
+    explicit Capabilities(Compression compression_,
+                          uint64_t max_frame_size_   = 0,
+                          uint32_t pipelining_depth_ = 0,
+                          uint32_t keepalive_ms_     = 0)
+        : compression(compression_)
+        , max_frame_size(max_frame_size_)
+        , pipelining_depth(pipelining_depth_)
+        , keepalive_ms(keepalive_ms_)
+    {
+    }
+
+    MOVEABLE_BY_DEFAULT(Capabilities);
+    COPYABLE_BY_DEFAULT(Capabilities);
+
+    // What a connection between a peer offering these and one offering
+    // 'other' can use. The result is the same on both sides.
+    Capabilities intersect(const Capabilities& other) const;
+};
+
+}  // namespace comm
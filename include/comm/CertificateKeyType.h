@@ -0,0 +1,15 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#pragma once
+
+namespace comm
+{
+
+// Key algorithm for auto-generated server certificates.
+// ECDSA and Ed25519 keys are much faster to generate than RSA ones,
+// and make for cheaper handshakes.
+enum class CertificateKeyType { RSA_2048, ECDSA_P256, Ed25519 };
+
+}  // namespace comm
@@ -0,0 +1,61 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "util/Macros.h"
+
+namespace comm
+{
+
+// A zstd dictionary both ends of a connection load, to compress many small,
+// similar messages (such as queries that only differ in property values)
+// far better than each could be compressed on its own.
+//
+// Dictionaries are identified by the id zstd stores in them, which peers
+// exchange during the handshake: a connection only uses a dictionary if
+// both peers loaded the same one. Thread-safe.
+class CompressionDictionary final
+{
+   public:
+    // 'content' must be a dictionary in zstd format, as train() makes.
+    // Throws ProtocolError otherwise.
+    explicit CompressionDictionary(std::string content, int level = 3);
+    ~CompressionDictionary();
+
+    NOT_COPYABLE(CompressionDictionary);
+    NOT_MOVEABLE(CompressionDictionary);
+
+    // Reads a dictionary from a file. Throws ReadFail if it cannot be read.
+    static std::shared_ptr< const CompressionDictionary > load(const std::string& path,
+                                                               int level = 3);
+
+    // Builds dictionary content, of up to 'max_size' bytes, from typical
+    // messages. A few hundred samples is a good start.
+    static std::string train(const std::vector< std::string >& samples,
+                             size_t max_size = 16 * 1024);
+
+    uint32_t id() const;
+
+    void compress(const char* data, size_t size, std::string& output) const;
+
+    // Throws InvalidMessageSize if the data decompresses to more than
+    // 'max_size' bytes, and ProtocolError if it is not valid.
+    void decompress(const char* data, size_t size, size_t max_size, std::string& output) const;
+
+   private:
+    struct Dictionaries;
+
+    std::string _content;
+    uint32_t _id;
+    std::unique_ptr< Dictionaries > _dictionaries;
+};
+
+}  // namespace comm
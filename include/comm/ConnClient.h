@@ -36,29 +36,80 @@
 #include <openssl/ssl.h>
 
 #include "comm/Address.h"
+#include "comm/Capabilities.h"
 #include "comm/Connection.h"
+#include "comm/Deadline.h"
 #include "util/Macros.h"
 #include "comm/Protocol.h"
+#include "comm/SocketTuning.h"
+#include "comm/TLSPolicy.h"
 
 namespace comm
 {
 
+class CompressionDictionary;
+
 struct ConnClientConfig {
     Protocol allowed_protocols{Protocol::TCP};
     std::string ca_certificate{};
     bool verify_certificate{false};
     ConnMetrics* metrics{nullptr};
+    // Plain TCP only; ignored if the kernel lacks io_uring.
+    bool use_io_uring{false};
+    // Kernel TLS offload, when OpenSSL and the kernel support it.
+    bool enable_ktls{false};
+    // Resume sessions from earlier connections to the same server.
+    bool resume_tls_sessions{true};
+    TLSPolicy tls_policy{};
+    // Offered to the server during the handshake.
+    Capabilities capabilities{};
+    // Used with servers that loaded the same one. See Connection::dictionary().
+    std::shared_ptr< const CompressionDictionary > dictionary{};
+    SocketTuning socket_tuning{};
+    // Over a Unix domain socket, move messages through shared memory if
+    // the server agrees. Plain TCP only.
+    bool use_shared_memory{false};
+    // How long connecting to the server may take, across all of its
+    // addresses. 0 leaves it to the kernel, which can take minutes to give
+    // up on an address that does not answer.
+    unsigned connect_timeout_ms{0};
+    // Retry with the version 1 hello when the server hangs up on the
+    // current one before answering, as servers from before version 2 do.
+    bool legacy_fallback{true};
+    // Limit on the messages the server sends in several frames; 0 keeps
+    // the default. See Connection::set_max_message_size().
+    uint64_t max_message_size{0};
 
     ConnClientConfig() = default;
 
     ConnClientConfig(Protocol allowed_protocols_,
-                     std::string ca_certificate_ = "",
-                     bool verify_certificate_    = false,
-                     ConnMetrics* metrics_       = nullptr)
+                     std::string ca_certificate_  = "",
+                     bool verify_certificate_     = false,
+                     ConnMetrics* metrics_        = nullptr,
+                     bool use_io_uring_           = false,
+                     bool enable_ktls_            = false,
+                     bool resume_tls_sessions_    = true,
+                     TLSPolicy tls_policy_        = {},
+                     Capabilities capabilities_   = {},
+                     SocketTuning socket_tuning_  = {},
+                     bool use_shared_memory_      = false,
+                     unsigned connect_timeout_ms_ = 0,
+                     bool legacy_fallback_        = true,
+                     uint64_t max_message_size_   = 0)
         : allowed_protocols(allowed_protocols_)
         , ca_certificate(std::move(ca_certificate_))
         , verify_certificate(verify_certificate_)
         , metrics(metrics_)
+        , use_io_uring(use_io_uring_)
+        , enable_ktls(enable_ktls_)
+        , resume_tls_sessions(resume_tls_sessions_)
+        , tls_policy(std::move(tls_policy_))
+        , capabilities(std::move(capabilities_))
+        , socket_tuning(std::move(socket_tuning_))
+        , use_shared_memory(use_shared_memory_)
+        , connect_timeout_ms(connect_timeout_ms_)
+        , legacy_fallback(legacy_fallback_)
+        , max_message_size(max_message_size_)
     {
     }
 
@@ -76,7 +127,10 @@ class ConnClient final
     MOVEABLE_BY_DEFAULT(ConnClient);
     NOT_COPYABLE(ConnClient);
 
-    std::shared_ptr< Connection > connect();
+    // Connects, and goes through the handshake, unless already connected.
+    // Throws Timeout if that is not done by 'deadline'. The connection
+    // comes out without a deadline of its own; see Connection::set_deadline().
+    std::shared_ptr< Connection > connect(const Deadline& deadline = {});
 
    private:
     ConnClientConfig _config;
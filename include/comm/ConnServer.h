@@ -34,15 +34,20 @@
 
 #include <openssl/ssl.h>
 
+#include "comm/Capabilities.h"
+#include "comm/CertificateKeyType.h"
 #include "comm/Connection.h"
 #include "util/Macros.h"
 #include "comm/Protocol.h"
+#include "comm/SocketTuning.h"
+#include "comm/TLSPolicy.h"
 
 class OpenSSLInitializer;
 
 namespace comm
 {
 
+class CompressionDictionary;
 class TCPSocket;
 
 struct ConnServerConfig {
@@ -52,21 +57,73 @@ struct ConnServerConfig {
     std::string tls_certificate{};
     std::string tls_private_key{};
     ConnMetrics* metrics{nullptr};
+    // Plain TCP only; ignored if the kernel lacks io_uring.
+    bool use_io_uring{false};
+    // Kernel TLS offload, when OpenSSL and the kernel support it.
+    bool enable_ktls{false};
+    // Seconds each session ticket key is used for; 0 disables tickets.
+    unsigned session_ticket_rotation{3600};
+    // Key type of the auto-generated certificate.
+    CertificateKeyType certificate_key_type{CertificateKeyType::ECDSA_P256};
+    // File where the auto-generated certificate is kept, and reused from
+    // until it gets close to expiring. Empty to generate one every time.
+    std::string certificate_cache{};
+    TLSPolicy tls_policy{};
+    // Offered to clients during the handshake.
+    Capabilities capabilities{};
+    // Used with clients that loaded the same one. See Connection::dictionary().
+    std::shared_ptr< const CompressionDictionary > dictionary{};
+    // Applied to the listening socket, and inherited by accepted ones.
+    SocketTuning socket_tuning{};
+    // Listen on this Unix domain socket instead of the TCP port, for
+    // clients on the same host. See Address::is_unix(). The socket is
+    // created with the permissions the process umask leaves, which decide
+    // which local users may connect. A stale socket left at the path is
+    // replaced, but not one a running server still listens on.
+    std::string unix_socket_path{};
+    // Let clients on the Unix domain socket move messages through shared
+    // memory. Plain TCP only, and not for connections of an EventLoop.
+    bool use_shared_memory{false};
+    // Limit on the messages clients send in several frames; 0 keeps the
+    // default. See Connection::set_max_message_size().
+    uint64_t max_message_size{0};
 
     ConnServerConfig() = default;
 
     ConnServerConfig(Protocol allowed_protocols_,
-                     bool auto_generate_certificate_ = true,
-                     std::string ca_certificate_     = "",
-                     std::string tls_certificate_    = "",
-                     std::string tls_private_key_    = "",
-                     ConnMetrics* metrics_           = nullptr)
+                     bool auto_generate_certificate_          = true,
+                     std::string ca_certificate_              = "",
+                     std::string tls_certificate_             = "",
+                     std::string tls_private_key_             = "",
+                     ConnMetrics* metrics_                    = nullptr,
+                     bool use_io_uring_                       = false,
+                     bool enable_ktls_                        = false,
+                     unsigned session_ticket_rotation_        = 3600,
+                     CertificateKeyType certificate_key_type_ = CertificateKeyType::ECDSA_P256,
+                     std::string certificate_cache_           = "",
+                     TLSPolicy tls_policy_                    = {},
+                     Capabilities capabilities_               = {},
+                     SocketTuning socket_tuning_              = {},
+                     std::string unix_socket_path_            = "",
+                     bool use_shared_memory_                  = false,
+                     uint64_t max_message_size_               = 0)
         : allowed_protocols(allowed_protocols_)
         , auto_generate_certificate(auto_generate_certificate_)
         , ca_certificate(std::move(ca_certificate_))
         , tls_certificate(std::move(tls_certificate_))
         , tls_private_key(std::move(tls_private_key_))
         , metrics(metrics_)
+        , use_io_uring(use_io_uring_)
+        , enable_ktls(enable_ktls_)
+        , session_ticket_rotation(session_ticket_rotation_)
+        , certificate_key_type(certificate_key_type_)
+        , certificate_cache(std::move(certificate_cache_))
+        , tls_policy(std::move(tls_policy_))
+        , capabilities(std::move(capabilities_))
+        , socket_tuning(std::move(socket_tuning_))
+        , unix_socket_path(std::move(unix_socket_path_))
+        , use_shared_memory(use_shared_memory_)
+        , max_message_size(max_message_size_)
     {
     }
 
@@ -77,6 +134,9 @@ struct ConnServerConfig {
 // Implementation of a server
 class ConnServer final
 {
+    friend class EventLoop;
+    friend class HandshakeExecutor;
+
    public:
     explicit ConnServer(int port, ConnServerConfig config = {});
     ~ConnServer();
@@ -89,6 +149,11 @@ class ConnServer final
     std::unique_ptr< Connection > negotiate_protocol(std::shared_ptr< Connection > conn);
 
    private:
+    // The EventLoop can only serve connections over sockets.
+    // See HandshakeExecutorConfig::offer_shared_memory.
+    std::unique_ptr< Connection > negotiate_protocol(std::shared_ptr< Connection > conn,
+                                                     bool allow_shared_memory);
+
     ConnServerConfig _config;
     std::unique_ptr< TCPSocket > _listening_socket;
     OpenSSLInitializer& _open_ssl_initializer;
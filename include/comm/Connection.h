@@ -30,13 +30,23 @@
 
 #pragma once
 
+#include <functional>
 #include <string>
 #include <memory>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "comm/Capabilities.h"
+#include "comm/Deadline.h"
 #include "util/Macros.h"
 
 namespace comm
 {
 
+class CompressionDictionary;
+
 class ConnMetrics
 {
    public:
@@ -45,8 +55,24 @@ class ConnMetrics
     virtual void observe_bytes_recv(std::size_t bytes_recv);
 };
 
+// A view over a piece of a message body. Fragments passed to
+// Connection::send_message are sent back-to-back as one message, without
+// being copied into a contiguous buffer first.
+struct MessageFragment {
+    const uint8_t* data{nullptr};
+    size_t size{0};
+};
+
+// Receives a message piece by piece, see Connection::recv_message().
+using MessageSink = std::function< void(const uint8_t* data, size_t size) >;
+
 class Connection
 {
+    friend class ConnClient;
+    friend class ConnServer;
+    friend class EventLoop;
+    friend class HandshakeExecutor;
+
    public:
     explicit Connection(ConnMetrics* metrics = nullptr);
     virtual ~Connection();
@@ -54,13 +80,56 @@ class Connection
     MOVEABLE_BY_DEFAULT(Connection);
     NOT_COPYABLE(Connection);
 
-    void send_message(const uint8_t* data, uint32_t size);
+    // Messages larger than a frame are split into chunks that go out in
+    // frames of their own, if the peer accepts chunked messages.
+    void send_message(const uint8_t* data, size_t size);
+    void send_message(const std::vector< MessageFragment >& fragments);
+
+    // Sends 'size' bytes of an open file, starting at 'offset', as one
+    // message. Where the transport allows it, the kernel moves the data
+    // straight from the page cache to the socket.
+    void send_file(int file_fd, off_t offset, uint64_t size);
     const std::basic_string< uint8_t >& recv_message();
 
+    // Receives the next message straight into a caller-owned buffer.
+    // The buffer is resized to fit the message; its previous content is lost,
+    // but its capacity is reused across calls.
+    void recv_message(std::basic_string< uint8_t >& message);
+
+    // Receives the next message as a sequence of pieces, each handed to
+    // 'sink' as soon as it is read, so that the message never has to be
+    // held in memory as a whole. The pieces are only valid during the call.
+    void recv_message(const MessageSink& sink);
+
     std::string msg_size_to_str_KB(uint32_t size);
     void set_max_buffer_size(uint32_t max_buffer_size);
     bool check_message_size(uint32_t size);
 
+    // Limit on chunked messages, sent or received. Without chunking, a
+    // message has to fit in a single frame of the maximum buffer size.
+    // Defaults to DEFAULT_BUFFER_SIZE, the default limit on a single frame,
+    // so that a peer cannot make recv_message() hold more than it could
+    // before chunking; raise it only for peers trusted with the memory.
+    void set_max_message_size(uint64_t max_message_size);
+    uint64_t max_message_size() const;
+
+    // Messages smaller than this are sent uncompressed, even when the peers
+    // negotiated compression.
+    void set_compression_threshold(size_t threshold);
+
+    // Time by which the sends and receives that follow have to be done.
+    // Once it passes, they throw Timeout. If that leaves a message half
+    // sent or half received, or a receive gives up while a reply to a
+    // message sent is still due, the connection is shut down, and the sends
+    // or receives that follow throw ConnectionError. Stays in effect until
+    // replaced; a default Deadline lifts it.
+    void set_deadline(const Deadline& deadline);
+
+    // The same, for one direction only. Each may be set from the thread
+    // that sends, or receives, while the other direction is in use.
+    void set_send_deadline(const Deadline& deadline);
+    void set_recv_deadline(const Deadline& deadline);
+
     std::string source_family_name(short source_family) const;
     virtual std::string get_source() const     = 0;
     virtual short get_source_family() const    = 0;
@@ -68,14 +137,127 @@ class Connection
     virtual bool is_open()                     = 0;
     virtual void shutdown()                    = 0;
 
+    // Capabilities negotiated with the peer during the handshake.
+    const Capabilities& capabilities() const;
+
+    // Dictionary both peers loaded, if any.
+    const std::shared_ptr< const CompressionDictionary >& dictionary() const;
+
    protected:
     virtual size_t read(uint8_t* buffer, size_t length)        = 0;
     virtual size_t write(const uint8_t* buffer, size_t length) = 0;
 
+    // Gathers as much of the given buffers as possible into a single write.
+    // Returns the number of bytes written, which may be less than the total.
+    // The default implementation writes the first non-empty buffer only.
+    virtual size_t writev(const iovec* iov, int iovcnt);
+
+    // Writes up to 'count' bytes of a file. Returns the number of bytes
+    // written. The default implementation goes through a bounce buffer.
+    virtual size_t write_file(int file_fd, off_t offset, size_t count);
+
+    // Brackets the writes of a frame whose header and body go out
+    // separately. The default implementation does nothing.
+    virtual void cork(bool corked);
+
+    // Non-blocking counterparts of read() and write(), for connections
+    // served by an EventLoop: they return 0 when the socket is not ready.
+    virtual size_t read_some(uint8_t* buffer, size_t length)        = 0;
+    virtual size_t write_some(const uint8_t* buffer, size_t length) = 0;
+    virtual void set_nonblocking(bool nonblocking)                  = 0;
+    virtual int native_handle() const                               = 0;
+
+    // Waits up to 'timeout_ms' for the connection to be ready for
+    // read_some() (POLLIN) or write_some() (POLLOUT). Returns false if it
+    // timed out. The default implementation polls native_handle().
+    virtual bool wait_ready(short events, int timeout_ms);
+
+    // Records the outcome of the handshake, and lowers the message size
+    // limit to the negotiated maximum frame size. The dictionary is only
+    // kept if the peers agreed on it.
+    void set_capabilities(const Capabilities& capabilities,
+                          std::shared_ptr< const CompressionDictionary > dictionary = {});
+
     std::basic_string< uint8_t > _buffer_str{};
     uint32_t _max_buffer_size{};
+    uint64_t _max_message_size{};
 
     ConnMetrics* _metrics{nullptr};
+
+    Capabilities _capabilities{};
+    std::shared_ptr< const CompressionDictionary > _dictionary{};
+    size_t _compression_threshold{};
+
+    // Compressed frames, on their way out and in. One for each direction,
+    // as each may have a thread of its own.
+    std::basic_string< uint8_t > _send_frame_buffer{};
+    std::basic_string< uint8_t > _recv_frame_buffer{};
+
+    Deadline _send_deadline{};
+    Deadline _recv_deadline{};
+
+   private:
+    // Corks the connection for as long as it is in scope. See cork().
+    class CorkGuard;
+
+    // read(), write(), writev() and write_file(), unless a deadline is set.
+    // Then they go through the non-blocking calls instead, waiting for the
+    // connection to be ready no longer than the deadline allows.
+    size_t timed_read(uint8_t* buffer, size_t length);
+    size_t timed_write(const uint8_t* buffer, size_t length);
+    size_t timed_writev(const iovec* iov, int iovcnt);
+    size_t timed_write_file(int file_fd, off_t offset, size_t count);
+
+    // Where each direction is in the message it sends or receives. Each
+    // is only touched by its own direction, which may have a thread of its
+    // own.
+    enum class StreamState { Idle, Partial, Broken };
+
+    // Throws Timeout if the connection is not ready before the deadline.
+    // Partway through a message, or with a reply due, breaks that
+    // direction first.
+    void wait_for_deadline(short events);
+
+    // Marks a message as sent, or received, in full.
+    void end_send();
+    void end_recv();
+
+    // Throws ConnectionError if 'state' is Broken.
+    void check_stream(StreamState state) const;
+
+    // Largest chunk of a message that goes in one frame.
+    size_t chunk_size() const;
+
+    void send_frame(const std::vector< MessageFragment >& fragments, size_t size, bool continued);
+    void send_file_frame(int file_fd, off_t offset, uint32_t size, bool continued);
+
+    void recv_all(uint8_t* buffer, size_t size);
+
+    // Reads the header of the next frame, and its codec byte if compression
+    // was negotiated. Returns the size of the rest of the frame.
+    uint32_t recv_frame_header(bool& continued, uint8_t& codec);
+
+    // Reads the rest of a compressed frame, and appends its decoded body to
+    // 'message'.
+    void recv_compressed_frame(uint8_t codec,
+                               uint32_t size,
+                               uint64_t max_size,
+                               std::basic_string< uint8_t >& message);
+
+    // Appends the body of the next frame to 'message', which is cleared
+    // first if 'first' is set. Returns whether the message goes on in the
+    // next frame.
+    bool recv_frame(std::basic_string< uint8_t >& message, bool first);
+
+    StreamState _send_state{StreamState::Idle};
+    StreamState _recv_state{StreamState::Idle};
+
+    // Messages sent and received in full. While more were sent than
+    // received, replies are due, as far as the receiving side can tell.
+    // Each count is only written by its own direction; the receiving side
+    // reads the sent one with __atomic builtins.
+    uint64_t _messages_sent{0};
+    uint64_t _messages_received{0};
 };
 
 };  // namespace comm
@@ -0,0 +1,54 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+namespace comm
+{
+
+// Point in time by which a blocking call has to be done, or throw Timeout.
+// A default constructed one never passes.
+//
+//    connection->set_deadline(comm::Deadline::after(std::chrono::milliseconds(50)));
+class Deadline
+{
+   public:
+    using Clock = std::chrono::steady_clock;
+
+    Deadline() = default;
+
+    explicit Deadline(Clock::time_point when) : _when(when) {}
+
+    static Deadline after(std::chrono::milliseconds timeout)
+    {
+        return Deadline(Clock::now() + timeout);
+    }
+
+    bool is_set() const { return _when != Clock::time_point::max(); }
+
+    bool passed() const { return is_set() && Clock::now() >= _when; }
+
+    // Time left, rounded up to the millisecond, as poll(2) takes it: -1
+    // for no deadline, 0 once it passed.
+    int remaining_ms() const
+    {
+        if (!is_set()) {
+            return -1;
+        }
+
+        auto left = std::chrono::ceil< std::chrono::milliseconds >(_when - Clock::now()).count();
+
+        return static_cast< int >(
+            std::clamp< decltype(left) >(left, 0, std::numeric_limits< int >::max()));
+    }
+
+   private:
+    Clock::time_point _when{Clock::time_point::max()};
+};
+
+}  // namespace comm
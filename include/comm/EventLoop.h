@@ -0,0 +1,147 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "comm/Connection.h"
+#include "comm/HandshakeExecutor.h"
+#include "util/Macros.h"
+
+namespace comm
+{
+
+class ConnServer;
+class WorkerPool;
+
+// Called on a worker thread for every message an EventLoop receives.
+// The returned buffer is sent back to the peer as the response.
+// Throwing closes the connection the request came from.
+using RequestHandler = std::function< std::basic_string< uint8_t >(
+    const Connection& connection, std::basic_string< uint8_t >& request) >;
+
+struct EventLoopConfig {
+    unsigned worker_threads{4};
+    unsigned max_events{256};           // Readiness events handled per wakeup
+    unsigned max_queued_requests{16};   // Per connection, before it is no longer read
+    unsigned max_reads_per_wakeup{16};  // Per connection, before the others get a turn
+    // Threads and timeout for the protocol handshakes of new connections.
+    // Shared memory is never offered.
+    HandshakeExecutorConfig handshakes{};
+
+    EventLoopConfig() = default;
+
+    explicit EventLoopConfig(unsigned worker_threads_,
+                             unsigned max_events_                = 256,
+                             unsigned max_queued_requests_       = 16,
+                             unsigned max_reads_per_wakeup_      = 16,
+                             HandshakeExecutorConfig handshakes_ = {})
+        : worker_threads(worker_threads_)
+        , max_events(max_events_)
+        , max_queued_requests(max_queued_requests_)
+        , max_reads_per_wakeup(max_reads_per_wakeup_)
+        , handshakes(std::move(handshakes_))
+    {
+    }
+
+    MOVEABLE_BY_DEFAULT(EventLoopConfig);
+    COPYABLE_BY_DEFAULT(EventLoopConfig);
+};
+
+// Event-driven mode for a ConnServer.
+//
+// Instead of one blocking thread per connection, a single thread waits on
+// epoll for the listening socket and every accepted connection, which are
+// switched to non-blocking mode once the protocol handshake is done. The
+// handshakes run on a HandshakeExecutor, so a client that stalls its own
+// is dropped once it times out.
+// Incoming bytes are reassembled into messages as they arrive, and complete
+// messages are handed to a pool of worker threads running the handler.
+// Requests from one connection are handled one at a time, in order, so
+// responses go back in the order the requests came in.
+//
+// A connection is not read from while max_queued_requests of its requests
+// are waiting, and the next request is not handled until the previous
+// response was taken by the socket, so a peer that sends without reading
+// is held back by TCP flow control instead of growing the queue.
+//
+//    comm::ConnServer server(port, config);
+//    comm::EventLoop loop(server, handler);
+//    loop.run();  // Until loop.stop() is called from another thread.
+class EventLoop final
+{
+   public:
+    EventLoop(ConnServer& server, RequestHandler handler, EventLoopConfig config = {});
+    ~EventLoop();
+
+    NOT_COPYABLE(EventLoop);
+    NOT_MOVEABLE(EventLoop);
+
+    // Serves connections until stop() is called.
+    void run();
+
+    // Makes run() return. Safe to call from any thread.
+    void stop();
+
+    // Number of connections currently registered with the loop.
+    std::size_t connections() const;
+
+   private:
+    struct Client;
+
+    // Something a worker thread needs the loop thread to do.
+    struct Event {
+        uint64_t client_id{0};
+        std::unique_ptr< Connection > connection{};  // Set for a new connection
+        std::basic_string< uint8_t > response{};
+        bool failed{false};
+    };
+
+    void accept_connections();
+    void process_events();
+    void add_client(std::unique_ptr< Connection > connection);
+    void remove_client(uint64_t id);
+    void receive(const std::shared_ptr< Client >& client);
+    void respond(Client& client, std::basic_string< uint8_t >&& response);
+    // Appends one frame of a response to the client's output.
+    void frame(Client& client, const uint8_t* data, size_t size, bool continued);
+    void flush(Client& client);
+    void dispatch(const std::shared_ptr< Client >& client);
+    // Updates what epoll reports for the client, to match its state.
+    void watch(Client& client);
+    // Receives from connections that still had data when they ran out of
+    // reads, or that were let back in after their queue drained.
+    void receive_pending();
+    void post(Event&& event);
+
+    ConnServer& _server;
+    RequestHandler _handler;
+    EventLoopConfig _config;
+
+    int _epoll_fd{-1};
+    int _wakeup_fd{-1};
+    std::atomic< bool > _stop{false};
+
+    std::mutex _events_mutex{};
+    std::vector< Event > _events{};
+
+    std::unordered_map< uint64_t, std::shared_ptr< Client > > _clients{};
+    std::vector< uint64_t > _pending{};
+    std::atomic< std::size_t > _number_of_clients{0};
+    uint64_t _next_client_id;
+
+    // Destroyed first, as pending tasks refer to the members above.
+    std::unique_ptr< WorkerPool > _workers;
+    std::unique_ptr< HandshakeExecutor > _handshakes;
+};
+
+};  // namespace comm
@@ -0,0 +1,129 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "comm/Connection.h"
+#include "util/Macros.h"
+
+namespace comm
+{
+
+class ConnServer;
+class WorkerPool;
+
+struct HandshakeExecutorConfig {
+    unsigned threads{4};
+    // Time a client gets to complete the whole handshake.
+    unsigned timeout_ms{5000};
+    // Off for consumers that wait on the sockets of the connections, like
+    // the EventLoop, as shared memory connections have none to wait on.
+    bool offer_shared_memory{true};
+
+    HandshakeExecutorConfig() = default;
+
+    explicit HandshakeExecutorConfig(unsigned threads_,
+                                     unsigned timeout_ms_      = 5000,
+                                     bool offer_shared_memory_ = true)
+        : threads(threads_), timeout_ms(timeout_ms_), offer_shared_memory(offer_shared_memory_)
+    {
+    }
+
+    MOVEABLE_BY_DEFAULT(HandshakeExecutorConfig);
+    COPYABLE_BY_DEFAULT(HandshakeExecutorConfig);
+};
+
+// Runs ConnServer::negotiate_protocol for accepted connections on a pool of
+// threads, so a slow client never holds up the accept loop or the clients
+// behind it. Each handshake has a deadline; a client that misses it has its
+// socket shut down, and is dropped. Negotiated connections are handed out in
+// the order they become ready.
+//
+//    comm::HandshakeExecutor handshakes(server);
+//
+//    // Accepting thread:
+//    handshakes.submit(server.accept());
+//
+//    // Serving thread:
+//    while (auto connection = handshakes.next()) { ... }
+class HandshakeExecutor final
+{
+   public:
+    // Called with each negotiated connection, on the thread that negotiated it.
+    using ReadyHandler = std::function< void(std::unique_ptr< Connection > connection) >;
+
+    explicit HandshakeExecutor(ConnServer& server, HandshakeExecutorConfig config = {});
+
+    // Hands negotiated connections to 'on_ready', rather than to next().
+    HandshakeExecutor(ConnServer& server, HandshakeExecutorConfig config, ReadyHandler on_ready);
+    ~HandshakeExecutor();
+
+    NOT_COPYABLE(HandshakeExecutor);
+    NOT_MOVEABLE(HandshakeExecutor);
+
+    // Queues an accepted connection for negotiation. Never blocks.
+    void submit(std::unique_ptr< Connection > connection);
+
+    // Waits for the next negotiated connection.
+    // Returns nullptr once stop() has been called.
+    std::unique_ptr< Connection > next();
+
+    // As above, but also returns nullptr if nothing is ready within 'timeout'.
+    std::unique_ptr< Connection > next(std::chrono::milliseconds timeout);
+
+    // Aborts handshakes in flight and wakes up callers of next().
+    // Connections already negotiated are closed when the executor is destroyed.
+    void stop();
+
+    // Handshakes submitted that have not completed or failed yet.
+    std::size_t pending() const;
+
+    // Handshakes that failed or timed out since the executor was created.
+    std::size_t failed() const;
+
+   private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Handshake {
+        // A duplicate of the socket's descriptor, which keeps it from being
+        // closed and reused while the watchdog may still shut it down.
+        int fd{-1};
+        Clock::time_point deadline{};
+        bool timed_out{false};
+    };
+
+    void negotiate(uint64_t id, const std::shared_ptr< Connection >& connection);
+    void watch();
+
+    ConnServer& _server;
+    HandshakeExecutorConfig _config;
+    ReadyHandler _on_ready;
+
+    mutable std::mutex _mutex{};
+    std::condition_variable _ready_cv{};
+    std::condition_variable _watchdog_cv{};
+    std::deque< std::unique_ptr< Connection > > _ready{};
+    std::map< uint64_t, Handshake > _in_flight{};
+    std::size_t _pending{0};
+    std::size_t _failed{0};
+    uint64_t _next_id{0};
+    bool _stop{false};
+
+    std::thread _watchdog;
+
+    // Destroyed first, as pending tasks refer to the members above.
+    std::unique_ptr< WorkerPool > _workers;
+};
+
+};  // namespace comm
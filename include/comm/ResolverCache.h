@@ -0,0 +1,89 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/socket.h>
+
+#include "util/Macros.h"
+
+namespace comm
+{
+
+struct ResolvedAddress {
+    int family{AF_UNSPEC};
+    socklen_t length{0};
+    sockaddr_storage address{};
+};
+
+// Process-wide cache of name resolutions, consulted by TCPSocket::connect(),
+// so that pools refilling, or clients reconnecting all at once, do not each
+// go to the resolver. Threads looking up a name that is being resolved wait
+// for that lookup rather than starting their own.
+//
+// getaddrinfo() does not tell how long the records it found may be kept,
+// so entries expire after a fixed time to live. Failed lookups are not
+// cached.
+class ResolverCache
+{
+   public:
+    using Addresses = std::vector< ResolvedAddress >;
+
+    static ResolverCache& instance();
+
+    NOT_COPYABLE(ResolverCache);
+    NOT_MOVEABLE(ResolverCache);
+
+    // Addresses of 'host', with 'port' filled in, in the order the resolver
+    // returned them. Throws ServerAddError if the name does not resolve.
+    Addresses resolve(const std::string& host, int port);
+
+    // Forgets 'host', e.g. once none of its addresses answered.
+    void invalidate(const std::string& host, int port);
+
+    // Seconds entries are kept for; 0 turns the cache off.
+    void set_ttl(unsigned seconds);
+    unsigned ttl() const;
+
+    std::size_t size() const;
+    void clear();
+
+    // Lookups answered from the cache, or by waiting on a lookup already
+    // in progress, and lookups that went to the resolver.
+    uint64_t hits() const;
+    uint64_t misses() const;
+
+   private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        std::shared_future< Addresses > addresses{};
+        Clock::time_point expires{};
+    };
+
+    static constexpr std::size_t MAX_ENTRIES = 1024;
+
+    ResolverCache();
+
+    static Addresses lookup(const std::string& host, int port);
+
+    // Makes room for one more entry. Expects the mutex to be held.
+    void evict(Clock::time_point now);
+
+    mutable std::mutex _mutex;
+    std::unordered_map< std::string, Entry > _entries;
+    unsigned _ttl;
+    uint64_t _hits{0};
+    uint64_t _misses{0};
+};
+
+};  // namespace comm
@@ -0,0 +1,75 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "util/Macros.h"
+
+namespace comm
+{
+
+// Socket options for the network a connection runs over. The defaults
+// leave everything to the kernel, which caps throughput on fast links with
+// a long round trip: the send and receive buffers it autotunes to stay
+// well under the bandwidth-delay product of a 10 or 25GbE path.
+struct SocketTuning {
+    // Expected bandwidth of the path, in bits per second, and its round
+    // trip time. When both are set, the send and receive buffers are sized
+    // to hold their product, unless autotuning, which setting them turns
+    // off, would grow them that far anyway (see net.ipv4.tcp_wmem and
+    // net.ipv4.tcp_rmem).
+    uint64_t bandwidth_bps{0};
+    uint32_t rtt_us{0};
+    // SO_SNDBUF and SO_RCVBUF, in bytes, overriding the product above.
+    // Always set, which turns autotuning off. The kernel caps them at
+    // net.core.wmem_max and net.core.rmem_max.
+    uint32_t send_buffer_size{0};
+    uint32_t receive_buffer_size{0};
+    // TCP_NOTSENT_LOWAT: how much unsent data the kernel queues before the
+    // socket stops accepting more. Keeps latency down on a busy connection.
+    uint32_t notsent_lowat{0};
+    // TCP_CORK while a file is sent, so its frame header leaves in the same
+    // segment as the start of its content.
+    bool cork{false};
+    // SO_BUSY_POLL: microseconds blocking reads spin on the device queue
+    // before sleeping. May need CAP_NET_ADMIN; ignored if refused.
+    uint32_t busy_poll_us{0};
+
+    SocketTuning() = default;
+
+    explicit SocketTuning(uint64_t bandwidth_bps_,
+                          uint32_t rtt_us_              = 0,
+                          uint32_t send_buffer_size_    = 0,
+                          uint32_t receive_buffer_size_ = 0,
+                          uint32_t notsent_lowat_       = 0,
+                          bool cork_                    = false,
+                          uint32_t busy_poll_us_        = 0)
+        : bandwidth_bps(bandwidth_bps_)
+        , rtt_us(rtt_us_)
+        , send_buffer_size(send_buffer_size_)
+        , receive_buffer_size(receive_buffer_size_)
+        , notsent_lowat(notsent_lowat_)
+        , cork(cork_)
+        , busy_poll_us(busy_poll_us_)
+    {
+    }
+
+    MOVEABLE_BY_DEFAULT(SocketTuning);
+    COPYABLE_BY_DEFAULT(SocketTuning);
+
+    // Bulk transfers, such as blob uploads, over a path of the given
+    // bandwidth and round trip time.
+    static SocketTuning high_throughput(uint64_t bandwidth_bps, uint32_t rtt_us);
+
+    // Small requests and responses, on a connection kept busy.
+    static SocketTuning low_latency();
+
+    // Send and receive buffer sizes, in bytes, or 0 for the kernel default.
+    uint32_t send_buffer() const;
+    uint32_t receive_buffer() const;
+};
+
+}  // namespace comm
@@ -0,0 +1,52 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "util/Macros.h"
+
+namespace comm
+{
+
+enum class TLSVersion { TLS1_2, TLS1_3 };
+
+// Which AEAD the TLS 1.3 cipher suites favor. Auto keeps OpenSSL's
+// suites, which favor AES-GCM, when the CPU has AES instructions, and puts
+// ChaCha20-Poly1305 first otherwise, as it is faster in software.
+enum class CipherPreference { Auto, AES_GCM, ChaCha20 };
+
+struct TLSPolicy {
+    TLSVersion min_version{TLSVersion::TLS1_2};
+    CipherPreference cipher_preference{CipherPreference::Auto};
+    // TLS 1.3 suites in OpenSSL syntax, e.g. "TLS_AES_128_GCM_SHA256".
+    // Overrides cipher_preference when set.
+    std::string cipher_suites{};
+    // TLS 1.2 cipher list in OpenSSL syntax. OpenSSL defaults when empty.
+    std::string cipher_list{};
+    // Key exchange groups, most preferred first, e.g. "X25519:P-256".
+    // OpenSSL defaults when empty.
+    std::string groups{};
+
+    TLSPolicy() = default;
+
+    explicit TLSPolicy(TLSVersion min_version_,
+                       CipherPreference cipher_preference_ = CipherPreference::Auto,
+                       std::string cipher_suites_          = "",
+                       std::string cipher_list_            = "",
+                       std::string groups_                 = "")
+        : min_version(min_version_)
+        , cipher_preference(cipher_preference_)
+        , cipher_suites(std::move(cipher_suites_))
+        , cipher_list(std::move(cipher_list_))
+        , groups(std::move(groups_))
+    {
+    }
+
+    MOVEABLE_BY_DEFAULT(TLSPolicy);
+    COPYABLE_BY_DEFAULT(TLSPolicy);
+};
+
+}  // namespace comm
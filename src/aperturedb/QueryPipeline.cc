@@ -0,0 +1,134 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#include "aperturedb/QueryPipeline.h"
+
+#include <algorithm>
+
+using namespace VDMS;
+
+QueryPipeline::QueryPipeline(Receiver receive, Aborter abort, std::size_t max_in_flight)
+    : _receive(std::move(receive))
+    , _abort(std::move(abort))
+    , _max_in_flight(std::max< std::size_t >(max_in_flight, 1))
+    , _send_mutex()
+    , _mutex()
+    , _cv()
+    , _pending()
+    , _error()
+    , _receiver()
+{
+    _receiver = std::thread(&QueryPipeline::receive_loop, this);
+}
+
+QueryPipeline::~QueryPipeline()
+{
+    bool receiving;
+
+    {
+        std::lock_guard< std::mutex > lock(_mutex);
+        _stop     = true;
+        receiving = !_pending.empty();
+    }
+
+    _cv.notify_all();
+
+    // Responses that are still on their way will never be read.
+    if (receiving) {
+        _abort();
+    }
+
+    _receiver.join();
+}
+
+std::future< ResponseView > QueryPipeline::submit(const Sender& send)
+{
+    // Held until the promise is queued, so that queue order is send order.
+    std::lock_guard< std::mutex > send_lock(_send_mutex);
+
+    {
+        std::unique_lock< std::mutex > lock(_mutex);
+
+        _cv.wait(lock, [this] { return _error || _pending.size() < _max_in_flight; });
+
+        if (_error) {
+            std::rethrow_exception(_error);
+        }
+    }
+
+    try {
+        send();
+    } catch (...) {
+        // A partially sent query leaves the stream unusable.
+        fail(std::current_exception());
+        throw;
+    }
+
+    std::promise< ResponseView > promise;
+    auto future = promise.get_future();
+
+    {
+        std::lock_guard< std::mutex > lock(_mutex);
+        _pending.push_back(std::move(promise));
+    }
+
+    _cv.notify_all();
+
+    return future;
+}
+
+void QueryPipeline::receive_loop()
+{
+    while (true) {
+        {
+            std::unique_lock< std::mutex > lock(_mutex);
+
+            _cv.wait(lock, [this] { return _stop || !_pending.empty(); });
+
+            if (_pending.empty() || _error) {
+                return;
+            }
+        }
+
+        try {
+            auto response = _receive();
+
+            std::promise< ResponseView > promise;
+
+            {
+                std::lock_guard< std::mutex > lock(_mutex);
+                promise = std::move(_pending.front());
+                _pending.pop_front();
+            }
+
+            _cv.notify_all();
+
+            promise.set_value(std::move(response));
+        } catch (...) {
+            fail(std::current_exception());
+            return;
+        }
+    }
+}
+
+void QueryPipeline::fail(std::exception_ptr error)
+{
+    std::deque< std::promise< ResponseView > > pending;
+
+    {
+        std::lock_guard< std::mutex > lock(_mutex);
+
+        if (!_error) {
+            _error = error;
+        }
+
+        pending.swap(_pending);
+    }
+
+    _cv.notify_all();
+
+    for (auto& promise : pending) {
+        promise.set_exception(error);
+    }
+}
@@ -0,0 +1,64 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+
+#include "aperturedb/VDMSClient.h"
+#include "util/Macros.h"
+
+namespace VDMS
+{
+
+// Keeps several queries in flight on a single connection.
+//
+// Queries are sent by the calling thread, in submission order, while a
+// background thread receives the responses and matches them to the queries
+// in the same order. Submitting blocks while 'max_in_flight' queries are
+// still waiting for their response.
+//
+// Once sending or receiving fails, the connection is left in an unknown
+// state: every pending and future query fails with the same exception.
+class QueryPipeline
+{
+   public:
+    using Sender   = std::function< void() >;
+    using Receiver = std::function< ResponseView() >;
+    using Aborter  = std::function< void() >;
+
+    // 'abort' must make a blocked 'receive' return or throw.
+    QueryPipeline(Receiver receive, Aborter abort, std::size_t max_in_flight);
+    ~QueryPipeline();
+
+    NOT_COPYABLE(QueryPipeline);
+    NOT_MOVEABLE(QueryPipeline);
+
+    std::future< ResponseView > submit(const Sender& send);
+
+   private:
+    void receive_loop();
+    void fail(std::exception_ptr error);
+
+    Receiver _receive;
+    Aborter _abort;
+    std::size_t _max_in_flight;
+
+    std::mutex _send_mutex;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque< std::promise< ResponseView > > _pending;
+    std::exception_ptr _error;
+    bool _stop{false};
+
+    std::thread _receiver;
+};
+
+};  // namespace VDMS
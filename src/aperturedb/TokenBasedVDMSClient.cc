@@ -29,57 +29,573 @@
  */
 
 #include "aperturedb/VDMSClient.h"
+
+#include <exception>
+#include <limits>
+
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "aperturedb/queryMessageWrapper.h"
 #include "aperturedb/Exception.h"
+#include "aperturedb/QueryPipeline.h"
+#include "comm/BufferPool.h"
+#include "comm/CompressionDictionary.h"
 #include "comm/ConnClient.h"
 #include "comm/Connection.h"
 #include "comm/Exception.h"
+#include "comm/Variables.h"
 
 using namespace VDMS;
 
+namespace
+{
+
+using google::protobuf::io::CodedOutputStream;
+using google::protobuf::internal::WireFormatLite;
+
+// Serializes a queryMessage straight from the caller's json, blobs and token.
+// Field headers (tag and length) are encoded into a small side buffer, and
+// field contents are referenced in place, so the request goes out on the
+// connection without the blobs ever being copied. The bytes on the wire
+// are the same queryMessage::SerializeToArray would produce.
+//
+// Given a dictionary, the json goes in the json_zstd field instead,
+// compressed, unless that would not make it any smaller.
+class QueryMessageFragments
+{
+   public:
+    QueryMessageFragments(const std::string& json,
+                          const std::vector< std::string* >& blobs,
+                          const std::string& token,
+                          const comm::CompressionDictionary* dictionary)
+        : _headers((blobs.size() + 2) * max_header_size, 0), _compressed_json(), _fragments()
+    {
+        _fragments.reserve(2 * (blobs.size() + 2));
+
+        if (dictionary && !json.empty()) {
+            dictionary->compress(json.data(), json.size(), _compressed_json);
+
+            if (_compressed_json.size() >= json.size()) {
+                _compressed_json.clear();
+            }
+        }
+
+        // Same field order, and same skipping of empty strings, as protobuf.
+        if (!json.empty() && _compressed_json.empty()) {
+            add_field(protobufs::queryMessage::kJsonFieldNumber, json);
+        }
+
+        for (auto& blob : blobs) {
+            add_field(protobufs::queryMessage::kBlobsFieldNumber, *blob);
+        }
+
+        if (!token.empty()) {
+            add_field(protobufs::queryMessage::kTokenFieldNumber, token);
+        }
+
+        if (!_compressed_json.empty()) {
+            add_field(protobufs::queryMessage::kJsonZstdFieldNumber, _compressed_json);
+        }
+    }
+
+    NOT_COPYABLE(QueryMessageFragments);
+    NOT_MOVEABLE(QueryMessageFragments);
+
+    const std::vector< comm::MessageFragment >& fragments() const { return _fragments; }
+
+   private:
+    // A varint-encoded tag, 5 bytes at most, and a varint-encoded 64-bit
+    // length, 10 bytes at most.
+    static constexpr size_t max_header_size = 5 + 10;
+
+    void add_field(int field_number, const std::string& value)
+    {
+        auto tag = WireFormatLite::MakeTag(field_number, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+
+        uint8_t* begin = _headers.data() + _headers_used;
+        uint8_t* end   = CodedOutputStream::WriteTagToArray(tag, begin);
+
+        end = CodedOutputStream::WriteVarint64ToArray(value.size(), end);
+
+        _headers_used += end - begin;
+
+        _fragments.push_back({begin, static_cast< size_t >(end - begin)});
+        _fragments.push_back({reinterpret_cast< const uint8_t* >(value.data()), value.size()});
+    }
+
+    // Sized up front: fragments point into it.
+    std::basic_string< uint8_t > _headers;
+    size_t _headers_used{0};
+    std::string _compressed_json;
+    std::vector< comm::MessageFragment > _fragments;
+};
+
+// Walks a serialized queryMessage and points json and blobs at their bytes
+// inside the message, which protobuf parsing would otherwise copy.
+// Compressed json is decompressed with the dictionary, into a buffer of its own.
+// CodedInputStream counts in ints, so larger messages throw InvalidMessageSize.
+bool parse_response_view(ResponseView& response, const comm::CompressionDictionary* dictionary)
+{
+    const auto& message = *response.message;
+
+    if (message.size() > static_cast< size_t >(std::numeric_limits< int >::max())) {
+        THROW_EXCEPTION(InvalidMessageSize, "Response too large to parse as views");
+    }
+
+    auto size = static_cast< int >(message.size());
+
+    google::protobuf::io::CodedInputStream input(message.data(), size);
+    input.SetTotalBytesLimit(size);
+
+    auto view = [&message](int offset, uint32_t length) {
+        return std::string_view(reinterpret_cast< const char* >(message.data()) + offset, length);
+    };
+
+    while (auto tag = input.ReadTag()) {
+        auto field_number = WireFormatLite::GetTagFieldNumber(tag);
+        auto wire_type    = WireFormatLite::GetTagWireType(tag);
+
+        if (wire_type == WireFormatLite::WIRETYPE_LENGTH_DELIMITED &&
+            (field_number == protobufs::queryMessage::kJsonFieldNumber ||
+             field_number == protobufs::queryMessage::kBlobsFieldNumber ||
+             field_number == protobufs::queryMessage::kJsonZstdFieldNumber)) {
+            uint32_t length;
+
+            if (!input.ReadVarint32(&length)) {
+                return false;
+            }
+
+            auto offset = input.CurrentPosition();
+
+            if (!input.Skip(static_cast< int >(length))) {
+                return false;
+            }
+
+            if (field_number == protobufs::queryMessage::kJsonFieldNumber) {
+                response.json = view(offset, length);
+            } else if (field_number == protobufs::queryMessage::kJsonZstdFieldNumber) {
+                if (!dictionary) {
+                    return false;
+                }
+
+                auto compressed = view(offset, length);
+                auto json       = std::make_shared< std::string >();
+
+                dictionary->decompress(
+                    compressed.data(), compressed.size(), comm::MAX_BUFFER_SIZE, *json);
+
+                response.json        = *json;
+                response.json_buffer = std::move(json);
+            } else {
+                response.blobs.push_back(view(offset, length));
+            }
+        } else if (!WireFormatLite::SkipField(&input, tag)) {
+            return false;
+        }
+    }
+
+    return input.ConsumedEntireMessage();
+}
+
+int open_blob_file(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd < 0) {
+        THROW_EXCEPTION(WriteFail, errno, "open()", 0);
+    }
+
+    return fd;
+}
+
+void write_blob_file(int fd, const uint8_t* data, size_t size)
+{
+    while (size > 0) {
+        auto count = ::write(fd, data, size);
+
+        if (count < 0 && errno != EINTR) {
+            THROW_EXCEPTION(WriteFail, errno, "write()", 0);
+        }
+
+        if (count > 0) {
+            data += count;
+            size -= static_cast< size_t >(count);
+        }
+    }
+}
+
+// Parses a queryMessage piece by piece, as it is received, and writes blobs
+// to files instead of keeping them in memory. Only the json is kept.
+class ResponseFileWriter
+{
+   public:
+    explicit ResponseFileWriter(const BlobPath& blob_path) : _blob_path(blob_path) {}
+
+    ~ResponseFileWriter()
+    {
+        if (_blob_fd >= 0) {
+            ::close(_blob_fd);
+        }
+    }
+
+    NOT_COPYABLE(ResponseFileWriter);
+    NOT_MOVEABLE(ResponseFileWriter);
+
+    void consume(const uint8_t* data, size_t size)
+    {
+        while (size > 0) {
+            if (_state == State::Body) {
+                auto count = static_cast< size_t >(std::min< uint64_t >(size, _remaining));
+
+                write_body(data, count);
+                data += count;
+                size -= count;
+                _remaining -= count;
+
+                if (_remaining == 0) {
+                    end_field();
+                }
+
+                continue;
+            }
+
+            // Tags, lengths and varint values come a byte at a time.
+            uint8_t byte = *data++;
+            --size;
+
+            if (_shift >= 64) {
+                THROW_EXCEPTION(ProtocolError, "Malformed varint in response");
+            }
+
+            _varint |= static_cast< uint64_t >(byte & 0x7f) << _shift;
+            _shift += 7;
+
+            if (byte & 0x80) {
+                continue;
+            }
+
+            auto value = _varint;
+            _varint    = 0;
+            _shift     = 0;
+
+            if (_state == State::Tag) {
+                start_field(value);
+            } else if (_state == State::Length) {
+                begin_body(value);
+            } else {
+                _state = State::Tag;
+            }
+        }
+    }
+
+    // Returns the json, once the whole message was consumed.
+    std::string finish(const comm::CompressionDictionary* dictionary)
+    {
+        if (_state != State::Tag || _shift != 0) {
+            THROW_EXCEPTION(ProtocolError, "Truncated response");
+        }
+
+        if (!_json_zstd.empty()) {
+            if (!dictionary) {
+                THROW_EXCEPTION(ProtocolError, "Error parsing response using protobuf message");
+            }
+
+            dictionary->decompress(
+                _json_zstd.data(), _json_zstd.size(), comm::MAX_BUFFER_SIZE, _json);
+        }
+
+        return std::move(_json);
+    }
+
+   private:
+    enum class State { Tag, Length, Value, Body };
+    enum class Target { Skip, Json, JsonZstd, Blob };
+
+    void start_field(uint64_t tag)
+    {
+        _field = static_cast< int >(tag >> 3);
+
+        switch (static_cast< WireFormatLite::WireType >(tag & 0x7)) {
+            case WireFormatLite::WIRETYPE_VARINT:
+                _state = State::Value;
+                break;
+            case WireFormatLite::WIRETYPE_LENGTH_DELIMITED:
+                _state = State::Length;
+                break;
+            case WireFormatLite::WIRETYPE_FIXED64:
+                _target    = Target::Skip;
+                _remaining = 8;
+                _state     = State::Body;
+                break;
+            case WireFormatLite::WIRETYPE_FIXED32:
+                _target    = Target::Skip;
+                _remaining = 4;
+                _state     = State::Body;
+                break;
+            case WireFormatLite::WIRETYPE_START_GROUP:
+            case WireFormatLite::WIRETYPE_END_GROUP:
+            default:
+                THROW_EXCEPTION(ProtocolError, "Error parsing response using protobuf message");
+        }
+    }
+
+    void begin_body(uint64_t length)
+    {
+        _remaining = length;
+        _state     = State::Body;
+
+        switch (_field) {
+            case protobufs::queryMessage::kJsonFieldNumber:
+                _target = Target::Json;
+                break;
+            case protobufs::queryMessage::kJsonZstdFieldNumber:
+                _target = Target::JsonZstd;
+                break;
+            case protobufs::queryMessage::kBlobsFieldNumber:
+                _target  = Target::Blob;
+                _blob_fd = open_blob_file(_blob_path(_blobs++));
+                break;
+            default:
+                _target = Target::Skip;
+                break;
+        }
+
+        if (_remaining == 0) {
+            end_field();
+        }
+    }
+
+    void write_body(const uint8_t* data, size_t size)
+    {
+        switch (_target) {
+            case Target::Json:
+                _json.append(reinterpret_cast< const char* >(data), size);
+                break;
+            case Target::JsonZstd:
+                _json_zstd.append(reinterpret_cast< const char* >(data), size);
+                break;
+            case Target::Blob:
+                write_blob_file(_blob_fd, data, size);
+                break;
+            case Target::Skip:
+                break;
+        }
+    }
+
+    void end_field()
+    {
+        if (_target == Target::Blob) {
+            ::close(_blob_fd);
+            _blob_fd = -1;
+        }
+
+        _state = State::Tag;
+    }
+
+    const BlobPath& _blob_path;
+    State _state{State::Tag};
+    Target _target{Target::Skip};
+    int _field{0};
+    uint64_t _varint{0};
+    int _shift{0};
+    uint64_t _remaining{0};
+    std::string _json{};
+    std::string _json_zstd{};
+    size_t _blobs{0};
+    int _blob_fd{-1};
+};
+
+comm::ConnClientConfig connection_config(const VDMSClientConfig& config)
+{
+    comm::ConnClientConfig conn_config(
+        config.protocols, config.ca_certificate, false, config.metrics);
+    conn_config.connect_timeout_ms       = config.connect_timeout_ms;
+    conn_config.capabilities.compression = config.compression;
+    conn_config.max_message_size         = config.max_message_size;
+
+    if (!config.json_dictionary.empty()) {
+        conn_config.dictionary = comm::CompressionDictionary::load(config.json_dictionary);
+    }
+
+    return conn_config;
+}
+
+}  // namespace
+
+Response ResponseView::to_response() const
+{
+    Response response;
+    response.json = std::string(json);
+
+    response.blobs.reserve(blobs.size());
+
+    for (auto& blob : blobs) {
+        response.blobs.emplace_back(blob);
+    }
+
+    return response;
+}
+
 TokenBasedVDMSClient::TokenBasedVDMSClient(const VDMSClientConfig& config)
-    : _client(new comm::ConnClient(
-          {config.addr, config.port},
-          comm::ConnClientConfig(config.protocols, config.ca_certificate, false, config.metrics)))
+    : _client(new comm::ConnClient({config.addr, config.port}, connection_config(config)))
     , _connection(_client->connect())
+    , _max_queries_in_flight(config.max_queries_in_flight)
+    , _pipeline_mutex()
+    , _pipeline()
+    , _query_timeout(config.query_timeout_ms)
 {
 }
 
 TokenBasedVDMSClient::~TokenBasedVDMSClient() = default;
 
+comm::Deadline TokenBasedVDMSClient::query_deadline() const
+{
+    return _query_timeout.count() > 0 ? comm::Deadline::after(_query_timeout) : comm::Deadline();
+}
+
+void TokenBasedVDMSClient::send_query(const std::string& json,
+                                      const std::vector< std::string* >& blobs,
+                                      const std::string& token,
+                                      const comm::Deadline& deadline)
+{
+    try {
+        _connection->set_send_deadline(deadline);
+
+        QueryMessageFragments request(json, blobs, token, _connection->dictionary().get());
+
+        _connection->send_message(request.fragments());
+    } catch (const comm::Exception& e) {
+        throw VDMS::Exception(e.num, e.name, e.errno_val, e.msg, e.file, e.line);
+    }
+}
+
+VDMS::ResponseView TokenBasedVDMSClient::receive_response(const comm::Deadline& deadline)
+{
+    try {
+        _connection->set_recv_deadline(deadline);
+
+        // The response buffer goes back to the pool once the last view is gone
+        auto msg = std::shared_ptr< std::basic_string< uint8_t > >(
+            new std::basic_string< uint8_t >(), [](std::basic_string< uint8_t >* buffer) {
+                comm::BufferPool::instance().release(std::move(*buffer));
+                delete buffer;
+            });
+
+        _connection->recv_message(*msg);
+
+        VDMS::ResponseView response;
+        response.message = std::move(msg);
+
+        if (!parse_response_view(response, _connection->dictionary().get())) {
+            THROW_EXCEPTION(ProtocolError, "Error parsing response using protobuf message");
+        }
+
+        return response;
+    } catch (const comm::Exception& e) {
+        throw VDMS::Exception(e.num, e.name, e.errno_val, e.msg, e.file, e.line);
+    }
+}
+
 VDMS::Response TokenBasedVDMSClient::query(const std::string& json,
                                            const std::vector< std::string* > blobs,
                                            const std::string& token)
+{
+    return query_view(json, blobs, token).to_response();
+}
+
+VDMS::ResponseView TokenBasedVDMSClient::query_view(const std::string& json,
+                                                    const std::vector< std::string* > blobs,
+                                                    const std::string& token)
+{
+    // Once pipelining, responses must be read by the pipeline, in order.
+    if (pipeline(false)) {
+        return query_async(json, blobs, token).get();
+    }
+
+    auto deadline = query_deadline();
+
+    send_query(json, blobs, token, deadline);
+
+    // Wait for response (blocking call)
+    return receive_response(deadline);
+}
+
+std::future< VDMS::ResponseView > TokenBasedVDMSClient::query_async(
+    const std::string& json, const std::vector< std::string* > blobs, const std::string& token)
+{
+    return pipeline(true)->submit([&] { send_query(json, blobs, token, query_deadline()); });
+}
+
+QueryPipeline* TokenBasedVDMSClient::pipeline(bool start)
+{
+    std::lock_guard< std::mutex > lock(_pipeline_mutex);
+
+    if (!_pipeline && start) {
+        _pipeline = std::unique_ptr< QueryPipeline >(new QueryPipeline(
+            [this] { return receive_response(query_deadline()); },
+            [this] { _connection->shutdown(); },
+            _max_queries_in_flight));
+    }
+
+    return _pipeline.get();
+}
+
+std::string TokenBasedVDMSClient::query_to_files(const std::string& json,
+                                                 const BlobPath& blob_path,
+                                                 const std::vector< std::string* > blobs,
+                                                 const std::string& token)
 {
     try {
-        protobufs::queryMessage cmd;
-        cmd.set_json(json);
-        cmd.set_token(token);
+        // Once pipelining, responses must be read by the pipeline, in order.
+        if (pipeline(false)) {
+            auto response = query_async(json, blobs, token).get();
+
+            for (size_t i = 0; i < response.blobs.size(); ++i) {
+                int fd = open_blob_file(blob_path(i));
+
+                try {
+                    write_blob_file(fd,
+                                    reinterpret_cast< const uint8_t* >(response.blobs[i].data()),
+                                    response.blobs[i].size());
+                } catch (...) {
+                    ::close(fd);
+                    throw;
+                }
 
-        for (auto& it : blobs) {
-            std::string* blob = cmd.add_blobs();
-            *blob             = *it;
+                ::close(fd);
+            }
+
+            return std::string(response.json);
         }
 
-        std::basic_string< uint8_t > msg(cmd.ByteSizeLong(), 0);
-        cmd.SerializeToArray(msg.data(), msg.length());
+        auto deadline = query_deadline();
 
-        _connection->send_message(msg.data(), msg.length());
+        send_query(json, blobs, token, deadline);
 
-        // Wait for response (blocking call)
-        msg = _connection->recv_message();
+        ResponseFileWriter writer(blob_path);
+        std::exception_ptr failure;
 
-        protobufs::queryMessage protobuf_response;
-        protobuf_response.ParseFromArray(msg.data(), msg.length());
+        // Once a blob cannot be written, the rest of the response is still
+        // read, so that the next query does not get it as its own.
+        _connection->set_recv_deadline(deadline);
+        _connection->recv_message([&writer, &failure](const uint8_t* data, size_t size) {
+            if (failure) {
+                return;
+            }
 
-        VDMS::Response response;
-        response.json = protobuf_response.json();
+            try {
+                writer.consume(data, size);
+            } catch (...) {
+                failure = std::current_exception();
+            }
+        });
 
-        for (auto& it : protobuf_response.blobs()) {
-            response.blobs.push_back(it);
+        if (failure) {
+            std::rethrow_exception(failure);
         }
 
-        return response;
+        return writer.finish(_connection->dictionary().get());
     } catch (const comm::Exception& e) {
         throw VDMS::Exception(e.num, e.name, e.errno_val, e.msg, e.file, e.line);
     }
@@ -83,3 +83,34 @@ VDMS::Response VDMSClient::query(const std::string& json, const std::vector< std
         throw VDMS::Exception(e.num, e.name, e.errno_val, e.msg, e.file, e.line);
     }
 }
+
+VDMS::ResponseView VDMSClient::query_view(const std::string& json,
+                                          const std::vector< std::string* > blobs)
+{
+    try {
+        return _impl->query_view(json, blobs);
+    } catch (const comm::Exception& e) {
+        throw VDMS::Exception(e.num, e.name, e.errno_val, e.msg, e.file, e.line);
+    }
+}
+
+std::future< VDMS::ResponseView > VDMSClient::query_async(const std::string& json,
+                                                          const std::vector< std::string* > blobs)
+{
+    try {
+        return _impl->query_async(json, blobs);
+    } catch (const comm::Exception& e) {
+        throw VDMS::Exception(e.num, e.name, e.errno_val, e.msg, e.file, e.line);
+    }
+}
+
+std::string VDMSClient::query_to_files(const std::string& json,
+                                       const BlobPath& blob_path,
+                                       const std::vector< std::string* > blobs)
+{
+    try {
+        return _impl->query_to_files(json, blob_path, blobs);
+    } catch (const comm::Exception& e) {
+        throw VDMS::Exception(e.num, e.name, e.errno_val, e.msg, e.file, e.line);
+    }
+}
@@ -88,31 +88,21 @@ std::unique_ptr< AuthToken > process_token_response(const std::string& response,
 
 }  // namespace
 
-VDMSClientImpl::VDMSClientImpl(std::string username,
-                               std::string password,
-                               const VDMSClientConfig& config)
-    : TokenBasedVDMSClient(config)
+Session::Session(std::string username, std::string password)
+    : _mutex()
     , _username(std::move(username))
     , _password(std::move(password))
     , _api_key()
     , _auth_token()
 {
-    re_authenticate();
 }
 
-VDMSClientImpl::VDMSClientImpl(std::string api_key, const VDMSClientConfig& config)
-    : TokenBasedVDMSClient(config)
-    , _username()
-    , _password()
-    , _api_key(std::move(api_key))
-    , _auth_token()
+Session::Session(std::string api_key)
+    : _mutex(), _username(), _password(), _api_key(std::move(api_key)), _auth_token()
 {
-    re_authenticate();
 }
 
-VDMSClientImpl::~VDMSClientImpl() = default;
-
-bool VDMSClientImpl::needs_re_authentication()
+bool Session::needs_re_authentication()
 {
     auto expiration_point =
         _auth_token->issued_at + std::chrono::seconds(_auth_token->refresh_token_expires_in);
@@ -121,7 +111,7 @@ bool VDMSClientImpl::needs_re_authentication()
     return expiration_point <= now;
 }
 
-bool VDMSClientImpl::needs_token_refresh()
+bool Session::needs_token_refresh()
 {
     auto expiration_point =
         _auth_token->issued_at + std::chrono::seconds(_auth_token->session_token_expires_in);
@@ -130,26 +120,22 @@ bool VDMSClientImpl::needs_token_refresh()
     return expiration_point <= now;
 }
 
-VDMS::Response VDMSClientImpl::query(const std::string& json,
-                                     const std::vector< std::string* > blobs,
-                                     bool ignore_authentication)
+std::string Session::session_token(TokenBasedVDMSClient& client)
 {
-    if (_auth_token && !ignore_authentication) {
-        if (needs_re_authentication()) {
-            re_authenticate();
-        }
+    std::lock_guard< std::mutex > lock(_mutex);
 
-        if (needs_token_refresh()) {
-            refresh_token();
-        }
+    if (!_auth_token || needs_re_authentication()) {
+        re_authenticate(client);
+    }
 
-        return TokenBasedVDMSClient::query(json, blobs, _auth_token->session_token);
+    if (needs_token_refresh()) {
+        refresh_token(client);
     }
 
-    return TokenBasedVDMSClient::query(json, blobs);
+    return _auth_token->session_token;
 }
 
-void VDMSClientImpl::re_authenticate()
+void Session::re_authenticate(TokenBasedVDMSClient& client)
 {
     nlohmann::json requestJson;
 
@@ -160,17 +146,59 @@ void VDMSClientImpl::re_authenticate()
         requestJson = nlohmann::json::array({{{"Authenticate", {{"token", _api_key}}}}});
     }
 
-    auto response = query(requestJson.dump(), {}, true);
+    auto response = client.query(requestJson.dump());
 
     _auth_token = process_token_response(response.json, "Authenticate");
 }
 
-void VDMSClientImpl::refresh_token()
+void Session::refresh_token(TokenBasedVDMSClient& client)
 {
     auto requestJson = nlohmann::json::array(
         {{{"RefreshToken", {{"refresh_token", _auth_token->refresh_token}}}}});
 
-    auto response = query(requestJson.dump(), {}, true);
+    auto response = client.query(requestJson.dump());
 
     _auth_token = process_token_response(response.json, "RefreshToken");
 }
+
+VDMSClientImpl::VDMSClientImpl(std::string username,
+                               std::string password,
+                               const VDMSClientConfig& config)
+    : TokenBasedVDMSClient(config), _session(std::move(username), std::move(password))
+{
+    _session.session_token(*this);
+}
+
+VDMSClientImpl::VDMSClientImpl(std::string api_key, const VDMSClientConfig& config)
+    : TokenBasedVDMSClient(config), _session(std::move(api_key))
+{
+    _session.session_token(*this);
+}
+
+VDMSClientImpl::~VDMSClientImpl() = default;
+
+VDMS::Response VDMSClientImpl::query(const std::string& json,
+                                     const std::vector< std::string* > blobs)
+{
+    return query_view(json, blobs).to_response();
+}
+
+VDMS::ResponseView VDMSClientImpl::query_view(const std::string& json,
+                                              const std::vector< std::string* > blobs)
+{
+    return TokenBasedVDMSClient::query_view(json, blobs, _session.session_token(*this));
+}
+
+std::future< VDMS::ResponseView > VDMSClientImpl::query_async(
+    const std::string& json, const std::vector< std::string* > blobs)
+{
+    return TokenBasedVDMSClient::query_async(json, blobs, _session.session_token(*this));
+}
+
+std::string VDMSClientImpl::query_to_files(const std::string& json,
+                                           const BlobPath& blob_path,
+                                           const std::vector< std::string* > blobs)
+{
+    return TokenBasedVDMSClient::query_to_files(
+        json, blob_path, blobs, _session.session_token(*this));
+}
@@ -32,11 +32,13 @@
 
 #include <chrono>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
 #include "aperturedb/VDMSClient.h"
 #include "comm/Protocol.h"
+#include "util/Macros.h"
 
 namespace VDMS
 {
@@ -49,27 +51,60 @@ struct AuthToken {
     int32_t session_token_expires_in{-1};
 };
 
-class VDMSClientImpl : public TokenBasedVDMSClient
+// Credentials and tokens of a user. A session can be shared by several
+// connections: the token is obtained through whichever connection needs it
+// first, and is then reused by all of them.
+class Session
 {
    public:
-    VDMSClientImpl(std::string username, std::string password, const VDMSClientConfig& config);
-    VDMSClientImpl(std::string api_key, const VDMSClientConfig& config);
-    ~VDMSClientImpl();
+    Session(std::string username, std::string password);
+    explicit Session(std::string api_key);
 
-    // Blocking call
-    VDMS::Response query(const std::string& json_query,
-                         const std::vector< std::string* > blobs = {},
-                         bool ignore_authentication              = false);
+    NOT_COPYABLE(Session);
+    NOT_MOVEABLE(Session);
+
+    // Returns a valid session token, authenticating or refreshing the
+    // token through 'client' if needed. Thread-safe.
+    std::string session_token(TokenBasedVDMSClient& client);
 
    private:
     bool needs_re_authentication();
     bool needs_token_refresh();
-    void re_authenticate();
-    void refresh_token();
+    void re_authenticate(TokenBasedVDMSClient& client);
+    void refresh_token(TokenBasedVDMSClient& client);
 
+    std::mutex _mutex;
     std::string _username;
     std::string _password;
     std::string _api_key;
     std::unique_ptr< AuthToken > _auth_token;
 };
+
+class VDMSClientImpl : public TokenBasedVDMSClient
+{
+   public:
+    VDMSClientImpl(std::string username, std::string password, const VDMSClientConfig& config);
+    VDMSClientImpl(std::string api_key, const VDMSClientConfig& config);
+    ~VDMSClientImpl();
+
+    // Blocking call
+    VDMS::Response query(const std::string& json_query,
+                         const std::vector< std::string* > blobs = {});
+
+    // Blocking call
+    VDMS::ResponseView query_view(const std::string& json_query,
+                                  const std::vector< std::string* > blobs = {});
+
+    // Non-blocking call
+    std::future< VDMS::ResponseView > query_async(const std::string& json_query,
+                                                  const std::vector< std::string* > blobs = {});
+
+    // Blocking call
+    std::string query_to_files(const std::string& json_query,
+                               const BlobPath& blob_path,
+                               const std::vector< std::string* > blobs = {});
+
+   private:
+    Session _session;
+};
 };  // namespace VDMS
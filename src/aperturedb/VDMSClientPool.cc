@@ -0,0 +1,214 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#include "aperturedb/VDMSClientPool.h"
+
+#include "aperturedb/Exception.h"
+#include "aperturedb/VDMSClientImpl.h"
+#include "comm/Exception.h"
+
+using namespace VDMS;
+
+namespace
+{
+
+constexpr uint32_t EMPTY = UINT32_MAX;
+
+constexpr uint32_t head_index(uint64_t head) { return static_cast< uint32_t >(head); }
+
+constexpr uint64_t make_head(uint32_t index, uint64_t previous_head)
+{
+    return (((previous_head >> 32) + 1) << 32) | index;
+}
+
+}  // namespace
+
+VDMSClientPoolMetrics::~VDMSClientPoolMetrics() = default;
+
+void VDMSClientPoolMetrics::observe_wait_time(std::chrono::nanoseconds /*wait_time*/) {}
+
+VDMSClientPool::Lease::Lease(VDMSClientPool* pool, uint32_t index) : _pool(pool), _index(index) {}
+
+VDMSClientPool::Lease::~Lease() { release(); }
+
+VDMSClientPool::Lease::Lease(Lease&& other) noexcept : _pool(other._pool), _index(other._index)
+{
+    other._pool = nullptr;
+}
+
+VDMSClientPool::Lease& VDMSClientPool::Lease::operator=(Lease&& other) noexcept
+{
+    if (this != &other) {
+        release();
+
+        _pool       = other._pool;
+        _index      = other._index;
+        other._pool = nullptr;
+    }
+
+    return *this;
+}
+
+void VDMSClientPool::Lease::release()
+{
+    if (_pool) {
+        _pool->push(_index);
+        _pool = nullptr;
+    }
+}
+
+VDMS::Response VDMSClientPool::Lease::query(const std::string& json,
+                                            const std::vector< std::string* > blobs)
+{
+    return query_view(json, blobs).to_response();
+}
+
+VDMS::ResponseView VDMSClientPool::Lease::query_view(const std::string& json,
+                                                     const std::vector< std::string* > blobs)
+{
+    try {
+        if (!_pool) {
+            THROW_EXCEPTION(ConnectionError, "Query on a released or moved-from lease");
+        }
+
+        auto& client = *_pool->_clients[_index];
+
+        return client.query_view(json, blobs, _pool->_session->session_token(client));
+    } catch (const comm::Exception& e) {
+        throw VDMS::Exception(e.num, e.name, e.errno_val, e.msg, e.file, e.line);
+    }
+}
+
+VDMSClientPool::VDMSClientPool(std::string username,
+                               std::string password,
+                               std::size_t size,
+                               const VDMSClientConfig& config,
+                               VDMSClientPoolMetrics* metrics)
+    : VDMSClientPool(std::unique_ptr< Session >(new Session(std::move(username), std::move(password))),
+                     size,
+                     config,
+                     metrics)
+{
+}
+
+VDMSClientPool::VDMSClientPool(std::string api_key,
+                               std::size_t size,
+                               const VDMSClientConfig& config,
+                               VDMSClientPoolMetrics* metrics)
+    : VDMSClientPool(
+          std::unique_ptr< Session >(new Session(std::move(api_key))), size, config, metrics)
+{
+}
+
+VDMSClientPool::VDMSClientPool(std::unique_ptr< Session > session,
+                               std::size_t size,
+                               const VDMSClientConfig& config,
+                               VDMSClientPoolMetrics* metrics)
+    : _session(std::move(session))
+    , _clients()
+    , _metrics(metrics)
+    , _next(new std::atomic< uint32_t >[size])
+    , _head(make_head(EMPTY, 0))
+    , _wait_mutex()
+    , _wait_cv()
+{
+    try {
+        if (size == 0 || size >= EMPTY) {
+            THROW_EXCEPTION(ConnectionError, "Invalid pool size");
+        }
+
+        _clients.reserve(size);
+
+        for (std::size_t i = 0; i < size; ++i) {
+            _clients.emplace_back(new TokenBasedVDMSClient(config));
+        }
+
+        // Authenticate once, for all connections
+        _session->session_token(*_clients.front());
+    } catch (const comm::Exception& e) {
+        throw VDMS::Exception(e.num, e.name, e.errno_val, e.msg, e.file, e.line);
+    }
+
+    for (std::size_t i = size; i > 0; --i) {
+        push(static_cast< uint32_t >(i - 1));
+    }
+}
+
+VDMSClientPool::~VDMSClientPool() = default;
+
+std::size_t VDMSClientPool::size() const { return _clients.size(); }
+
+VDMSClientPool::Lease VDMSClientPool::lease()
+{
+    auto start = std::chrono::steady_clock::now();
+
+    auto index = pop();
+
+    if (_metrics) {
+        _metrics->observe_wait_time(std::chrono::steady_clock::now() - start);
+    }
+
+    return Lease(this, index);
+}
+
+VDMS::Response VDMSClientPool::query(const std::string& json,
+                                     const std::vector< std::string* > blobs)
+{
+    return lease().query(json, blobs);
+}
+
+uint32_t VDMSClientPool::pop()
+{
+    uint32_t index;
+
+    if (try_pop(index)) {
+        return index;
+    }
+
+    ++_waiters;
+
+    {
+        std::unique_lock< std::mutex > lock(_wait_mutex);
+        _wait_cv.wait(lock, [this, &index] { return try_pop(index); });
+    }
+
+    --_waiters;
+
+    return index;
+}
+
+bool VDMSClientPool::try_pop(uint32_t& index)
+{
+    auto head = _head.load();
+
+    while (true) {
+        index = head_index(head);
+
+        if (index == EMPTY) {
+            return false;
+        }
+
+        auto next = make_head(_next[index].load(std::memory_order_relaxed), head);
+
+        if (_head.compare_exchange_weak(head, next)) {
+            return true;
+        }
+    }
+}
+
+void VDMSClientPool::push(uint32_t index)
+{
+    auto head = _head.load();
+
+    do {
+        _next[index].store(head_index(head), std::memory_order_relaxed);
+    } while (!_head.compare_exchange_weak(head, make_head(index, head)));
+
+    // Sequentially consistent with the waiter's increment: either the
+    // waiter sees this connection, or we see the waiter.
+    if (_waiters > 0) {
+        std::lock_guard< std::mutex > lock(_wait_mutex);
+        _wait_cv.notify_one();
+    }
+}
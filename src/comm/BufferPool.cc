@@ -0,0 +1,154 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#include "comm/BufferPool.h"
+
+#include <algorithm>
+
+#include "comm/Variables.h"
+
+using namespace comm;
+
+namespace
+{
+
+// Classes go from MIN_BUFFER_SIZE up to MAX_BUFFER_SIZE, doubling each time.
+constexpr std::size_t class_capacity(std::size_t size_class)
+{
+    return std::size_t(MIN_BUFFER_SIZE) << size_class;
+}
+
+constexpr std::size_t number_of_classes()
+{
+    std::size_t n = 1;
+    while (class_capacity(n - 1) < MAX_BUFFER_SIZE) {
+        ++n;
+    }
+    return n;
+}
+
+constexpr std::size_t NUMBER_OF_CLASSES = number_of_classes();
+
+// Function-local statics are not thread-safe with -fno-threadsafe-statics,
+// so make sure the pool is constructed at load time.
+[[maybe_unused]] BufferPool* pool_instance = &BufferPool::instance();
+
+}  // namespace
+
+BufferPool::BufferPool()
+    : _mutex(), _free_buffers(NUMBER_OF_CLASSES), _high_water_mark(DEFAULT_BUFFER_POOL_HIGH_WATER)
+{
+}
+
+BufferPool& BufferPool::instance()
+{
+    static BufferPool pool{};
+
+    return pool;
+}
+
+// Smallest class whose buffers can hold 'size' bytes.
+std::size_t BufferPool::size_class(std::size_t size)
+{
+    std::size_t c = 0;
+
+    while (c + 1 < NUMBER_OF_CLASSES && class_capacity(c) < size) {
+        ++c;
+    }
+
+    return c;
+}
+
+BufferPool::Buffer BufferPool::acquire(std::size_t size)
+{
+    auto c = size_class(size);
+
+    {
+        std::lock_guard< std::mutex > lock(_mutex);
+
+        auto& buffers = _free_buffers[c];
+
+        if (!buffers.empty() && buffers.back().capacity() >= size) {
+            Buffer buffer = std::move(buffers.back());
+            buffers.pop_back();
+            _pooled_bytes -= buffer.capacity();
+
+            return buffer;
+        }
+    }
+
+    Buffer buffer;
+    buffer.reserve(std::max(size, class_capacity(c)));
+
+    return buffer;
+}
+
+void BufferPool::release(Buffer&& buffer)
+{
+    auto capacity = buffer.capacity();
+
+    if (capacity < MIN_BUFFER_SIZE) {
+        return;
+    }
+
+    // Buffers are filed under the largest class they can fully serve.
+    auto c = size_class(capacity);
+    if (class_capacity(c) > capacity) {
+        --c;
+    }
+
+    buffer.clear();
+
+    std::lock_guard< std::mutex > lock(_mutex);
+
+    if (capacity > _high_water_mark) {
+        return;
+    }
+
+    trim(_high_water_mark - capacity);
+
+    _free_buffers[c].push_back(std::move(buffer));
+    _pooled_bytes += capacity;
+}
+
+void BufferPool::trim(std::size_t limit)
+{
+    for (auto c = NUMBER_OF_CLASSES; c > 0 && _pooled_bytes > limit; --c) {
+        auto& buffers = _free_buffers[c - 1];
+
+        while (!buffers.empty() && _pooled_bytes > limit) {
+            _pooled_bytes -= buffers.back().capacity();
+            buffers.pop_back();
+        }
+    }
+}
+
+void BufferPool::set_high_water_mark(std::size_t bytes)
+{
+    std::lock_guard< std::mutex > lock(_mutex);
+
+    _high_water_mark = bytes;
+    trim(_high_water_mark);
+}
+
+std::size_t BufferPool::high_water_mark() const
+{
+    std::lock_guard< std::mutex > lock(_mutex);
+
+    return _high_water_mark;
+}
+
+std::size_t BufferPool::pooled_bytes() const
+{
+    std::lock_guard< std::mutex > lock(_mutex);
+
+    return _pooled_bytes;
+}
+
+void BufferPool::clear()
+{
+    std::lock_guard< std::mutex > lock(_mutex);
+
+    trim(0);
+}
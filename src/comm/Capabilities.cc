@@ -0,0 +1,40 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#include "comm/Capabilities.h"
+
+#include <algorithm>
+
+using namespace comm;
+
+namespace
+{
+
+// Smallest of two limits, where 0 stands for no limit.
+template < typename T >
+T min_limit(T a, T b)
+{
+    if (a == 0 || b == 0) {
+        return std::max(a, b);
+    }
+
+    return std::min(a, b);
+}
+
+}  // namespace
+
+Capabilities Capabilities::intersect(const Capabilities& other) const
+{
+    Capabilities result;
+
+    result.compression      = compression & other.compression;
+    result.max_frame_size   = min_limit(max_frame_size, other.max_frame_size);
+    result.pipelining_depth = min_limit(pipelining_depth, other.pipelining_depth);
+    result.keepalive_ms     = min_limit(keepalive_ms, other.keepalive_ms);
+    result.dictionary_id    = dictionary_id == other.dictionary_id ? dictionary_id : 0;
+    result.chunked_messages = chunked_messages && other.chunked_messages;
+    result.shared_memory    = shared_memory && other.shared_memory;
+
+    return result;
+}
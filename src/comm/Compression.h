@@ -0,0 +1,58 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "comm/Capabilities.h"
+#include "comm/Connection.h"
+
+namespace comm
+{
+
+// On connections that negotiated compression, every frame body starts with
+// one of these. Compressed bodies follow it with the size of the original
+// message (uint32_t, little-endian), then the compressed data.
+enum class FrameCodec : uint8_t { Raw = 0, LZ4 = 1, Zstd = 2 };
+
+const size_t RAW_FRAME_HEADER_SIZE        = 1;
+const size_t COMPRESSED_FRAME_HEADER_SIZE = 1 + sizeof(uint32_t);
+
+// Whether the data starts like a format that is compressed already
+// (JPEG, PNG, GIF, WebP, MP4, gzip, zip, zstd, lz4...).
+bool looks_compressed(const uint8_t* data, size_t size);
+
+// Whether compress_frame() would try to compress the message: it is not
+// when no codec was negotiated, it is under 'threshold' bytes, or it is
+// made mostly of compressed data. Lets callers skip preparing a buffer.
+bool worth_compressing(Compression compression,
+                       size_t threshold,
+                       const std::vector< MessageFragment >& fragments,
+                       size_t total_size);
+
+// Compresses a message into a frame body, with the best codec
+// 'compression' allows. Returns false, leaving 'frame' in an unspecified
+// state, if the message should go out raw instead: when it is not
+// worth_compressing(), or would not shrink.
+bool compress_frame(Compression compression,
+                    size_t threshold,
+                    const std::vector< MessageFragment >& fragments,
+                    size_t total_size,
+                    std::basic_string< uint8_t >& frame);
+
+// Decodes a frame body, and appends the result to 'message'. Throws
+// InvalidMessageSize if the decoded body would exceed 'max_size', and
+// ProtocolError if the body is malformed or uses a codec that was not
+// negotiated.
+void decode_frame(Compression compression,
+                  const uint8_t* data,
+                  size_t size,
+                  size_t max_size,
+                  std::basic_string< uint8_t >& message);
+
+}  // namespace comm
@@ -30,6 +30,7 @@
 
 #include "comm/ConnClient.h"
 
+#include <algorithm>
 #include <string>
 #include <cstring>
 #include <unistd.h>
@@ -38,15 +39,42 @@
 #include <netdb.h>
 #include <netinet/tcp.h>
 
+#include "util/gcc_util.h"
+DISABLE_WARNING(effc++)
+DISABLE_WARNING(suggest-override)
+#include <glog/logging.h>
+ENABLE_WARNING(suggest-override)
+ENABLE_WARNING(effc++)
+
+#include "comm/CompressionDictionary.h"
 #include "comm/Exception.h"
 #include "comm/HelloMessage.h"
+#include "comm/ShmConnection.h"
 #include "comm/TCPConnection.h"
 #include "comm/TLS.h"
 #include "comm/TLSConnection.h"
+#include "comm/TLSSession.h"
 #include "comm/Variables.h"
 
 using namespace comm;
 
+namespace
+{
+
+// Everything that decides whether a server is trusted, and how a session
+// with it is negotiated, so that sessions are not resumed across them.
+std::string session_trust(const ConnClientConfig& config)
+{
+    const auto& policy = config.tls_policy;
+
+    return std::to_string(config.verify_certificate) + "\n" + config.ca_certificate + "\n" +
+           std::to_string(static_cast< int >(policy.min_version)) + "\n" +
+           std::to_string(static_cast< int >(policy.cipher_preference)) + "\n" +
+           policy.cipher_suites + "\n" + policy.cipher_list + "\n" + policy.groups;
+}
+
+}  // namespace
+
 ConnClient::ConnClient(const Address& server_address, ConnClientConfig config)
     : _config(std::move(config))
     , _connection()
@@ -63,20 +91,32 @@ ConnClient::ConnClient(const Address& server_address, ConnClientConfig config)
     if (!_config.ca_certificate.empty()) {
         ::set_ca_certificate(_ssl_ctx.get(), _config.ca_certificate);
     }
+
+    if (_config.enable_ktls) {
+        ::enable_ktls(_ssl_ctx.get());
+    }
+
+    set_tls_policy(_ssl_ctx.get(), _config.tls_policy);
+
+    if (_config.resume_tls_sessions) {
+        TLSSessionCache::instance().attach(_ssl_ctx.get(), _server, session_trust(_config));
+    }
 }
 
 ConnClient::~ConnClient() = default;
 
-std::shared_ptr< Connection > ConnClient::connect()
+namespace
 {
-    if (!_connection) {
-        if (_server.port <= 0 || static_cast< unsigned >(_server.port) > MAX_PORT_NUMBER) {
-            THROW_EXCEPTION(PortError);
-        }
 
-        // Create a TCP/IP socket
-        auto tcp_socket = TCPSocket::create();
+std::unique_ptr< TCPConnection > open_connection(const Address& server,
+                                                 const ConnClientConfig& config,
+                                                 const Deadline& deadline)
+{
+    // Create a TCP/IP socket, or a Unix domain one. connect() replaces it
+    // with one of the family of the address it reaches.
+    auto tcp_socket = TCPSocket::create(server.is_unix() ? AF_UNIX : AF_INET);
 
+    if (!server.is_unix()) {
         if (!tcp_socket->set_boolean_option(SOL_SOCKET, SO_REUSEADDR, true)) {
             THROW_EXCEPTION(SocketFail, "Unable to bind client socket");
         }
@@ -88,51 +128,143 @@ std::shared_ptr< Connection > ConnClient::connect()
         if (!tcp_socket->set_boolean_option(IPPROTO_TCP, TCP_QUICKACK, true)) {
             THROW_EXCEPTION(SocketFail, "Unable to turn quick ack on");
         }
+    }
+
+    tcp_socket->tune(config.socket_tuning);
 
-        if (!tcp_socket->connect(_server)) {
-            THROW_EXCEPTION(ConnectionError);
+    // Whichever comes first, the timeout or the deadline.
+    auto timeout_ms = config.connect_timeout_ms;
+    if (deadline.is_set()) {
+        auto remaining_ms = static_cast< unsigned >(std::max(deadline.remaining_ms(), 1));
+        timeout_ms = timeout_ms == 0 ? remaining_ms : std::min(timeout_ms, remaining_ms);
+    }
+
+    if (!tcp_socket->connect(server, timeout_ms)) {
+        if (deadline.passed()) {
+            THROW_EXCEPTION(Timeout, "Deadline passed while connecting");
         }
 
-        auto tcp_connection = std::unique_ptr< TCPConnection >(
-            new TCPConnection(std::move(tcp_socket), _config.metrics));
+        THROW_EXCEPTION(ConnectionError, errno, "connect()", 0);
+    }
+
+    return std::unique_ptr< TCPConnection >(
+        new TCPConnection(std::move(tcp_socket), config.metrics));
+}
 
-        HelloMessage client_hello_message;
+HelloMessage exchange_hello(TCPConnection& tcp_connection,
+                            Protocol allowed_protocols,
+                            const Capabilities& capabilities,
+                            bool legacy,
+                            const Deadline& deadline)
+{
+    tcp_connection.set_deadline(deadline);
 
-        client_hello_message.version  = PROTOCOL_VERSION;
-        client_hello_message.protocol = _config.allowed_protocols;
+    HelloMessage client_hello_message;
 
-        tcp_connection->send_message(reinterpret_cast< uint8_t* >(&client_hello_message),
-                                     sizeof(client_hello_message));
+    client_hello_message.legacy       = legacy;
+    client_hello_message.version      = legacy ? LEGACY_PROTOCOL_VERSION : PROTOCOL_VERSION;
+    client_hello_message.protocol     = allowed_protocols;
+    client_hello_message.capabilities = capabilities;
 
-        auto response = tcp_connection->recv_message();
+    auto encoded_hello = encode_hello(client_hello_message);
+    tcp_connection.send_message(encoded_hello.data(), encoded_hello.size());
 
-        if (response.length() != sizeof(HelloMessage)) {
-            THROW_EXCEPTION(InvalidMessageSize);
+    auto response = tcp_connection.recv_message();
+
+    auto server_hello_message = decode_hello(response.data(), response.length());
+
+    // The rest of the handshake takes the deadline on its own.
+    tcp_connection.set_deadline({});
+
+    if (server_hello_message.legacy != legacy) {
+        THROW_EXCEPTION(ProtocolError, "Unexpected hello message");
+    }
+
+    return server_hello_message;
+}
+
+}  // namespace
+
+std::shared_ptr< Connection > ConnClient::connect(const Deadline& deadline)
+{
+    if (!_connection) {
+        if (!_server.is_unix() &&
+            (_server.port <= 0 || static_cast< unsigned >(_server.port) > MAX_PORT_NUMBER)) {
+            THROW_EXCEPTION(PortError);
         }
 
-        auto server_hello_message = reinterpret_cast< const HelloMessage* >(response.data());
+        auto capabilities             = _config.capabilities;
+        capabilities.dictionary_id    = _config.dictionary ? _config.dictionary->id() : 0;
+        capabilities.chunked_messages = true;
+        capabilities.shared_memory    = _config.use_shared_memory && _server.is_unix();
+
+        auto tcp_connection = open_connection(_server, _config, deadline);
 
-        if (server_hello_message->version == 0) {
+        HelloMessage server_hello_message;
+
+        try {
+            server_hello_message = exchange_hello(
+                *tcp_connection, _config.allowed_protocols, capabilities, false, deadline);
+        } catch (const Exception& e) {
+            // Servers from before protocol version 2 hang up on a hello they
+            // cannot parse, without a word. Try again the way they expect.
+            // Any other failure, or an answer cut short, is not theirs.
+            if (!_config.legacy_fallback || e.num != ConnectionShutDown || e.errno_val != 0 ||
+                tcp_connection->_recv_state != Connection::StreamState::Idle) {
+                throw;
+            }
+
+            VLOG(1) << "Server hung up on the version " << PROTOCOL_VERSION
+                    << " hello, retrying with the version " << LEGACY_PROTOCOL_VERSION << " one";
+
+            tcp_connection       = open_connection(_server, _config, deadline);
+            server_hello_message = exchange_hello(
+                *tcp_connection, _config.allowed_protocols, capabilities, true, deadline);
+        }
+
+        if (server_hello_message.version == 0) {
             THROW_EXCEPTION(ProtocolError, "Protocol version mismatch");
         }
 
-        if (server_hello_message->protocol == Protocol::None) {
+        Capabilities negotiated;
+        if (!server_hello_message.legacy) {
+            negotiated = capabilities.intersect(server_hello_message.capabilities);
+        }
+
+        if (server_hello_message.protocol == Protocol::None) {
             THROW_EXCEPTION(ProtocolError, "Server rejected protocol");
-        } else if ((server_hello_message->protocol & Protocol::TLS) == Protocol::TLS) {
-            tcp_socket = tcp_connection->release_socket();
+        } else if ((server_hello_message.protocol & Protocol::TLS) == Protocol::TLS) {
+            auto tcp_socket = tcp_connection->release_socket();
 
             auto tls_socket = TLSSocket::create(std::move(tcp_socket), _ssl_ctx);
 
-            tls_socket->connect();
+            tls_socket->connect(deadline);
 
             _connection = std::unique_ptr< TLSConnection >(
                 new TLSConnection(std::move(tls_socket), _config.metrics));
-        } else if ((server_hello_message->protocol & Protocol::TCP) == Protocol::TCP) {
-            // Nothing to do, already using TCP
-            _connection = std::move(tcp_connection);
+        } else if ((server_hello_message.protocol & Protocol::TCP) == Protocol::TCP) {
+            if (negotiated.shared_memory) {
+                _connection = ShmConnection::create(
+                    tcp_connection->release_socket(), SHARED_MEMORY_RING_SIZE, _config.metrics);
+            } else {
+                // Nothing to do, already using TCP
+                if (_config.use_io_uring) {
+                    tcp_connection->enable_io_uring();
+                }
+
+                _connection = std::move(tcp_connection);
+            }
         } else {
             THROW_EXCEPTION(ProtocolError, "Protocol negotiation failed");
         }
+
+        if (!server_hello_message.legacy) {
+            _connection->set_capabilities(negotiated, _config.dictionary);
+        }
+
+        if (_config.max_message_size != 0) {
+            _connection->set_max_message_size(_config.max_message_size);
+        }
     }
 
     return std::static_pointer_cast< Connection >(_connection);
@@ -38,13 +38,16 @@
 #include <netdb.h>
 #include <netinet/tcp.h>
 
+#include "comm/CompressionDictionary.h"
 #include "comm/Connection.h"
 #include "comm/Exception.h"
 #include "comm/HelloMessage.h"
+#include "comm/ShmConnection.h"
 #include "comm/TCPConnection.h"
 #include "comm/TCPSocket.h"
 #include "comm/TLS.h"
 #include "comm/TLSConnection.h"
+#include "comm/TLSSession.h"
 #include "comm/Variables.h"
 
 using namespace comm;
@@ -59,7 +62,8 @@ ConnServer::ConnServer(int port, ConnServerConfig config)
     set_default_verify_paths(_ssl_ctx.get());
 
     if (_config.auto_generate_certificate) {
-        auto certificates = generate_certificate();
+        auto certificates =
+            load_or_generate_certificate(_config.certificate_cache, _config.certificate_key_type);
 
         ::set_tls_private_key(_ssl_ctx.get(), certificates.private_key);
 
@@ -78,23 +82,36 @@ ConnServer::ConnServer(int port, ConnServerConfig config)
         }
     }
 
-    if (_port <= 0 || static_cast< unsigned >(_port) > MAX_PORT_NUMBER) {
-        THROW_EXCEPTION(PortError);
+    if (_config.enable_ktls) {
+        ::enable_ktls(_ssl_ctx.get());
     }
 
-    // Create a TCP/IP socket
-    _listening_socket = TCPSocket::create();
+    enable_session_tickets(_ssl_ctx.get(), _config.session_ticket_rotation);
 
-    if (!_listening_socket->set_boolean_option(SOL_SOCKET, SO_REUSEADDR, true)) {
-        THROW_EXCEPTION(SocketFail, "Unable to create reusable socket");
-    }
+    set_tls_policy(_ssl_ctx.get(), _config.tls_policy);
+    set_server_cipher_preference(_ssl_ctx.get());
+
+    bool unix_socket = !_config.unix_socket_path.empty();
 
-    if (!_listening_socket->set_boolean_option(IPPROTO_TCP, TCP_NODELAY, true)) {
-        THROW_EXCEPTION(SocketFail, "Unable to turn Nagle's off");
+    if (!unix_socket && (_port <= 0 || static_cast< unsigned >(_port) > MAX_PORT_NUMBER)) {
+        THROW_EXCEPTION(PortError);
     }
 
-    if (!_listening_socket->set_boolean_option(IPPROTO_TCP, TCP_QUICKACK, true)) {
-        THROW_EXCEPTION(SocketFail, "Unable to turn quick ack on");
+    // Create a TCP/IP socket, or a Unix domain one
+    _listening_socket = TCPSocket::create(unix_socket ? AF_UNIX : AF_INET);
+
+    if (!unix_socket) {
+        if (!_listening_socket->set_boolean_option(SOL_SOCKET, SO_REUSEADDR, true)) {
+            THROW_EXCEPTION(SocketFail, "Unable to create reusable socket");
+        }
+
+        if (!_listening_socket->set_boolean_option(IPPROTO_TCP, TCP_NODELAY, true)) {
+            THROW_EXCEPTION(SocketFail, "Unable to turn Nagle's off");
+        }
+
+        if (!_listening_socket->set_boolean_option(IPPROTO_TCP, TCP_QUICKACK, true)) {
+            THROW_EXCEPTION(SocketFail, "Unable to turn quick ack on");
+        }
     }
 
     struct timeval tv = {MAX_RECV_TIMEOUT_SECS, 0};
@@ -102,7 +119,12 @@ ConnServer::ConnServer(int port, ConnServerConfig config)
         THROW_EXCEPTION(SocketFail, "Unable to set receive timeout");
     }
 
-    if (!_listening_socket->bind(_port)) {
+    _listening_socket->tune(_config.socket_tuning);
+
+    bool bound = unix_socket ? _listening_socket->bind(_config.unix_socket_path)
+                             : _listening_socket->bind(_port);
+
+    if (!bound) {
         THROW_EXCEPTION(BindFail);
     }
 
@@ -112,41 +134,70 @@ ConnServer::ConnServer(int port, ConnServerConfig config)
     }
 }
 
-ConnServer::~ConnServer() = default;
+ConnServer::~ConnServer()
+{
+    if (_listening_socket && !_config.unix_socket_path.empty()) {
+        ::unlink(_config.unix_socket_path.c_str());
+    }
+}
 
 // c contains a TCPConnection, unencrypted, connection to a client.
 // The ConnServer will implement the protocol negotiation.
 // This right now is a simple handshake, design for ApertureDB Server use-case.
 // This protocol can be a virtual method in the future to support arbitrary protocols.
 std::unique_ptr< Connection > ConnServer::negotiate_protocol(std::shared_ptr< Connection > conn)
+{
+    return negotiate_protocol(std::move(conn), true);
+}
+
+std::unique_ptr< Connection > ConnServer::negotiate_protocol(std::shared_ptr< Connection > conn,
+                                                             bool allow_shared_memory)
 {
     auto tcp_connection = std::static_pointer_cast< TCPConnection >(conn);
 
     auto response = tcp_connection->recv_message();
 
-    if (response.length() != sizeof(HelloMessage)) {
-        THROW_EXCEPTION(ProtocolError);
-    }
-
-    auto client_hello_message = reinterpret_cast< const HelloMessage* >(response.data());
+    auto client_hello_message = decode_hello(response.data(), response.length());
 
     HelloMessage server_hello_message;
+    server_hello_message.legacy = client_hello_message.legacy;
+
+    // Clients sending the extensible hello understand any later version.
+    bool supported = client_hello_message.legacy
+                         ? client_hello_message.version == LEGACY_PROTOCOL_VERSION
+                         : client_hello_message.version >= PROTOCOL_VERSION;
 
-    if (client_hello_message->version != PROTOCOL_VERSION) {
+    if (!supported) {
         server_hello_message.version  = 0;
         server_hello_message.protocol = Protocol::None;
     } else {
-        server_hello_message.version  = PROTOCOL_VERSION;
-        server_hello_message.protocol = client_hello_message->protocol & _config.allowed_protocols;
+        server_hello_message.version =
+            client_hello_message.legacy ? LEGACY_PROTOCOL_VERSION : PROTOCOL_VERSION;
+        server_hello_message.protocol = client_hello_message.protocol & _config.allowed_protocols;
+        server_hello_message.capabilities = _config.capabilities;
+        server_hello_message.capabilities.dictionary_id =
+            _config.dictionary ? _config.dictionary->id() : 0;
+        server_hello_message.capabilities.chunked_messages = true;
+        server_hello_message.capabilities.shared_memory =
+            allow_shared_memory && _config.use_shared_memory && !_config.unix_socket_path.empty();
     }
 
-    tcp_connection->send_message(reinterpret_cast< uint8_t* >(&server_hello_message),
-                                 sizeof(server_hello_message));
+    auto encoded_hello = encode_hello(server_hello_message);
+    tcp_connection->send_message(encoded_hello.data(), encoded_hello.size());
 
     if (server_hello_message.version == 0) {
         THROW_EXCEPTION(ProtocolError, "Protocol version mismatch");
     }
 
+    // Version 1 clients do not know about capabilities.
+    Capabilities capabilities;
+    if (!client_hello_message.legacy) {
+        capabilities =
+            server_hello_message.capabilities.intersect(client_hello_message.capabilities);
+    }
+
+    std::unique_ptr< Connection > connection;
+
     if ((server_hello_message.protocol & Protocol::TLS) == Protocol::TLS) {
         auto tcp_socket = tcp_connection->release_socket();
 
@@ -154,15 +205,37 @@ std::unique_ptr< Connection > ConnServer::negotiate_protocol(std::shared_ptr< Co
 
         tls_socket->accept();
 
-        return std::make_unique< TLSConnection >(std::move(tls_socket), _config.metrics);
+        connection = std::make_unique< TLSConnection >(std::move(tls_socket), _config.metrics);
     } else if ((server_hello_message.protocol & Protocol::TCP) == Protocol::TCP) {
         auto tcp_socket = tcp_connection->release_socket();
-        // Nothing to do, already using TCP
-        // return tcp_connection;
-        return std::make_unique< TCPConnection >(std::move(tcp_socket), _config.metrics);
+
+        if (capabilities.shared_memory) {
+            connection = ShmConnection::accept(std::move(tcp_socket), _config.metrics);
+        } else {
+            // Nothing to do, already using TCP
+            // return tcp_connection;
+            auto new_connection =
+                std::make_unique< TCPConnection >(std::move(tcp_socket), _config.metrics);
+
+            if (_config.use_io_uring) {
+                new_connection->enable_io_uring();
+            }
+
+            connection = std::move(new_connection);
+        }
     } else {
         THROW_EXCEPTION(ProtocolError, "Protocol negotiation failed");
     }
+
+    if (!client_hello_message.legacy) {
+        connection->set_capabilities(capabilities, _config.dictionary);
+    }
+
+    if (_config.max_message_size != 0) {
+        connection->set_max_message_size(_config.max_message_size);
+    }
+
+    return connection;
 }
 
 std::unique_ptr< Connection > ConnServer::accept()
@@ -30,95 +30,642 @@
 
 #include "comm/Connection.h"
 
+#include "comm/BufferPool.h"
+#include "comm/Compression.h"
 #include "comm/Exception.h"
 #include "comm/Variables.h"
 
+#include <cstring>
+
 #include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
 
 using namespace comm;
 
+namespace
+{
+
+// Makes sure 'buffer' can hold 'size' bytes without reallocating. A buffer
+// that is too small, or far larger than needed, is traded with the pool so
+// that connections do not hold on to memory sized for past messages.
+void fit_buffer(std::basic_string< uint8_t >& buffer, size_t size)
+{
+    constexpr size_t max_slack = 8;
+
+    auto capacity = buffer.capacity();
+
+    if (capacity >= size && (capacity <= MIN_BUFFER_SIZE || capacity / max_slack <= size)) {
+        return;
+    }
+
+    auto& pool = BufferPool::instance();
+
+    pool.release(std::move(buffer));
+    buffer = pool.acquire(size);
+}
+
+}  // namespace
+
 Connection::Connection(ConnMetrics* metrics)
-    : _max_buffer_size(DEFAULT_BUFFER_SIZE), _metrics(metrics)
+    : _max_buffer_size(DEFAULT_BUFFER_SIZE)
+    , _max_message_size(DEFAULT_BUFFER_SIZE)
+    , _metrics(metrics)
+    , _compression_threshold(DEFAULT_COMPRESSION_THRESHOLD)
 {
 }
 
-Connection::~Connection() = default;
+Connection::~Connection() { BufferPool::instance().release(std::move(_buffer_str)); }
 
 bool Connection::check_message_size(uint32_t size) { return size <= _max_buffer_size; }
 
 std::string Connection::msg_size_to_str_KB(uint32_t size) { return std::to_string(size / 1024); }
 
-void Connection::send_message(const uint8_t* data, uint32_t size)
+void Connection::send_message(const uint8_t* data, size_t size) { send_message({{data, size}}); }
+
+void Connection::send_message(const std::vector< MessageFragment >& fragments)
 {
-    if (size > _max_buffer_size) {
+    check_stream(_send_state);
+
+    size_t total_size = 0;
+
+    for (auto& fragment : fragments) {
+        total_size += fragment.size;
+    }
+
+    if (total_size > max_message_size()) {
         std::string error_msg = "Cannot send messages larger than " +
-                                msg_size_to_str_KB(_max_buffer_size) + "KB." + " Message size is " +
-                                msg_size_to_str_KB(size) + "KB.";
+                                std::to_string(max_message_size() / 1024) + "KB." +
+                                " Message size is " + std::to_string(total_size / 1024) + "KB.";
         THROW_EXCEPTION(InvalidMessageSize, error_msg);
     }
 
-    auto ret0 = write(reinterpret_cast< const uint8_t* >(&size), sizeof(size));
+    auto max_chunk_size = chunk_size();
+
+    if (total_size <= max_chunk_size) {
+        send_frame(fragments, total_size, false);
+        end_send();
+        return;
+    }
+
+    // Cut the fragments at chunk boundaries, without copying them.
+    std::vector< MessageFragment > chunk;
+    size_t chunk_bytes = 0;
+    size_t bytes_left  = total_size;
+
+    for (auto fragment : fragments) {
+        while (fragment.size > 0) {
+            auto count = std::min(fragment.size, max_chunk_size - chunk_bytes);
+
+            chunk.push_back({fragment.data, count});
+            chunk_bytes += count;
+            bytes_left -= count;
+            fragment.data += count;
+            fragment.size -= count;
+
+            if (chunk_bytes == max_chunk_size || bytes_left == 0) {
+                send_frame(chunk, chunk_bytes, bytes_left > 0);
+                chunk.clear();
+                chunk_bytes = 0;
+            }
+        }
+    }
+
+    end_send();
+}
+
+void Connection::send_frame(const std::vector< MessageFragment >& fragments,
+                            size_t size,
+                            bool continued)
+{
+    uint32_t header     = 0;
+    uint32_t frame_size = static_cast< uint32_t >(size);
+
+    // The size header goes out in the same write as the body,
+    // which saves a syscall (and a TLS record) per message.
+    std::vector< iovec > iov;
+    iov.reserve(fragments.size() + 2);
+    iov.push_back({&header, sizeof(header)});
+
+    auto compression = _capabilities.compression;
+    auto raw_codec   = static_cast< uint8_t >(FrameCodec::Raw);
 
-    if (ret0 != sizeof(size)) {
-        THROW_EXCEPTION(WriteFail);
+    // Frames that go out raw anyway do not need a buffer.
+    bool compress = compression != Compression::None &&
+                    worth_compressing(compression, _compression_threshold, fragments, size);
+
+    if (compress) {
+        fit_buffer(_send_frame_buffer, COMPRESSED_FRAME_HEADER_SIZE + size);
     }
 
-    size_t bytes_sent = 0;
+    if (compress && compress_frame(
+                        compression, _compression_threshold, fragments, size, _send_frame_buffer)) {
+        frame_size = static_cast< uint32_t >(_send_frame_buffer.size());
+        iov.push_back({_send_frame_buffer.data(), _send_frame_buffer.size()});
+    } else {
+        if (compression != Compression::None) {
+            frame_size += RAW_FRAME_HEADER_SIZE;
+            iov.push_back({&raw_codec, RAW_FRAME_HEADER_SIZE});
+        }
 
-    while (bytes_sent < size) {
-        bytes_sent += write(data + bytes_sent, size - bytes_sent);
+        for (auto& fragment : fragments) {
+            if (fragment.size > 0) {
+                iov.push_back({const_cast< uint8_t* >(fragment.data), fragment.size});
+            }
+        }
+    }
+
+    header = continued ? frame_size | FRAME_CONTINUED : frame_size;
+
+    size_t bytes_left = sizeof(header) + frame_size;
+    size_t first      = 0;
+
+    while (bytes_left > 0) {
+        size_t count = timed_writev(iov.data() + first, static_cast< int >(iov.size() - first));
+
+        if (count == 0 || count > bytes_left) {
+            THROW_EXCEPTION(WriteFail);
+        }
+
+        bytes_left -= count;
+
+        // Skip over whatever was fully written, and trim what was not.
+        while (first < iov.size() && count >= iov[first].iov_len) {
+            count -= iov[first].iov_len;
+            ++first;
+        }
+
+        if (count > 0) {
+            iov[first].iov_base = static_cast< uint8_t* >(iov[first].iov_base) + count;
+            iov[first].iov_len -= count;
+        }
     }
 
     if (_metrics) {
-        _metrics->observe_bytes_sent(bytes_sent);
+        _metrics->observe_bytes_sent(frame_size);
+    }
+}
+
+size_t Connection::writev(const iovec* iov, int iovcnt)
+{
+    for (int i = 0; i < iovcnt; ++i) {
+        if (iov[i].iov_len > 0) {
+            return write(static_cast< const uint8_t* >(iov[i].iov_base), iov[i].iov_len);
+        }
+    }
+
+    return 0;
+}
+
+size_t Connection::timed_write(const uint8_t* buffer, size_t length)
+{
+    if (!_send_deadline.is_set()) {
+        return write(buffer, length);
+    }
+
+    size_t count;
+
+    while ((count = write_some(buffer, length)) == 0) {
+        wait_for_deadline(POLLOUT);
+    }
+
+    _send_state = StreamState::Partial;
+
+    return count;
+}
+
+size_t Connection::timed_writev(const iovec* iov, int iovcnt)
+{
+    if (!_send_deadline.is_set()) {
+        return writev(iov, iovcnt);
+    }
+
+    for (int i = 0; i < iovcnt; ++i) {
+        if (iov[i].iov_len > 0) {
+            return timed_write(static_cast< const uint8_t* >(iov[i].iov_base), iov[i].iov_len);
+        }
+    }
+
+    return 0;
+}
+
+// Gives up on sendfile(2), which has no non-blocking counterpart here.
+size_t Connection::timed_write_file(int file_fd, off_t offset, size_t count)
+{
+    if (!_send_deadline.is_set()) {
+        return write_file(file_fd, offset, count);
+    }
+
+    uint8_t buffer[16 * 1024];
+
+    errno       = 0;
+    auto length = ::pread(file_fd, buffer, std::min(count, sizeof(buffer)), offset);
+
+    if (length < 0) {
+        THROW_EXCEPTION(ReadFail, errno, "pread()", 0);
+    }
+
+    size_t written = 0;
+
+    while (written < static_cast< size_t >(length)) {
+        written += timed_write(buffer + written, static_cast< size_t >(length) - written);
+    }
+
+    return written;
+}
+
+size_t Connection::timed_read(uint8_t* buffer, size_t length)
+{
+    size_t count;
+
+    if (!_recv_deadline.is_set()) {
+        count = read(buffer, length);
+    } else {
+        while ((count = read_some(buffer, length)) == 0) {
+            wait_for_deadline(POLLIN);
+        }
+    }
+
+    _recv_state = StreamState::Partial;
+
+    return count;
+}
+
+void Connection::wait_for_deadline(short events)
+{
+    const auto& deadline = events == POLLIN ? _recv_deadline : _send_deadline;
+
+    if (wait_ready(events, deadline.remaining_ms())) {
+        return;
+    }
+
+    // Partway through a message, the peer can no longer be kept in step.
+    // Neither can it while a reply is due, as the late reply would be taken
+    // for the next one.
+    auto& state = events == POLLIN ? _recv_state : _send_state;
+    bool reply_due =
+        events == POLLIN && __atomic_load_n(&_messages_sent, __ATOMIC_ACQUIRE) > _messages_received;
+
+    if (state == StreamState::Partial || reply_due) {
+        state = StreamState::Broken;
+        shutdown();
     }
+
+    THROW_EXCEPTION(Timeout, events == POLLIN ? "Deadline passed while receiving"
+                                              : "Deadline passed while sending");
 }
 
+void Connection::check_stream(StreamState state) const
+{
+    if (state == StreamState::Broken) {
+        THROW_EXCEPTION(ConnectionError, "Connection left out of step with the peer by a Timeout");
+    }
+}
+
+bool Connection::wait_ready(short events, int timeout_ms)
+{
+    pollfd fd{native_handle(), events, 0};
+    int result;
+
+    while ((result = ::poll(&fd, 1, timeout_ms)) < 0) {
+        if (errno != EINTR) {
+            THROW_EXCEPTION(ReadFail, errno, "poll()", 0);
+        }
+    }
+
+    return result > 0;
+}
+
+void Connection::set_deadline(const Deadline& deadline)
+{
+    _send_deadline = deadline;
+    _recv_deadline = deadline;
+}
+
+void Connection::set_send_deadline(const Deadline& deadline) { _send_deadline = deadline; }
+
+void Connection::set_recv_deadline(const Deadline& deadline) { _recv_deadline = deadline; }
+
+void Connection::end_send()
+{
+    _send_state = StreamState::Idle;
+    __atomic_store_n(&_messages_sent, _messages_sent + 1, __ATOMIC_RELEASE);
+}
+
+void Connection::end_recv()
+{
+    _recv_state = StreamState::Idle;
+    ++_messages_received;
+}
+
+void Connection::send_file(int file_fd, off_t offset, uint64_t size)
+{
+    check_stream(_send_state);
+
+    if (size > max_message_size()) {
+        std::string error_msg = "Cannot send messages larger than " +
+                                std::to_string(max_message_size() / 1024) + "KB." +
+                                " Message size is " + std::to_string(size / 1024) + "KB.";
+        THROW_EXCEPTION(InvalidMessageSize, error_msg);
+    }
+
+    auto max_chunk_size = chunk_size();
+
+    do {
+        auto count = static_cast< uint32_t >(std::min< uint64_t >(size, max_chunk_size));
+
+        send_file_frame(file_fd, offset, count, size > count);
+
+        offset += static_cast< off_t >(count);
+        size -= count;
+    } while (size > 0);
+
+    end_send();
+}
+
+// Uncorks on the way out, even when the frame was cut short by an error,
+// so that whatever was written is not held back from the peer.
+class Connection::CorkGuard
+{
+   public:
+    explicit CorkGuard(Connection& connection) : _connection(connection)
+    {
+        _connection.cork(true);
+    }
+
+    ~CorkGuard() { _connection.cork(false); }
+
+    NOT_COPYABLE(CorkGuard);
+    NOT_MOVEABLE(CorkGuard);
+
+   private:
+    Connection& _connection;
+};
+
+void Connection::send_file_frame(int file_fd, off_t offset, uint32_t size, bool continued)
+{
+    // Files go out as they are, behind a raw frame header if need be.
+    uint8_t header[sizeof(size) + RAW_FRAME_HEADER_SIZE];
+    size_t header_size = sizeof(size);
+    uint32_t wire_size = size;
+
+    if (_capabilities.compression != Compression::None) {
+        wire_size += RAW_FRAME_HEADER_SIZE;
+        header[sizeof(size)] = static_cast< uint8_t >(FrameCodec::Raw);
+        header_size += RAW_FRAME_HEADER_SIZE;
+    }
+
+    uint32_t frame_header = continued ? wire_size | FRAME_CONTINUED : wire_size;
+    std::memcpy(header, &frame_header, sizeof(frame_header));
+
+    CorkGuard cork_guard(*this);
+
+    size_t bytes_left = header_size;
+
+    while (bytes_left > 0) {
+        auto count = timed_write(header + header_size - bytes_left, bytes_left);
+
+        if (count == 0) {
+            THROW_EXCEPTION(WriteFail);
+        }
+
+        bytes_left -= count;
+    }
+
+    bytes_left = size;
+
+    while (bytes_left > 0) {
+        auto count = timed_write_file(file_fd, offset, bytes_left);
+
+        if (count == 0) {
+            THROW_EXCEPTION(WriteFail, "Unexpected end of file");
+        }
+
+        offset += static_cast< off_t >(count);
+        bytes_left -= count;
+    }
+
+    if (_metrics) {
+        _metrics->observe_bytes_sent(wire_size);
+    }
+}
+
+size_t Connection::write_file(int file_fd, off_t offset, size_t count)
+{
+    uint8_t buffer[16 * 1024];
+
+    errno       = 0;
+    auto length = ::pread(file_fd, buffer, std::min(count, sizeof(buffer)), offset);
+
+    if (length < 0) {
+        THROW_EXCEPTION(ReadFail, errno, "pread()", 0);
+    }
+
+    size_t written = 0;
+
+    while (written < static_cast< size_t >(length)) {
+        auto bytes_written = write(buffer + written, static_cast< size_t >(length) - written);
+
+        if (bytes_written == 0) {
+            THROW_EXCEPTION(WriteFail);
+        }
+
+        written += bytes_written;
+    }
+
+    return written;
+}
+
+void Connection::cork(bool /*corked*/) {}
+
 const std::basic_string< uint8_t >& Connection::recv_message()
 {
-    uint32_t recv_message_size;
+    recv_message(_buffer_str);
+
+    return _buffer_str;
+}
+
+void Connection::recv_message(std::basic_string< uint8_t >& message)
+{
+    check_stream(_recv_state);
 
-    auto recv_and_check = [this](uint8_t* buffer, uint32_t size) {
-        size_t bytes_recv = 0;
+    bool continued = recv_frame(message, true);
 
-        while (bytes_recv < size) {
-            bytes_recv += read(buffer + bytes_recv, size - bytes_recv);
+    while (continued) {
+        continued = recv_frame(message, false);
+    }
+
+    end_recv();
+}
+
+void Connection::recv_message(const MessageSink& sink)
+{
+    check_stream(_recv_state);
+
+    uint64_t received = 0;
+    bool continued    = true;
+
+    // Raw bodies are handed over as they are read. Compressed ones have to
+    // be decoded first, so they are handed over a frame at a time.
+    BufferPool::Lease lease(std::min< size_t >(_max_buffer_size, STREAM_BUFFER_SIZE));
+    auto& buffer = lease.buffer();
+
+    while (continued) {
+        uint8_t codec;
+        auto size         = recv_frame_header(continued, codec);
+        uint64_t max_body = std::min< uint64_t >(_max_buffer_size, max_message_size() - received);
+
+        if (codec != static_cast< uint8_t >(FrameCodec::Raw)) {
+            buffer.clear();
+            recv_compressed_frame(codec, size, max_body, buffer);
+            sink(buffer.data(), buffer.size());
+            received += buffer.size();
+            continue;
+        }
+
+        if (size > max_body) {
+            THROW_EXCEPTION(InvalidMessageSize);
         }
 
-        return bytes_recv;
-    };
+        size_t bytes_left = size;
+
+        buffer.resize(std::min< size_t >(buffer.capacity(), STREAM_BUFFER_SIZE));
 
-    size_t bytes_recv =
-        recv_and_check(reinterpret_cast< uint8_t* >(&recv_message_size), sizeof(recv_message_size));
+        while (bytes_left > 0) {
+            auto count = timed_read(buffer.data(), std::min(bytes_left, buffer.size()));
 
-    if (bytes_recv != sizeof(recv_message_size)) {
-        THROW_EXCEPTION(ReadFail, "Short read msg header");
+            sink(buffer.data(), count);
+            bytes_left -= count;
+        }
+
+        received += size;
+
+        if (_metrics) {
+            _metrics->observe_bytes_recv(size);
+        }
     }
 
-    if (recv_message_size > _max_buffer_size) {
+    end_recv();
+}
+
+void Connection::recv_all(uint8_t* buffer, size_t size)
+{
+    size_t bytes_recv = 0;
+
+    while (bytes_recv < size) {
+        bytes_recv += timed_read(buffer + bytes_recv, size - bytes_recv);
+    }
+}
+
+uint32_t Connection::recv_frame_header(bool& continued, uint8_t& codec)
+{
+    uint32_t header;
+
+    recv_all(reinterpret_cast< uint8_t* >(&header), sizeof(header));
+
+    continued                  = false;
+    uint32_t recv_message_size = header;
+
+    if (_capabilities.chunked_messages) {
+        continued         = (header & FRAME_CONTINUED) != 0;
+        recv_message_size = header & FRAME_SIZE_MASK;
+    }
+
+    auto compression = _capabilities.compression;
+    size_t max_size  = _max_buffer_size;
+
+    if (compression != Compression::None) {
+        max_size += COMPRESSED_FRAME_HEADER_SIZE;
+    }
+
+    if (recv_message_size > max_size) {
         std::string error_msg = "Cannot recieve messages larger than " +
                                 msg_size_to_str_KB(_max_buffer_size) + "KB." +
                                 "Received size: " + std::to_string(recv_message_size);
         THROW_EXCEPTION(InvalidMessageSize, error_msg);
     }
 
-    _buffer_str.resize(recv_message_size);
+    codec = static_cast< uint8_t >(FrameCodec::Raw);
+
+    if (compression != Compression::None) {
+        if (recv_message_size < RAW_FRAME_HEADER_SIZE) {
+            THROW_EXCEPTION(ProtocolError, "Empty frame");
+        }
+
+        recv_all(&codec, RAW_FRAME_HEADER_SIZE);
+        recv_message_size -= RAW_FRAME_HEADER_SIZE;
+    }
+
+    return recv_message_size;
+}
+
+void Connection::recv_compressed_frame(uint8_t codec,
+                                       uint32_t size,
+                                       uint64_t max_size,
+                                       std::basic_string< uint8_t >& message)
+{
+    fit_buffer(_recv_frame_buffer, RAW_FRAME_HEADER_SIZE + size);
+    _recv_frame_buffer.resize(RAW_FRAME_HEADER_SIZE + size);
+    _recv_frame_buffer[0] = codec;
+
+    recv_all(_recv_frame_buffer.data() + RAW_FRAME_HEADER_SIZE, size);
+
+    decode_frame(_capabilities.compression,
+                 _recv_frame_buffer.data(),
+                 _recv_frame_buffer.size(),
+                 max_size,
+                 message);
+
+    if (_metrics) {
+        _metrics->observe_bytes_recv(_recv_frame_buffer.size());
+    }
+}
+
+bool Connection::recv_frame(std::basic_string< uint8_t >& message, bool first)
+{
+    bool continued;
+    uint8_t codec;
+    auto recv_message_size = recv_frame_header(continued, codec);
+
+    // What is left of the message size limit, for this frame and the next.
+    size_t offset     = first ? 0 : message.size();
+    uint64_t max_body = std::min< uint64_t >(_max_buffer_size, max_message_size() - offset);
+
+    // Compressed frames go through a buffer of their own; raw ones are read
+    // in place, below.
+    if (codec != static_cast< uint8_t >(FrameCodec::Raw)) {
+        if (first) {
+            message.clear();
+        }
+
+        recv_compressed_frame(codec, recv_message_size, max_body, message);
 
-    bytes_recv = recv_and_check(_buffer_str.data(), recv_message_size);
+        return continued;
+    }
 
-    if (recv_message_size != bytes_recv) {
-        THROW_EXCEPTION(ReadFail, "Short read msg body");
+    if (recv_message_size > max_body) {
+        THROW_EXCEPTION(InvalidMessageSize);
     }
 
-    if (recv_message_size != _buffer_str.size()) {
-        THROW_EXCEPTION(ReadFail, "Short read other");
+    // Only the first frame may trade the buffer, as later ones append to it.
+    if (first) {
+        fit_buffer(message, recv_message_size);
     }
 
+    message.resize(offset + recv_message_size);
+
+    recv_all(message.data() + offset, recv_message_size);
+
     if (_metrics) {
-        _metrics->observe_bytes_recv(bytes_recv);
+        _metrics->observe_bytes_recv(recv_message_size);
     }
 
-    return _buffer_str;
+    return continued;
+}
+
+void Connection::set_compression_threshold(size_t threshold)
+{
+    _compression_threshold = threshold;
 }
 
 void Connection::set_max_buffer_size(uint32_t max_buffer_size)
@@ -127,11 +674,60 @@ void Connection::set_max_buffer_size(uint32_t max_buffer_size)
     _max_buffer_size = std::min(MAX_BUFFER_SIZE, _max_buffer_size);
 }
 
+void Connection::set_max_message_size(uint64_t max_message_size)
+{
+    _max_message_size = max_message_size;
+}
+
+uint64_t Connection::max_message_size() const
+{
+    if (!_capabilities.chunked_messages) {
+        return _max_buffer_size;
+    }
+
+    return std::max< uint64_t >(_max_message_size, _max_buffer_size);
+}
+
+size_t Connection::chunk_size() const
+{
+    if (!_capabilities.chunked_messages) {
+        return _max_buffer_size;
+    }
+
+    return std::min(_max_buffer_size, MESSAGE_CHUNK_SIZE);
+}
+
+const Capabilities& Connection::capabilities() const { return _capabilities; }
+
+const std::shared_ptr< const CompressionDictionary >& Connection::dictionary() const
+{
+    return _dictionary;
+}
+
+void Connection::set_capabilities(const Capabilities& capabilities,
+                                  std::shared_ptr< const CompressionDictionary > dictionary)
+{
+    _capabilities = capabilities;
+
+    if (capabilities.dictionary_id != 0) {
+        _dictionary = std::move(dictionary);
+    }
+
+    if (capabilities.max_frame_size != 0) {
+        auto max_frame_size = std::min< uint64_t >(capabilities.max_frame_size, MAX_BUFFER_SIZE);
+        set_max_buffer_size(std::min(_max_buffer_size, static_cast< uint32_t >(max_frame_size)));
+    }
+}
+
 std::string Connection::source_family_name(short source_family) const
 {
     switch (source_family) {
         case AF_INET:
             return "ipv4";
+        case AF_INET6:
+            return "ipv6";
+        case AF_UNIX:
+            return "unix";
         case AF_UNSPEC:
             return "unspec";
         default:
@@ -0,0 +1,570 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#include "comm/EventLoop.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <deque>
+
+#include "util/gcc_util.h"
+DISABLE_WARNING(effc++)
+DISABLE_WARNING(suggest-override)
+#include <glog/logging.h>
+ENABLE_WARNING(suggest-override)
+ENABLE_WARNING(effc++)
+
+#include "comm/BufferPool.h"
+#include "comm/Compression.h"
+#include "comm/ConnServer.h"
+#include "comm/Exception.h"
+#include "comm/FrameDecoder.h"
+#include "comm/TCPConnection.h"
+#include "comm/TCPSocket.h"
+#include "comm/Variables.h"
+#include "comm/WorkerPool.h"
+
+using namespace comm;
+
+namespace
+{
+
+// epoll user data for the two descriptors that are not connections.
+constexpr uint64_t LISTENING_SOCKET_ID = 0;
+constexpr uint64_t WAKEUP_ID           = 1;
+constexpr uint64_t FIRST_CLIENT_ID     = 2;
+
+bool compressed(const Connection& connection)
+{
+    return connection.capabilities().compression != Compression::None;
+}
+
+}  // namespace
+
+struct EventLoop::Client {
+    Client(uint64_t id_, std::unique_ptr< Connection > connection_)
+        : id(id_)
+        , connection(std::move(connection_))
+        , decoder(connection->_max_buffer_size +
+                      (compressed(*connection) ? COMPRESSED_FRAME_HEADER_SIZE : 0),
+                  connection->capabilities().chunked_messages)
+    {
+    }
+
+    uint64_t id;
+    std::unique_ptr< Connection > connection;
+    FrameDecoder decoder;
+
+    // Chunks of a message received so far.
+    std::basic_string< uint8_t > message{};
+
+    // Messages received while an earlier one is still being handled.
+    // The connection is not read from while this is full.
+    std::deque< std::basic_string< uint8_t > > requests{};
+    bool busy{false};
+    bool reading{true};
+
+    // Framed responses not yet accepted by the socket.
+    std::basic_string< uint8_t > output{};
+    size_t output_sent{0};
+    bool want_write{false};
+
+    // Events epoll was last asked to report.
+    uint32_t watched{EPOLLIN};
+};
+
+EventLoop::EventLoop(ConnServer& server, RequestHandler handler, EventLoopConfig config)
+    : _server(server)
+    , _handler(std::move(handler))
+    , _config(std::move(config))
+    , _next_client_id(FIRST_CLIENT_ID)
+    , _workers(std::make_unique< WorkerPool >(_config.worker_threads))
+    , _handshakes()
+{
+    auto handshake_config                = _config.handshakes;
+    handshake_config.offer_shared_memory = false;
+
+    _handshakes = std::make_unique< HandshakeExecutor >(
+        _server, handshake_config, [this](std::unique_ptr< Connection > connection) {
+            try {
+                connection->set_nonblocking(true);
+
+                Event event;
+                event.connection = std::move(connection);
+                post(std::move(event));
+            } catch (const Exception& e) {
+                VLOG(2) << "Unable to serve connection: " << e.name;
+            }
+        });
+
+    _epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+
+    if (_epoll_fd < 0) {
+        THROW_EXCEPTION(SocketFail, errno, "epoll_create1()", 0);
+    }
+
+    _wakeup_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (_wakeup_fd < 0) {
+        THROW_EXCEPTION(SocketFail, errno, "eventfd()", 0);
+    }
+
+    if (!_server._listening_socket->set_nonblocking(true)) {
+        THROW_EXCEPTION(SocketFail, "Unable to make listening socket non-blocking");
+    }
+
+    epoll_event event{};
+    event.events   = EPOLLIN;
+    event.data.u64 = LISTENING_SOCKET_ID;
+
+    if (::epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _server._listening_socket->native_handle(), &event)) {
+        THROW_EXCEPTION(SocketFail, errno, "epoll_ctl()", 0);
+    }
+
+    event.data.u64 = WAKEUP_ID;
+
+    if (::epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _wakeup_fd, &event)) {
+        THROW_EXCEPTION(SocketFail, errno, "epoll_ctl()", 0);
+    }
+}
+
+EventLoop::~EventLoop()
+{
+    // Lets handshakes and handlers in flight finish before the state
+    // they report back to goes away.
+    _handshakes.reset();
+    _workers.reset();
+    _clients.clear();
+
+    _server._listening_socket->set_nonblocking(false);
+
+    if (_wakeup_fd >= 0) {
+        ::close(_wakeup_fd);
+    }
+
+    if (_epoll_fd >= 0) {
+        ::close(_epoll_fd);
+    }
+}
+
+void EventLoop::run()
+{
+    std::vector< epoll_event > events(std::max(1u, _config.max_events));
+
+    while (!_stop) {
+        // Connections with data left over are served again right away.
+        int timeout = _pending.empty() ? -1 : 0;
+        int count   = ::epoll_wait(
+            _epoll_fd, events.data(), static_cast< int >(events.size()), timeout);
+
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            THROW_EXCEPTION(SocketFail, errno, "epoll_wait()", 0);
+        }
+
+        for (int i = 0; i < count; ++i) {
+            auto id = events[i].data.u64;
+
+            if (id == LISTENING_SOCKET_ID) {
+                accept_connections();
+                continue;
+            }
+
+            if (id == WAKEUP_ID) {
+                process_events();
+                continue;
+            }
+
+            auto it = _clients.find(id);
+
+            if (it == _clients.end()) {
+                continue;  // Closed earlier in this batch
+            }
+
+            auto client = it->second;
+
+            try {
+                if (events[i].events & EPOLLOUT) {
+                    flush(*client);
+                    dispatch(client);
+                }
+
+                if (events[i].events & (EPOLLHUP | EPOLLERR) && !client->reading) {
+                    THROW_EXCEPTION(ConnectionShutDown, "Peer hung up");
+                }
+
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    receive(client);
+                }
+            } catch (const Exception& e) {
+                VLOG(2) << "Closing connection from " << client->connection->get_source() << ": "
+                        << e.name;
+                remove_client(id);
+            }
+        }
+
+        receive_pending();
+    }
+}
+
+void EventLoop::stop()
+{
+    _stop = true;
+
+    uint64_t one = 1;
+    [[maybe_unused]] auto ret = ::write(_wakeup_fd, &one, sizeof(one));
+}
+
+std::size_t EventLoop::connections() const { return _number_of_clients; }
+
+void EventLoop::accept_connections()
+{
+    while (auto socket = TCPSocket::try_accept(_server._listening_socket)) {
+        // The handshake is blocking; keep it off the loop thread.
+        _handshakes->submit(
+            std::make_unique< TCPConnection >(std::move(socket), _server._config.metrics));
+    }
+}
+
+void EventLoop::process_events()
+{
+    uint64_t value;
+    [[maybe_unused]] auto ret = ::read(_wakeup_fd, &value, sizeof(value));
+
+    std::vector< Event > events;
+
+    {
+        std::lock_guard< std::mutex > lock(_events_mutex);
+        events.swap(_events);
+    }
+
+    for (auto& event : events) {
+        if (event.connection) {
+            add_client(std::move(event.connection));
+            continue;
+        }
+
+        auto it = _clients.find(event.client_id);
+
+        if (it == _clients.end()) {
+            continue;  // The peer went away while its request was handled
+        }
+
+        auto client = it->second;
+
+        if (event.failed) {
+            remove_client(client->id);
+            continue;
+        }
+
+        try {
+            respond(*client, std::move(event.response));
+            client->busy = false;
+            dispatch(client);
+        } catch (const Exception& e) {
+            VLOG(2) << "Closing connection from " << client->connection->get_source() << ": "
+                    << e.name;
+            remove_client(client->id);
+        }
+    }
+}
+
+void EventLoop::add_client(std::unique_ptr< Connection > connection)
+{
+    auto id     = _next_client_id++;
+    auto client = std::make_shared< Client >(id, std::move(connection));
+
+    epoll_event event{};
+    event.events   = EPOLLIN;
+    event.data.u64 = id;
+
+    if (::epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, client->connection->native_handle(), &event)) {
+        VLOG(2) << "Unable to watch connection from " << client->connection->get_source();
+        return;
+    }
+
+    _clients.emplace(id, client);
+    ++_number_of_clients;
+
+    // The handshake may have left application data in the TLS buffers,
+    // which epoll would not report.
+    try {
+        receive(client);
+    } catch (const Exception&) {
+        remove_client(id);
+    }
+}
+
+void EventLoop::remove_client(uint64_t id)
+{
+    auto it = _clients.find(id);
+
+    if (it == _clients.end()) {
+        return;
+    }
+
+    ::epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, it->second->connection->native_handle(), nullptr);
+
+    // The socket is closed once no worker refers to the client anymore.
+    _clients.erase(it);
+    --_number_of_clients;
+}
+
+void EventLoop::receive(const std::shared_ptr< Client >& client)
+{
+    auto& connection = *client->connection;
+
+    auto max_requests = std::max(1u, _config.max_queued_requests);
+    auto max_reads    = std::max(1u, _config.max_reads_per_wakeup);
+
+    // With TLS, stopping before the socket runs dry could leave decrypted
+    // data behind that epoll has no way to signal, so a connection that
+    // runs out of reads goes on the pending list, to be read again.
+    for (unsigned reads = 0;; ++reads) {
+        if (client->requests.size() >= max_requests) {
+            client->reading = false;
+            watch(*client);
+            break;
+        }
+
+        if (reads == max_reads) {
+            _pending.push_back(client->id);
+            break;
+        }
+
+        auto space = client->decoder.space();
+        auto count = connection.read_some(space.data, space.size);
+
+        if (count == 0) {
+            break;
+        }
+
+        if (client->decoder.commit(count)) {
+            auto frame   = client->decoder.take_message();
+            auto& buffer = client->message;
+
+            if (connection._metrics) {
+                connection._metrics->observe_bytes_recv(frame.size());
+            }
+
+            if (compressed(connection)) {
+                if (buffer.capacity() == 0) {
+                    buffer = BufferPool::instance().acquire(frame.size());
+                }
+
+                auto max_size = std::min< uint64_t >(connection._max_buffer_size,
+                                                     connection.max_message_size() - buffer.size());
+
+                decode_frame(connection._capabilities.compression,
+                             frame.data(),
+                             frame.size(),
+                             max_size,
+                             buffer);
+
+                BufferPool::instance().release(std::move(frame));
+            } else if (buffer.empty()) {
+                BufferPool::instance().release(std::move(buffer));
+                buffer = std::move(frame);
+            } else {
+                if (buffer.size() + frame.size() > connection.max_message_size()) {
+                    THROW_EXCEPTION(InvalidMessageSize);
+                }
+
+                buffer.append(frame);
+                BufferPool::instance().release(std::move(frame));
+            }
+
+            if (!client->decoder.continued()) {
+                client->requests.push_back(std::move(buffer));
+                buffer = {};
+            }
+        }
+    }
+
+    dispatch(client);
+}
+
+void EventLoop::receive_pending()
+{
+    std::vector< uint64_t > pending;
+    pending.swap(_pending);
+
+    for (auto id : pending) {
+        auto it = _clients.find(id);
+
+        if (it == _clients.end() || !it->second->reading) {
+            continue;
+        }
+
+        auto client = it->second;
+
+        try {
+            receive(client);
+        } catch (const Exception& e) {
+            VLOG(2) << "Closing connection from " << client->connection->get_source() << ": "
+                    << e.name;
+            remove_client(id);
+        }
+    }
+}
+
+void EventLoop::respond(Client& client, std::basic_string< uint8_t >&& response)
+{
+    auto& connection = *client.connection;
+
+    if (response.size() > connection.max_message_size()) {
+        THROW_EXCEPTION(InvalidMessageSize);
+    }
+
+    // Large responses go out in chunks, as Connection::send_message does.
+    auto chunk_size = connection.chunk_size();
+    size_t sent     = 0;
+
+    do {
+        auto count = std::min(response.size() - sent, chunk_size);
+
+        frame(client, response.data() + sent, count, sent + count < response.size());
+        sent += count;
+    } while (sent < response.size());
+
+    BufferPool::instance().release(std::move(response));
+
+    flush(client);
+}
+
+void EventLoop::frame(Client& client, const uint8_t* data, size_t size, bool continued)
+{
+    auto& connection = *client.connection;
+
+    uint32_t frame_size = static_cast< uint32_t >(size);
+    uint32_t header;
+
+    if (!compressed(connection)) {
+        header = continued ? frame_size | FRAME_CONTINUED : frame_size;
+        client.output.append(reinterpret_cast< const uint8_t* >(&header), sizeof(header));
+        client.output.append(data, size);
+    } else if (compress_frame(connection._capabilities.compression,
+                              connection._compression_threshold,
+                              {{data, size}},
+                              size,
+                              connection._send_frame_buffer)) {
+        frame_size = static_cast< uint32_t >(connection._send_frame_buffer.size());
+        header     = continued ? frame_size | FRAME_CONTINUED : frame_size;
+        client.output.append(reinterpret_cast< const uint8_t* >(&header), sizeof(header));
+        client.output.append(connection._send_frame_buffer);
+    } else {
+        frame_size += RAW_FRAME_HEADER_SIZE;
+        header = continued ? frame_size | FRAME_CONTINUED : frame_size;
+        client.output.append(reinterpret_cast< const uint8_t* >(&header), sizeof(header));
+        client.output.push_back(static_cast< uint8_t >(FrameCodec::Raw));
+        client.output.append(data, size);
+    }
+
+    if (connection._metrics) {
+        connection._metrics->observe_bytes_sent(frame_size);
+    }
+}
+
+void EventLoop::flush(Client& client)
+{
+    while (client.output_sent < client.output.size()) {
+        auto count = client.connection->write_some(client.output.data() + client.output_sent,
+                                                   client.output.size() - client.output_sent);
+
+        if (count == 0) {
+            break;
+        }
+
+        client.output_sent += count;
+    }
+
+    bool pending = client.output_sent < client.output.size();
+
+    if (!pending) {
+        client.output.clear();
+        client.output_sent = 0;
+    }
+
+    client.want_write = pending;
+    watch(client);
+}
+
+void EventLoop::watch(Client& client)
+{
+    uint32_t events = 0;
+
+    if (client.reading) {
+        events |= EPOLLIN;
+    }
+
+    if (client.want_write) {
+        events |= EPOLLOUT;
+    }
+
+    if (events == client.watched) {
+        return;
+    }
+
+    epoll_event event{};
+    event.events   = events;
+    event.data.u64 = client.id;
+
+    if (::epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, client.connection->native_handle(), &event)) {
+        THROW_EXCEPTION(SocketFail, errno, "epoll_ctl()", 0);
+    }
+
+    client.watched = events;
+}
+
+void EventLoop::dispatch(const std::shared_ptr< Client >& client)
+{
+    // The next response waits for the previous one to be taken by the
+    // socket, so a peer that does not read does not grow the output.
+    if (client->busy || client->want_write || client->requests.empty()) {
+        return;
+    }
+
+    client->busy = true;
+
+    auto request = std::move(client->requests.front());
+    client->requests.pop_front();
+
+    // Room in the queue again.
+    if (!client->reading) {
+        client->reading = true;
+        watch(*client);
+        _pending.push_back(client->id);
+    }
+
+    _workers->submit([this, client, request = std::move(request)]() mutable {
+        Event event;
+        event.client_id = client->id;
+
+        try {
+            event.response = _handler(*client->connection, request);
+        } catch (...) {
+            event.failed = true;
+        }
+
+        BufferPool::instance().release(std::move(request));
+
+        post(std::move(event));
+    });
+}
+
+void EventLoop::post(Event&& event)
+{
+    {
+        std::lock_guard< std::mutex > lock(_events_mutex);
+        _events.push_back(std::move(event));
+    }
+
+    uint64_t one = 1;
+    [[maybe_unused]] auto ret = ::write(_wakeup_fd, &one, sizeof(one));
+}
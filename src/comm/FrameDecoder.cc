@@ -0,0 +1,81 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#include "comm/FrameDecoder.h"
+
+#include <algorithm>
+
+#include "comm/BufferPool.h"
+#include "comm/Exception.h"
+#include "comm/Variables.h"
+
+using namespace comm;
+
+FrameDecoder::FrameDecoder(uint32_t max_frame_size, bool chunked)
+    : _max_frame_size(max_frame_size), _chunked(chunked)
+{
+}
+
+FrameDecoder::Space FrameDecoder::space()
+{
+    if (_header_received < sizeof(_header)) {
+        return {reinterpret_cast< uint8_t* >(&_header) + _header_received,
+                sizeof(_header) - _header_received};
+    }
+
+    if (_body_received == _message.size()) {
+        _message.resize(
+            _body_received + std::min< size_t >(_body_size - _body_received, STREAM_BUFFER_SIZE));
+    }
+
+    return {_message.data() + _body_received, _message.size() - _body_received};
+}
+
+bool FrameDecoder::commit(size_t count)
+{
+    if (_header_received < sizeof(_header)) {
+        _header_received += count;
+
+        if (_header_received < sizeof(_header)) {
+            return false;
+        }
+
+        uint32_t size = _chunked ? _header & FRAME_SIZE_MASK : _header;
+        _continued    = _chunked && (_header & FRAME_CONTINUED) != 0;
+
+        if (size > _max_frame_size) {
+            std::string error_msg = "Cannot recieve messages larger than " +
+                                    std::to_string(_max_frame_size / 1024) + "KB." +
+                                    "Received size: " + std::to_string(size);
+            THROW_EXCEPTION(InvalidMessageSize, error_msg);
+        }
+
+        _body_size = size;
+        _message   = BufferPool::instance().acquire(std::min< size_t >(size, STREAM_BUFFER_SIZE));
+        _message.resize(std::min< size_t >(size, STREAM_BUFFER_SIZE));
+    } else {
+        _body_received += count;
+    }
+
+    _complete = _body_received == _body_size;
+
+    return _complete;
+}
+
+std::basic_string< uint8_t > FrameDecoder::take_message()
+{
+    if (!_complete) {
+        THROW_EXCEPTION(ReadFail, "Message is not complete");
+    }
+
+    _header_received = 0;
+    _body_received   = 0;
+    _complete        = false;
+
+    return std::move(_message);
+}
+
+bool FrameDecoder::continued() const { return _continued; }
+
+bool FrameDecoder::in_progress() const { return _header_received > 0; }
@@ -0,0 +1,73 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "util/Macros.h"
+
+namespace comm
+{
+
+// Reassembles length-prefixed messages from a byte stream that arrives in
+// arbitrary pieces, as it does from a non-blocking socket.
+//
+// The decoder hands out the memory the next bytes should be read into, so
+// message bodies land in their final buffer without an extra copy:
+//
+//    auto space = decoder.space();
+//    auto count = connection.read_some(space.data, space.size);
+//    if (decoder.commit(count)) {
+//        handle(decoder.take_message());
+//    }
+class FrameDecoder
+{
+   public:
+    struct Space {
+        uint8_t* data;
+        size_t size;
+    };
+
+    // With 'chunked', the high bit of frame headers is read as
+    // FRAME_CONTINUED rather than as part of the size.
+    explicit FrameDecoder(uint32_t max_frame_size, bool chunked = false);
+
+    MOVEABLE_BY_DEFAULT(FrameDecoder);
+    NOT_COPYABLE(FrameDecoder);
+
+    // Where the next bytes of the stream go, and how many are wanted.
+    // The body buffer grows as the body arrives, STREAM_BUFFER_SIZE at a
+    // time, so that a peer announcing a large frame is not given the
+    // memory for it before it sends the bytes.
+    Space space();
+
+    // Records that 'count' bytes were stored in space(). Returns true once
+    // a whole message is available from take_message().
+    // Throws InvalidMessageSize if the peer announces an oversized message.
+    bool commit(size_t count);
+
+    // Hands over the completed message and starts decoding the next one.
+    std::basic_string< uint8_t > take_message();
+
+    // Whether the message last completed goes on in the next frame.
+    bool continued() const;
+
+    // Whether part of a message has been received.
+    bool in_progress() const;
+
+   private:
+    uint32_t _max_frame_size;
+    bool _chunked;
+    uint32_t _header{0};
+    size_t _header_received{0};
+    size_t _body_size{0};
+    size_t _body_received{0};
+    bool _complete{false};
+    bool _continued{false};
+    std::basic_string< uint8_t > _message{};
+};
+
+};  // namespace comm
@@ -0,0 +1,221 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#include "comm/HandshakeExecutor.h"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "util/gcc_util.h"
+DISABLE_WARNING(effc++)
+DISABLE_WARNING(suggest-override)
+#include <glog/logging.h>
+ENABLE_WARNING(suggest-override)
+ENABLE_WARNING(effc++)
+
+#include "comm/ConnServer.h"
+#include "comm/Exception.h"
+#include "comm/WorkerPool.h"
+
+using namespace comm;
+
+HandshakeExecutor::HandshakeExecutor(ConnServer& server, HandshakeExecutorConfig config)
+    : HandshakeExecutor(server, std::move(config), nullptr)
+{
+}
+
+HandshakeExecutor::HandshakeExecutor(ConnServer& server,
+                                     HandshakeExecutorConfig config,
+                                     ReadyHandler on_ready)
+    : _server(server)
+    , _config(std::move(config))
+    , _on_ready(std::move(on_ready))
+    , _watchdog(&HandshakeExecutor::watch, this)
+    , _workers(std::make_unique< WorkerPool >(_config.threads))
+{
+}
+
+HandshakeExecutor::~HandshakeExecutor()
+{
+    stop();
+
+    _workers.reset();
+    _watchdog.join();
+}
+
+void HandshakeExecutor::submit(std::unique_ptr< Connection > connection)
+{
+    std::shared_ptr< Connection > shared_connection = std::move(connection);
+    uint64_t id;
+
+    // The handshake may close the socket (a failed TLS accept does) before
+    // it is out of the map.
+    int fd = ::fcntl(shared_connection->native_handle(), F_DUPFD_CLOEXEC, 0);
+
+    if (fd < 0) {
+        VLOG(2) << "Unable to watch handshake: " << errno;
+
+        std::lock_guard< std::mutex > lock(_mutex);
+        ++_failed;
+        return;
+    }
+
+    {
+        std::lock_guard< std::mutex > lock(_mutex);
+
+        if (_stop) {
+            ::close(fd);
+            return;
+        }
+
+        id = _next_id++;
+
+        // The deadline starts now, so time spent waiting for a free thread
+        // counts against it too.
+        Handshake handshake;
+        handshake.fd       = fd;
+        handshake.deadline = Clock::now() + std::chrono::milliseconds(_config.timeout_ms);
+
+        _in_flight.emplace(id, handshake);
+        ++_pending;
+    }
+
+    _watchdog_cv.notify_one();
+
+    _workers->submit([this, id, shared_connection]() { negotiate(id, shared_connection); });
+}
+
+void HandshakeExecutor::negotiate(uint64_t id, const std::shared_ptr< Connection >& connection)
+{
+    std::unique_ptr< Connection > negotiated;
+
+    try {
+        negotiated = _server.negotiate_protocol(connection, _config.offer_shared_memory);
+    } catch (const Exception& e) {
+        VLOG(2) << "Protocol negotiation failed: " << e.name;
+    }
+
+    {
+        std::lock_guard< std::mutex > lock(_mutex);
+
+        // Once out of the map, the watchdog no longer touches the socket.
+        auto it = _in_flight.find(id);
+        bool timed_out = it == _in_flight.end() || it->second.timed_out;
+
+        if (it != _in_flight.end()) {
+            ::close(it->second.fd);
+            _in_flight.erase(it);
+        }
+
+        --_pending;
+
+        if (!negotiated || timed_out || _stop) {
+            ++_failed;
+            return;
+        }
+
+        if (!_on_ready) {
+            _ready.push_back(std::move(negotiated));
+            _ready_cv.notify_one();
+            return;
+        }
+    }
+
+    _on_ready(std::move(negotiated));
+}
+
+void HandshakeExecutor::watch()
+{
+    std::unique_lock< std::mutex > lock(_mutex);
+
+    while (!_stop) {
+        auto now          = Clock::now();
+        auto next_wake_up = now + std::chrono::seconds(1);
+
+        for (auto& entry : _in_flight) {
+            auto& handshake = entry.second;
+
+            if (handshake.timed_out) {
+                continue;
+            }
+
+            if (handshake.deadline <= now) {
+                // Makes the blocking reads and writes of the handshake fail.
+                ::shutdown(handshake.fd, SHUT_RDWR);
+                handshake.timed_out = true;
+            } else if (handshake.deadline < next_wake_up) {
+                next_wake_up = handshake.deadline;
+            }
+        }
+
+        _watchdog_cv.wait_until(lock, next_wake_up);
+    }
+}
+
+std::unique_ptr< Connection > HandshakeExecutor::next()
+{
+    std::unique_lock< std::mutex > lock(_mutex);
+
+    _ready_cv.wait(lock, [this]() { return _stop || !_ready.empty(); });
+
+    if (_stop) {
+        return nullptr;
+    }
+
+    auto connection = std::move(_ready.front());
+    _ready.pop_front();
+
+    return connection;
+}
+
+std::unique_ptr< Connection > HandshakeExecutor::next(std::chrono::milliseconds timeout)
+{
+    std::unique_lock< std::mutex > lock(_mutex);
+
+    if (!_ready_cv.wait_for(lock, timeout, [this]() { return _stop || !_ready.empty(); }) ||
+        _stop) {
+        return nullptr;
+    }
+
+    auto connection = std::move(_ready.front());
+    _ready.pop_front();
+
+    return connection;
+}
+
+void HandshakeExecutor::stop()
+{
+    {
+        std::lock_guard< std::mutex > lock(_mutex);
+
+        if (_stop) {
+            return;
+        }
+
+        _stop = true;
+
+        for (auto& entry : _in_flight) {
+            if (!entry.second.timed_out) {
+                ::shutdown(entry.second.fd, SHUT_RDWR);
+                entry.second.timed_out = true;
+            }
+        }
+    }
+
+    _ready_cv.notify_all();
+    _watchdog_cv.notify_all();
+}
+
+std::size_t HandshakeExecutor::pending() const
+{
+    std::lock_guard< std::mutex > lock(_mutex);
+    return _pending;
+}
+
+std::size_t HandshakeExecutor::failed() const
+{
+    std::lock_guard< std::mutex > lock(_mutex);
+    return _failed;
+}
@@ -0,0 +1,211 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#include "comm/HelloMessage.h"
+
+#include <algorithm>
+
+#include "comm/Exception.h"
+
+using namespace comm;
+
+namespace
+{
+
+const uint8_t HELLO_MAGIC[] = {'A', 'D', 'B', 'H'};
+
+const size_t LEGACY_HELLO_SIZE = 8;
+
+enum WireType { VARINT = 0, FIXED64 = 1, LENGTH_DELIMITED = 2, FIXED32 = 5 };
+
+enum Field {
+    VERSION          = 1,
+    PROTOCOL         = 2,
+    COMPRESSION      = 3,
+    MAX_FRAME_SIZE   = 4,
+    PIPELINING_DEPTH = 5,
+    KEEPALIVE_MS     = 6,
+    DICTIONARY_ID    = 7,
+    CHUNKED_MESSAGES = 8,
+    SHARED_MEMORY    = 9,
+};
+
+void put_varint(std::basic_string< uint8_t >& buffer, uint64_t value)
+{
+    while (value >= 0x80) {
+        buffer.push_back(static_cast< uint8_t >(value | 0x80));
+        value >>= 7;
+    }
+
+    buffer.push_back(static_cast< uint8_t >(value));
+}
+
+void put_field(std::basic_string< uint8_t >& buffer, Field field, uint64_t value)
+{
+    // Like protobuf, fields holding the default value are left out.
+    if (value != 0) {
+        put_varint(buffer, (static_cast< uint64_t >(field) << 3) | VARINT);
+        put_varint(buffer, value);
+    }
+}
+
+class Reader
+{
+   public:
+    Reader(const uint8_t* data, size_t size) : _data(data), _end(data + size) {}
+
+    bool done() const { return _data == _end; }
+
+    uint64_t varint()
+    {
+        uint64_t value = 0;
+
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            if (done()) {
+                THROW_EXCEPTION(ProtocolError, "Truncated hello message");
+            }
+
+            uint8_t byte = *_data++;
+            value |= static_cast< uint64_t >(byte & 0x7f) << shift;
+
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+
+        THROW_EXCEPTION(ProtocolError, "Malformed hello message");
+    }
+
+    void skip(size_t size)
+    {
+        if (static_cast< size_t >(_end - _data) < size) {
+            THROW_EXCEPTION(ProtocolError, "Truncated hello message");
+        }
+
+        _data += size;
+    }
+
+   private:
+    const uint8_t* _data;
+    const uint8_t* _end;
+};
+
+uint32_t get_le32(const uint8_t* data)
+{
+    return static_cast< uint32_t >(data[0]) | static_cast< uint32_t >(data[1]) << 8 |
+           static_cast< uint32_t >(data[2]) << 16 | static_cast< uint32_t >(data[3]) << 24;
+}
+
+void put_le32(std::basic_string< uint8_t >& buffer, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i) {
+        buffer.push_back(static_cast< uint8_t >(value >> (8 * i)));
+    }
+}
+
+}  // namespace
+
+std::basic_string< uint8_t > comm::encode_hello(const HelloMessage& message)
+{
+    std::basic_string< uint8_t > buffer;
+
+    // Version 1 peers all ran on little-endian hosts.
+    if (message.legacy) {
+        put_le32(buffer, message.version);
+        put_le32(buffer, static_cast< uint32_t >(message.protocol));
+        return buffer;
+    }
+
+    const auto& capabilities = message.capabilities;
+
+    buffer.append(HELLO_MAGIC, sizeof(HELLO_MAGIC));
+    put_field(buffer, VERSION, message.version);
+    put_field(buffer, PROTOCOL, static_cast< uint32_t >(message.protocol));
+    put_field(buffer, COMPRESSION, static_cast< uint32_t >(capabilities.compression));
+    put_field(buffer, MAX_FRAME_SIZE, capabilities.max_frame_size);
+    put_field(buffer, PIPELINING_DEPTH, capabilities.pipelining_depth);
+    put_field(buffer, KEEPALIVE_MS, capabilities.keepalive_ms);
+    put_field(buffer, DICTIONARY_ID, capabilities.dictionary_id);
+    put_field(buffer, CHUNKED_MESSAGES, capabilities.chunked_messages);
+    put_field(buffer, SHARED_MEMORY, capabilities.shared_memory);
+
+    return buffer;
+}
+
+HelloMessage comm::decode_hello(const uint8_t* data, size_t size)
+{
+    HelloMessage message;
+
+    if (size < sizeof(HELLO_MAGIC) ||
+        !std::equal(HELLO_MAGIC, HELLO_MAGIC + sizeof(HELLO_MAGIC), data)) {
+        if (size != LEGACY_HELLO_SIZE) {
+            THROW_EXCEPTION(ProtocolError, "Unknown hello message");
+        }
+
+        message.legacy   = true;
+        message.version  = get_le32(data);
+        message.protocol = static_cast< Protocol >(get_le32(data + 4));
+        return message;
+    }
+
+    auto& capabilities = message.capabilities;
+    Reader reader(data + sizeof(HELLO_MAGIC), size - sizeof(HELLO_MAGIC));
+
+    while (!reader.done()) {
+        auto tag   = reader.varint();
+        auto field = tag >> 3;
+
+        switch (tag & 0x7) {
+            case VARINT: {
+                auto value = reader.varint();
+
+                switch (field) {
+                    case VERSION:
+                        message.version = static_cast< uint32_t >(value);
+                        break;
+                    case PROTOCOL:
+                        message.protocol = static_cast< Protocol >(value);
+                        break;
+                    case COMPRESSION:
+                        capabilities.compression = static_cast< Compression >(value);
+                        break;
+                    case MAX_FRAME_SIZE:
+                        capabilities.max_frame_size = value;
+                        break;
+                    case PIPELINING_DEPTH:
+                        capabilities.pipelining_depth = static_cast< uint32_t >(value);
+                        break;
+                    case KEEPALIVE_MS:
+                        capabilities.keepalive_ms = static_cast< uint32_t >(value);
+                        break;
+                    case DICTIONARY_ID:
+                        capabilities.dictionary_id = static_cast< uint32_t >(value);
+                        break;
+                    case CHUNKED_MESSAGES:
+                        capabilities.chunked_messages = value != 0;
+                        break;
+                    case SHARED_MEMORY:
+                        capabilities.shared_memory = value != 0;
+                        break;
+                    default:
+                        break;  // Added by a newer peer
+                }
+                break;
+            }
+            case FIXED64:
+                reader.skip(8);
+                break;
+            case LENGTH_DELIMITED:
+                reader.skip(reader.varint());
+                break;
+            case FIXED32:
+                reader.skip(4);
+                break;
+            default:
+                THROW_EXCEPTION(ProtocolError, "Malformed hello message");
+        }
+    }
+
+    return message;
+}
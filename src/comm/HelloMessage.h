@@ -4,14 +4,48 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "comm/Capabilities.h"
 #include "comm/Protocol.h"
 
 namespace comm
 {
 
+// First message each peer sends on a new connection.
+//
+// Up to protocol version 1, it was the raw {uint32_t version; uint32_t
+// protocol} struct, in host byte order. It is now a 4-byte magic followed by
+// fields in the protobuf wire format, as if encoded from
+//
+//    message HelloMessage {
+//        uint32 version          = 1;
+//        uint32 protocol         = 2;
+//        uint32 compression      = 3;
+//        uint64 max_frame_size   = 4;
+//        uint32 pipelining_depth = 5;
+//        uint32 keepalive_ms     = 6;
+//        uint32 dictionary_id    = 7;
+//        bool   chunked_messages = 8;
+//        bool   shared_memory    = 9;
+//    }
+//
+// so fields can be added without breaking older peers, which skip the ones
+// they do not know. Version 1 messages are still understood, and answered in
+// kind.
 struct HelloMessage {
     uint32_t version{};
     Protocol protocol{};
+    Capabilities capabilities{};
+    // Version 1 layout.
+    bool legacy{false};
 };
 
+std::basic_string< uint8_t > encode_hello(const HelloMessage& message);
+
+// Throws ProtocolError if the buffer holds neither layout.
+HelloMessage decode_hello(const uint8_t* data, size_t size);
+
 }  // namespace comm
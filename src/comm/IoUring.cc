@@ -0,0 +1,213 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#include "comm/IoUring.h"
+
+#include <algorithm>
+#include <cerrno>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace comm;
+
+namespace
+{
+
+int io_uring_setup(unsigned entries, io_uring_params* params)
+{
+    return static_cast< int >(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_register(int ring_fd, unsigned opcode, const void* arg, unsigned nr_args)
+{
+    return static_cast< int >(::syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args));
+}
+
+int io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return static_cast< int >(
+        ::syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+template < typename T > T* at(void* base, unsigned offset)
+{
+    return reinterpret_cast< T* >(static_cast< uint8_t* >(base) + offset);
+}
+
+}  // namespace
+
+std::unique_ptr< IoUring > IoUring::create(unsigned entries)
+{
+    io_uring_params params{};
+
+    int ring_fd = io_uring_setup(entries, &params);
+
+    if (ring_fd < 0) {
+        return nullptr;
+    }
+
+    std::unique_ptr< IoUring > ring(new IoUring(ring_fd));
+
+    if (!ring->map(params)) {
+        return nullptr;
+    }
+
+    return ring;
+}
+
+IoUring::IoUring(int ring_fd) : _ring_fd(ring_fd) {}
+
+IoUring::~IoUring()
+{
+    if (_sqes) {
+        ::munmap(_sqes, _sqes_size);
+    }
+
+    if (_cq_ring && _cq_ring != _sq_ring) {
+        ::munmap(_cq_ring, _cq_ring_size);
+    }
+
+    if (_sq_ring) {
+        ::munmap(_sq_ring, _sq_ring_size);
+    }
+
+    ::close(_ring_fd);
+}
+
+bool IoUring::map(const io_uring_params& params)
+{
+    _sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    // Since 5.4 both rings live in a single mapping.
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+
+    if (single_mmap) {
+        _sq_ring_size = _cq_ring_size = std::max(_sq_ring_size, _cq_ring_size);
+    }
+
+    auto map_ring = [this](size_t size, off_t offset) -> void* {
+        void* ring = ::mmap(
+            nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, offset);
+        return ring == MAP_FAILED ? nullptr : ring;
+    };
+
+    _sq_ring = map_ring(_sq_ring_size, IORING_OFF_SQ_RING);
+
+    if (!_sq_ring) {
+        return false;
+    }
+
+    _cq_ring = single_mmap ? _sq_ring : map_ring(_cq_ring_size, IORING_OFF_CQ_RING);
+
+    if (!_cq_ring) {
+        return false;
+    }
+
+    _sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    _sqes      = static_cast< io_uring_sqe* >(map_ring(_sqes_size, IORING_OFF_SQES));
+
+    if (!_sqes) {
+        return false;
+    }
+
+    _sq_head  = at< unsigned >(_sq_ring, params.sq_off.head);
+    _sq_tail  = at< unsigned >(_sq_ring, params.sq_off.tail);
+    _sq_mask  = at< unsigned >(_sq_ring, params.sq_off.ring_mask);
+    _sq_array = at< unsigned >(_sq_ring, params.sq_off.array);
+
+    _cq_head = at< unsigned >(_cq_ring, params.cq_off.head);
+    _cq_tail = at< unsigned >(_cq_ring, params.cq_off.tail);
+    _cq_mask = at< unsigned >(_cq_ring, params.cq_off.ring_mask);
+    _cqes    = at< io_uring_cqe >(_cq_ring, params.cq_off.cqes);
+
+    return true;
+}
+
+ssize_t IoUring::recvmsg(int fd, msghdr* msg, int flags)
+{
+    io_uring_sqe sqe{};
+    sqe.opcode    = IORING_OP_RECVMSG;
+    sqe.fd        = fd;
+    sqe.addr      = reinterpret_cast< uint64_t >(msg);
+    sqe.len       = 1;
+    sqe.msg_flags = static_cast< uint32_t >(flags);
+
+    return submit_and_wait(sqe);
+}
+
+ssize_t IoUring::sendmsg(int fd, const msghdr* msg, int flags)
+{
+    io_uring_sqe sqe{};
+    sqe.opcode    = IORING_OP_SENDMSG;
+    sqe.fd        = fd;
+    sqe.addr      = reinterpret_cast< uint64_t >(msg);
+    sqe.len       = 1;
+    sqe.msg_flags = static_cast< uint32_t >(flags);
+
+    return submit_and_wait(sqe);
+}
+
+bool IoUring::register_buffer(void* buffer, size_t size)
+{
+    iovec iov{buffer, size};
+
+    return io_uring_register(_ring_fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+}
+
+ssize_t IoUring::read_fixed(int fd, void* buffer, size_t length)
+{
+    io_uring_sqe sqe{};
+    sqe.opcode    = IORING_OP_READ_FIXED;
+    sqe.fd        = fd;
+    sqe.addr      = reinterpret_cast< uint64_t >(buffer);
+    sqe.len       = static_cast< uint32_t >(length);
+    sqe.buf_index = 0;
+
+    return submit_and_wait(sqe);
+}
+
+ssize_t IoUring::submit_and_wait(const io_uring_sqe& sqe)
+{
+    // We are the only producer, so the tail needs no synchronization to
+    // read; the kernel must see the entry before it sees the new tail.
+    unsigned tail  = *_sq_tail;
+    unsigned index = tail & *_sq_mask;
+
+    _sqes[index]     = sqe;
+    _sq_array[index] = index;
+    __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    unsigned to_submit = 1;
+
+    while (true) {
+        int ret = io_uring_enter(_ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS);
+        ++_enters;
+
+        // Without SQPOLL, entries are consumed during the call,
+        // even if the wait for the completion is interrupted.
+        if (__atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) == tail + 1) {
+            to_submit = 0;
+        }
+
+        unsigned head = *_cq_head;
+
+        if (head != __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE)) {
+            ssize_t result = _cqes[head & *_cq_mask].res;
+            __atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+            return result;
+        }
+
+        if (ret < 0 && errno != EINTR) {
+            _failed = true;
+            return -errno;
+        }
+    }
+}
+
+bool IoUring::failed() const { return _failed; }
+
+uint64_t IoUring::enters() const { return _enters; }
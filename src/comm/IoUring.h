@@ -0,0 +1,86 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "util/Macros.h"
+
+namespace comm
+{
+
+// Minimal io_uring instance driven through the raw system calls.
+//
+// Every operation is queued and reaped with a single io_uring_enter(),
+// which submits the request and waits for its completion in one trip to
+// the kernel. A buffer can be registered once, so that reads into it do not
+// have the kernel map it on every call. A ring is meant to be used by one
+// thread at a time.
+class IoUring
+{
+   public:
+    // Returns nullptr if the kernel does not provide io_uring,
+    // or if it is not allowed (e.g. by a seccomp profile).
+    static std::unique_ptr< IoUring > create(unsigned entries = 4);
+
+    ~IoUring();
+
+    NOT_COPYABLE(IoUring);
+    NOT_MOVEABLE(IoUring);
+
+    // Same as the system calls, except that errors are returned as -errno.
+    // -EINVAL means the kernel does not know the operation.
+    ssize_t recvmsg(int fd, msghdr* msg, int flags);
+    ssize_t sendmsg(int fd, const msghdr* msg, int flags);
+
+    // Registers the buffer read_fixed() reads into. Returns false if the
+    // kernel refuses, e.g. as it would go over RLIMIT_MEMLOCK.
+    bool register_buffer(void* buffer, size_t size);
+
+    // read(2) into (part of) the registered buffer.
+    ssize_t read_fixed(int fd, void* buffer, size_t length);
+
+    // Number of io_uring_enter() calls so far.
+    uint64_t enters() const;
+
+    // Whether io_uring_enter() itself failed. The ring must not be used
+    // anymore, as a request may have been left in the submission queue.
+    bool failed() const;
+
+   private:
+    explicit IoUring(int ring_fd);
+
+    bool map(const io_uring_params& params);
+    ssize_t submit_and_wait(const io_uring_sqe& sqe);
+
+    int _ring_fd;
+    bool _failed{false};
+    uint64_t _enters{0};
+
+    void* _sq_ring{nullptr};
+    size_t _sq_ring_size{0};
+    void* _cq_ring{nullptr};
+    size_t _cq_ring_size{0};
+    io_uring_sqe* _sqes{nullptr};
+    size_t _sqes_size{0};
+
+    unsigned* _sq_head{nullptr};
+    unsigned* _sq_tail{nullptr};
+    unsigned* _sq_mask{nullptr};
+    unsigned* _sq_array{nullptr};
+
+    unsigned* _cq_head{nullptr};
+    unsigned* _cq_tail{nullptr};
+    unsigned* _cq_mask{nullptr};
+    io_uring_cqe* _cqes{nullptr};
+};
+
+};  // namespace comm
@@ -0,0 +1,184 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#include "comm/ResolverCache.h"
+
+#include <cstring>
+#include <memory>
+
+#include <netdb.h>
+
+#include "comm/Exception.h"
+#include "comm/Variables.h"
+
+using namespace comm;
+
+namespace
+{
+
+// Function-local statics are not thread-safe with -fno-threadsafe-statics,
+// so make sure the cache is constructed at load time.
+[[maybe_unused]] ResolverCache* cache_instance = &ResolverCache::instance();
+
+struct AddrinfoDeleter {
+    void operator()(addrinfo* info) const { ::freeaddrinfo(info); }
+};
+
+std::string cache_key(const std::string& host, int port)
+{
+    return host + ":" + std::to_string(port);
+}
+
+}  // namespace
+
+ResolverCache::ResolverCache() : _mutex(), _entries(), _ttl(DEFAULT_RESOLVER_CACHE_TTL_SECS) {}
+
+ResolverCache& ResolverCache::instance()
+{
+    static ResolverCache cache{};
+
+    return cache;
+}
+
+ResolverCache::Addresses ResolverCache::lookup(const std::string& host, int port)
+{
+    addrinfo hints{};
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = AI_ADDRCONFIG | AI_NUMERICSERV;
+
+    addrinfo* list = nullptr;
+    int error = ::getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &list);
+
+    if (error != 0) {
+        THROW_EXCEPTION(ServerAddError, ::gai_strerror(error));
+    }
+
+    std::unique_ptr< addrinfo, AddrinfoDeleter > resolved(list);
+
+    Addresses addresses;
+
+    for (auto info = list; info; info = info->ai_next) {
+        ResolvedAddress address;
+        address.family = info->ai_family;
+        address.length = info->ai_addrlen;
+        memcpy(&address.address, info->ai_addr, info->ai_addrlen);
+
+        addresses.push_back(address);
+    }
+
+    return addresses;
+}
+
+ResolverCache::Addresses ResolverCache::resolve(const std::string& host, int port)
+{
+    auto key = cache_key(host, port);
+    auto now = Clock::now();
+
+    std::promise< Addresses > promise;
+    std::shared_future< Addresses > cached;
+
+    {
+        std::lock_guard< std::mutex > lock(_mutex);
+
+        auto entry = _ttl == 0 ? _entries.end() : _entries.find(key);
+
+        if (entry != _entries.end() && now < entry->second.expires) {
+            ++_hits;
+            cached = entry->second.addresses;
+        } else {
+            ++_misses;
+
+            if (_ttl != 0) {
+                if (entry == _entries.end()) {
+                    evict(now);
+                }
+
+                _entries[key] = {promise.get_future().share(),
+                                 now + std::chrono::seconds(_ttl)};
+            }
+        }
+    }
+
+    // Waits for the lookup, if another thread is still at it.
+    if (cached.valid()) {
+        return cached.get();
+    }
+
+    try {
+        auto addresses = lookup(host, port);
+        promise.set_value(addresses);
+
+        return addresses;
+    } catch (...) {
+        promise.set_exception(std::current_exception());
+        invalidate(host, port);
+        throw;
+    }
+}
+
+void ResolverCache::invalidate(const std::string& host, int port)
+{
+    std::lock_guard< std::mutex > lock(_mutex);
+
+    _entries.erase(cache_key(host, port));
+}
+
+void ResolverCache::evict(Clock::time_point now)
+{
+    if (_entries.size() < MAX_ENTRIES) {
+        return;
+    }
+
+    for (auto entry = _entries.begin(); entry != _entries.end();) {
+        entry = now < entry->second.expires ? std::next(entry) : _entries.erase(entry);
+    }
+
+    if (_entries.size() >= MAX_ENTRIES) {
+        _entries.erase(_entries.begin());
+    }
+}
+
+void ResolverCache::set_ttl(unsigned seconds)
+{
+    std::lock_guard< std::mutex > lock(_mutex);
+
+    _ttl = seconds;
+    _entries.clear();
+}
+
+unsigned ResolverCache::ttl() const
+{
+    std::lock_guard< std::mutex > lock(_mutex);
+
+    return _ttl;
+}
+
+std::size_t ResolverCache::size() const
+{
+    std::lock_guard< std::mutex > lock(_mutex);
+
+    return _entries.size();
+}
+
+void ResolverCache::clear()
+{
+    std::lock_guard< std::mutex > lock(_mutex);
+
+    _entries.clear();
+}
+
+uint64_t ResolverCache::hits() const
+{
+    std::lock_guard< std::mutex > lock(_mutex);
+
+    return _hits;
+}
+
+uint64_t ResolverCache::misses() const
+{
+    std::lock_guard< std::mutex > lock(_mutex);
+
+    return _misses;
+}
@@ -0,0 +1,441 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#include "comm/ShmConnection.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <string>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "comm/Exception.h"
+
+using namespace comm;
+
+// Sits at the start of each ring, in the shared memory, so its atomics
+// have to work across processes.
+struct ShmConnection::RingHeader {
+    // Bytes read from, and written to, the ring since the connection
+    // started; it is empty when they are equal. Each is only advanced by
+    // its own side.
+    alignas(64) std::atomic< uint64_t > head{0};
+    alignas(64) std::atomic< uint64_t > tail{0};
+    // Set by a side about to sleep, so that the other one signals it.
+    alignas(64) std::atomic< bool > reader_waiting{false};
+    std::atomic< bool > writer_waiting{false};
+};
+
+namespace
+{
+
+static_assert(std::atomic< uint64_t >::is_always_lock_free,
+              "Shared memory rings need lock-free atomics");
+
+// Rings are laid out back to back, each header followed by its data.
+const size_t RING_ALIGNMENT = 64;
+
+void close_fds(const int (&fds)[5])
+{
+    for (auto fd : fds) {
+        if (fd != -1) {
+            ::close(fd);
+        }
+    }
+}
+
+void signal(int event_fd)
+{
+    uint64_t one = 1;
+    [[maybe_unused]] auto ret = ::write(event_fd, &one, sizeof(one));
+}
+
+// The client can neither resize the memory under the server, which would
+// fault on the pages cut off, nor lift the seals later.
+const int SEALS = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+
+bool is_eventfd(int fd)
+{
+    char link[64];
+    auto path   = "/proc/self/fd/" + std::to_string(fd);
+    auto length = ::readlink(path.c_str(), link, sizeof(link));
+
+    return length > 0 && std::string(link, static_cast< size_t >(length)) == "anon_inode:[eventfd]";
+}
+
+// Whether the client sent a sealed memfd followed by eventfds, as create()
+// does, rather than files the server should not map or wait on.
+bool is_valid(const int (&fds)[5])
+{
+    auto seals = ::fcntl(fds[0], F_GET_SEALS);
+
+    if (seals == -1 || (seals & SEALS) != SEALS) {
+        return false;
+    }
+
+    return std::all_of(std::begin(fds) + 1, std::end(fds), is_eventfd);
+}
+
+}  // namespace
+
+ShmConnection::ShmConnection(std::unique_ptr< TCPSocket > socket,
+                             const int (&fds)[5],
+                             ConnMetrics* metrics)
+    : Connection(metrics), _socket(std::move(socket))
+{
+    std::copy(std::begin(fds), std::end(fds), std::begin(_fds));
+}
+
+ShmConnection::~ShmConnection()
+{
+    if (_memory) {
+        ::munmap(_memory, _memory_size);
+    }
+
+    close_fds(_fds);
+}
+
+std::unique_ptr< ShmConnection > ShmConnection::create(std::unique_ptr< TCPSocket > socket,
+                                                       size_t ring_size,
+                                                       ConnMetrics* metrics)
+{
+    ring_size = (ring_size + RING_ALIGNMENT - 1) / RING_ALIGNMENT * RING_ALIGNMENT;
+
+    int fds[5] = {-1, -1, -1, -1, -1};
+
+    fds[0] = ::memfd_create("aperturedb-comm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fds[0] == -1) {
+        THROW_EXCEPTION(SocketFail, errno, "memfd_create()", 0);
+    }
+
+    for (size_t i = 1; i < 5; ++i) {
+        fds[i] = ::eventfd(0, EFD_CLOEXEC);
+        if (fds[i] == -1) {
+            auto errno_r = errno;
+            close_fds(fds);
+            THROW_EXCEPTION(SocketFail, errno_r, "eventfd()", 0);
+        }
+    }
+
+    auto size = 2 * (sizeof(RingHeader) + ring_size);
+    if (::ftruncate(fds[0], static_cast< off_t >(size)) != 0) {
+        auto errno_r = errno;
+        close_fds(fds);
+        THROW_EXCEPTION(SocketFail, errno_r, "ftruncate()", 0);
+    }
+
+    if (::fcntl(fds[0], F_ADD_SEALS, SEALS) != 0) {
+        auto errno_r = errno;
+        close_fds(fds);
+        THROW_EXCEPTION(SocketFail, errno_r, "fcntl(F_ADD_SEALS)", 0);
+    }
+
+    auto connection =
+        std::unique_ptr< ShmConnection >(new ShmConnection(std::move(socket), fds, metrics));
+
+    connection->map(true);
+
+    if (!connection->_socket->send_fds(fds, 5)) {
+        THROW_EXCEPTION(SocketFail, errno, "sendmsg()", 0);
+    }
+
+    return connection;
+}
+
+std::unique_ptr< ShmConnection > ShmConnection::accept(std::unique_ptr< TCPSocket > socket,
+                                                       ConnMetrics* metrics)
+{
+    int fds[5] = {-1, -1, -1, -1, -1};
+
+    if (!socket->recv_fds(fds, 5)) {
+        THROW_EXCEPTION(ProtocolError, "Shared memory not received");
+    }
+
+    if (!is_valid(fds)) {
+        close_fds(fds);
+        THROW_EXCEPTION(ProtocolError, "Shared memory not sealed, or not with eventfds");
+    }
+
+    auto connection =
+        std::unique_ptr< ShmConnection >(new ShmConnection(std::move(socket), fds, metrics));
+
+    connection->map(false);
+
+    return connection;
+}
+
+void ShmConnection::map(bool client)
+{
+    struct stat status;
+    if (::fstat(_fds[0], &status) != 0) {
+        THROW_EXCEPTION(SocketFail, errno, "fstat()", 0);
+    }
+
+    // The client sized the memory; make sure the server can trust it.
+    auto size       = static_cast< size_t >(status.st_size);
+    auto ring_bytes = size / 2;
+
+    if (size % 2 != 0 || ring_bytes <= sizeof(RingHeader) ||
+        ring_bytes % RING_ALIGNMENT != 0) {
+        THROW_EXCEPTION(ProtocolError, "Invalid shared memory size");
+    }
+
+    auto memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fds[0], 0);
+    if (memory == MAP_FAILED) {
+        THROW_EXCEPTION(SocketFail, errno, "mmap()", 0);
+    }
+
+    _memory      = static_cast< uint8_t* >(memory);
+    _memory_size = size;
+
+    Ring rings[2];
+
+    for (size_t i = 0; i < 2; ++i) {
+        auto start = _memory + i * ring_bytes;
+
+        // The client sets the headers up; the server finds them in place.
+        rings[i].header   = client ? new (start) RingHeader{}
+                                   : reinterpret_cast< RingHeader* >(start);
+        rings[i].data     = start + sizeof(RingHeader);
+        rings[i].capacity = ring_bytes - sizeof(RingHeader);
+        rings[i].data_fd  = _fds[1 + 2 * i];
+        rings[i].space_fd = _fds[2 + 2 * i];
+    }
+
+    _out = rings[client ? 0 : 1];
+    _in  = rings[client ? 1 : 0];
+}
+
+size_t ShmConnection::read(uint8_t* buffer, size_t length)
+{
+    size_t count;
+
+    while ((count = read_some(buffer, length)) == 0) {
+        wait_for_data();
+    }
+
+    return count;
+}
+
+size_t ShmConnection::write(const uint8_t* buffer, size_t length)
+{
+    iovec iov{const_cast< uint8_t* >(buffer), length};
+
+    return writev(&iov, 1);
+}
+
+size_t ShmConnection::writev(const iovec* iov, int iovcnt)
+{
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        total += iov[i].iov_len;
+    }
+
+    if (total == 0) {
+        return 0;
+    }
+
+    size_t count;
+
+    while ((count = gather(iov, iovcnt)) == 0) {
+        wait_for_space();
+    }
+
+    return count;
+}
+
+// Reads the file straight into the ring, sparing the bounce buffer.
+size_t ShmConnection::write_file(int file_fd, off_t offset, size_t count)
+{
+    uint64_t tail;
+    size_t contiguous;
+
+    while (free_space(tail, contiguous) == 0) {
+        wait_for_space();
+    }
+
+    auto length = ::pread(file_fd,
+                          _out.data + tail % _out.capacity,
+                          std::min(count, contiguous),
+                          offset);
+
+    if (length < 0) {
+        THROW_EXCEPTION(ReadFail, errno, "pread()", 0);
+    }
+
+    publish(tail, static_cast< size_t >(length));
+
+    return static_cast< size_t >(length);
+}
+
+size_t ShmConnection::read_some(uint8_t* buffer, size_t length)
+{
+    auto& header = *_in.header;
+
+    auto head  = header.head.load(std::memory_order_relaxed);
+    auto tail  = header.tail.load(std::memory_order_acquire);
+    auto count = std::min< uint64_t >(length, std::min(tail - head, _in.capacity));
+
+    if (count == 0) {
+        return 0;
+    }
+
+    auto offset = head % _in.capacity;
+    auto first  = std::min(count, _in.capacity - offset);
+
+    memcpy(buffer, _in.data + offset, first);
+    memcpy(buffer + first, _in.data, count - first);
+
+    header.head.store(head + count);
+    if (header.writer_waiting.load()) {
+        signal(_in.space_fd);
+    }
+
+    return count;
+}
+
+size_t ShmConnection::write_some(const uint8_t* buffer, size_t length)
+{
+    iovec iov{const_cast< uint8_t* >(buffer), length};
+
+    return gather(&iov, 1);
+}
+
+// Neither read_some() nor write_some() ever blocks.
+void ShmConnection::set_nonblocking(bool /*nonblocking*/) {}
+
+int ShmConnection::native_handle() const { return _socket->native_handle(); }
+
+// The waiting flag is raised before the ring is checked one last time, and
+// the peer checks it after updating the ring, so a wakeup is never missed.
+bool ShmConnection::wait_for_data(int timeout_ms)
+{
+    auto& header = *_in.header;
+    bool ready   = true;
+
+    header.reader_waiting.store(true);
+    if (header.tail.load() == header.head.load(std::memory_order_relaxed)) {
+        ready = wait(_in.data_fd, timeout_ms);
+    }
+    header.reader_waiting.store(false);
+
+    return ready;
+}
+
+bool ShmConnection::wait_for_space(int timeout_ms)
+{
+    uint64_t tail;
+    size_t contiguous;
+    bool ready = true;
+
+    _out.header->writer_waiting.store(true);
+    if (free_space(tail, contiguous) == 0) {
+        ready = wait(_out.space_fd, timeout_ms);
+    }
+    _out.header->writer_waiting.store(false);
+
+    return ready;
+}
+
+bool ShmConnection::wait_ready(short events, int timeout_ms)
+{
+    return events == POLLIN ? wait_for_data(timeout_ms) : wait_for_space(timeout_ms);
+}
+
+bool ShmConnection::wait(int event_fd, int timeout_ms)
+{
+    pollfd fds[2] = {{event_fd, POLLIN, 0}, {_socket->native_handle(), POLLIN, 0}};
+    int result;
+
+    while ((result = ::poll(fds, 2, timeout_ms)) < 0) {
+        if (errno != EINTR) {
+            THROW_EXCEPTION(ReadFail, errno, "poll()", 0);
+        }
+    }
+
+    if (result == 0) {
+        return false;
+    }
+
+    if (fds[0].revents & POLLIN) {
+        uint64_t value;
+        [[maybe_unused]] auto ret = ::read(event_fd, &value, sizeof(value));
+        return true;
+    }
+
+    // Nothing is sent on the socket once the rings are set up, so it only
+    // becomes readable when either end shuts it down.
+    THROW_EXCEPTION(ConnectionShutDown, "Peer Closed Connection.");
+}
+
+size_t ShmConnection::free_space(uint64_t& tail, size_t& contiguous) const
+{
+    tail      = _out.header->tail.load(std::memory_order_relaxed);
+    auto head = _out.header->head.load();
+    auto used = std::min(tail - head, _out.capacity);
+    auto free = _out.capacity - used;
+
+    contiguous = std::min(free, _out.capacity - tail % _out.capacity);
+
+    return free;
+}
+
+size_t ShmConnection::gather(const iovec* iov, int iovcnt)
+{
+    uint64_t tail;
+    size_t contiguous;
+    auto space = free_space(tail, contiguous);
+
+    size_t written = 0;
+
+    for (int i = 0; i < iovcnt && written < space; ++i) {
+        auto data  = static_cast< const uint8_t* >(iov[i].iov_base);
+        auto count = std::min(iov[i].iov_len, space - written);
+
+        auto offset = (tail + written) % _out.capacity;
+        auto first  = std::min(count, _out.capacity - offset);
+
+        memcpy(_out.data + offset, data, first);
+        memcpy(_out.data, data + first, count - first);
+
+        written += count;
+    }
+
+    if (written > 0) {
+        publish(tail, written);
+    }
+
+    return written;
+}
+
+void ShmConnection::publish(uint64_t tail, size_t count)
+{
+    auto& header = *_out.header;
+
+    header.tail.store(tail + count);
+    if (header.reader_waiting.load()) {
+        signal(_out.data_fd);
+    }
+}
+
+std::string ShmConnection::get_source() const { return _socket->print_source(); }
+
+short ShmConnection::get_source_family() const { return _socket->source_family(); }
+
+std::string ShmConnection::get_encryption() const { return "none"; }
+
+bool ShmConnection::is_open() { return _socket->is_open(); }
+
+void ShmConnection::shutdown()
+{
+    if (_socket) {
+        _socket->shutdown();
+    }
+}
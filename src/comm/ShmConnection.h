@@ -0,0 +1,112 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "comm/Connection.h"
+#include "util/Macros.h"
+#include "comm/TCPSocket.h"
+
+namespace comm
+{
+
+// Carries messages between two processes on the same host through shared
+// memory, so that they are copied once, into the ring, and once out of it,
+// rather than through the socket layer of the kernel.
+//
+// There is a ring buffer for each direction, both in a memfd the client
+// creates and passes to the server over the Unix domain socket they
+// connected with. A peer that runs out of data, or of room, sleeps on an
+// eventfd the other one signals. The socket itself carries nothing more;
+// it is kept to notice the peer going away, and to be shut down.
+//
+// The rings are only used through the blocking calls: ConnServer does not
+// negotiate them with clients of an EventLoop.
+class ShmConnection : public Connection
+{
+   public:
+    ~ShmConnection() override;
+
+    NOT_COPYABLE(ShmConnection);
+    NOT_MOVEABLE(ShmConnection);
+
+    // Client side: creates rings of 'ring_size' bytes and hands them to
+    // the server at the other end of 'socket'.
+    static std::unique_ptr< ShmConnection > create(std::unique_ptr< TCPSocket > socket,
+                                                   size_t ring_size,
+                                                   ConnMetrics* metrics = nullptr);
+
+    // Server side: maps the rings the client sent over 'socket'.
+    static std::unique_ptr< ShmConnection > accept(std::unique_ptr< TCPSocket > socket,
+                                                   ConnMetrics* metrics = nullptr);
+
+    std::string get_source() const override;
+    short get_source_family() const override;
+    std::string get_encryption() const override;
+    bool is_open() override;
+    void shutdown() override;
+
+   protected:
+    size_t read(uint8_t* buffer, size_t length) override;
+    size_t write(const uint8_t* buffer, size_t length) override;
+    size_t writev(const iovec* iov, int iovcnt) override;
+    size_t write_file(int file_fd, off_t offset, size_t count) override;
+    size_t read_some(uint8_t* buffer, size_t length) override;
+    size_t write_some(const uint8_t* buffer, size_t length) override;
+    void set_nonblocking(bool nonblocking) override;
+    int native_handle() const override;
+    bool wait_ready(short events, int timeout_ms) override;
+
+   private:
+    struct RingHeader;
+
+    // One direction of the connection, as seen from this end.
+    struct Ring {
+        RingHeader* header{nullptr};
+        uint8_t* data{nullptr};
+        uint64_t capacity{0};
+        // Signalled by the writer when it adds data, and by the reader when
+        // it makes room, if the other one is waiting.
+        int data_fd{-1};
+        int space_fd{-1};
+    };
+
+    // 'fds' holds the memfd, then the data and space eventfds of the ring
+    // from the client to the server, then those of the other ring. They
+    // belong to the connection from then on.
+    ShmConnection(std::unique_ptr< TCPSocket > socket, const int (&fds)[5], ConnMetrics* metrics);
+
+    // Maps the memfd and lays the rings out over it.
+    void map(bool client);
+
+    // Block until the peer adds data, or makes room, for up to
+    // 'timeout_ms' if not -1. They return false if that timed out, throw if
+    // the peer hung up, and may return spuriously.
+    bool wait_for_data(int timeout_ms = -1);
+    bool wait_for_space(int timeout_ms = -1);
+    bool wait(int event_fd, int timeout_ms);
+
+    // Room left in the outgoing ring, and how much of it is contiguous
+    // from 'tail' on.
+    size_t free_space(uint64_t& tail, size_t& contiguous) const;
+
+    // Copies as much of the buffers as fits in the outgoing ring, without
+    // waiting. Returns the number of bytes copied.
+    size_t gather(const iovec* iov, int iovcnt);
+
+    // Makes 'count' bytes written from 'tail' on visible to the reader.
+    void publish(uint64_t tail, size_t count);
+
+    std::unique_ptr< TCPSocket > _socket;
+    uint8_t* _memory{nullptr};
+    size_t _memory_size{0};
+    int _fds[5]{-1, -1, -1, -1, -1};
+    Ring _in{};
+    Ring _out{};
+};
+
+};  // namespace comm
@@ -0,0 +1,73 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#pragma once
+
+#include <csignal>
+#include <ctime>
+
+#include <pthread.h>
+
+#include "util/Macros.h"
+
+namespace comm
+{
+
+// Keeps writes that cannot take MSG_NOSIGNAL, like sendfile() or the ones
+// OpenSSL's own socket BIO issues, from killing the process with SIGPIPE.
+//
+// SIGPIPE is blocked for the calling thread while the guard lives. A SIGPIPE
+// raised in the meantime is discarded; the write still fails with EPIPE.
+class SigpipeGuard
+{
+   public:
+    explicit SigpipeGuard(bool active = true) : _active(active)
+    {
+        if (!_active) {
+            return;
+        }
+
+        sigset_t pending;
+        sigpending(&pending);
+        _was_pending = sigismember(&pending, SIGPIPE);
+
+        sigset_t sigpipe;
+        sigemptyset(&sigpipe);
+        sigaddset(&sigpipe, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &sigpipe, &_old_mask);
+    }
+
+    ~SigpipeGuard()
+    {
+        if (!_active) {
+            return;
+        }
+
+        sigset_t sigpipe;
+        sigemptyset(&sigpipe);
+        sigaddset(&sigpipe, SIGPIPE);
+
+        if (!_was_pending) {
+            sigset_t pending;
+            sigpending(&pending);
+
+            if (sigismember(&pending, SIGPIPE)) {
+                timespec no_wait{0, 0};
+                sigtimedwait(&sigpipe, nullptr, &no_wait);
+            }
+        }
+
+        pthread_sigmask(SIG_SETMASK, &_old_mask, nullptr);
+    }
+
+    NOT_COPYABLE(SigpipeGuard);
+    NOT_MOVEABLE(SigpipeGuard);
+
+   private:
+    bool _active;
+    bool _was_pending{false};
+    sigset_t _old_mask{};
+};
+
+};  // namespace comm
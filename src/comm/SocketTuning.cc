@@ -0,0 +1,59 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#include "comm/SocketTuning.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace comm;
+
+namespace
+{
+
+// Bytes in flight on a path of the given bandwidth and round trip time.
+uint32_t bandwidth_delay_product(uint64_t bandwidth_bps, uint32_t rtt_us)
+{
+    auto bytes = bandwidth_bps / 8 * rtt_us / 1000000;
+
+    return static_cast< uint32_t >(
+        std::min< uint64_t >(bytes, std::numeric_limits< int32_t >::max()));
+}
+
+}  // namespace
+
+SocketTuning SocketTuning::high_throughput(uint64_t bandwidth_bps, uint32_t rtt_us)
+{
+    SocketTuning tuning(bandwidth_bps, rtt_us);
+    tuning.cork = true;
+
+    return tuning;
+}
+
+SocketTuning SocketTuning::low_latency()
+{
+    SocketTuning tuning;
+    tuning.notsent_lowat = 16 * 1024;
+    tuning.busy_poll_us  = 50;
+
+    return tuning;
+}
+
+uint32_t SocketTuning::send_buffer() const
+{
+    if (send_buffer_size != 0) {
+        return send_buffer_size;
+    }
+
+    return bandwidth_delay_product(bandwidth_bps, rtt_us);
+}
+
+uint32_t SocketTuning::receive_buffer() const
+{
+    if (receive_buffer_size != 0) {
+        return receive_buffer_size;
+    }
+
+    return bandwidth_delay_product(bandwidth_bps, rtt_us);
+}
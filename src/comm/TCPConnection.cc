@@ -30,17 +30,44 @@
 
 #include "comm/TCPConnection.h"
 
+#include <algorithm>
 #include <assert.h>
+#include <climits>
 #include <cstdlib>
+#include <cstring>
 #include <netdb.h>
 #include <string>
 #include <unistd.h>
 
 #include "comm/Exception.h"
+#include "comm/Variables.h"
 #include "util/gcc_util.h"
 
 using namespace comm;
 
+namespace
+{
+
+bool complete(std::unique_ptr< IoUring >& ring, ssize_t result, ssize_t& count)
+{
+    // -EINVAL is what kernels without the operation report.
+    if (result == -EINVAL || ring->failed()) {
+        ring.reset();
+        return false;
+    }
+
+    if (result < 0) {
+        errno = static_cast< int >(-result);
+        count = -1;
+    } else {
+        count = result;
+    }
+
+    return true;
+}
+
+}  // namespace
+
 TCPConnection::TCPConnection(std::unique_ptr< TCPSocket > tcp_socket, ConnMetrics* metrics)
     : Connection(metrics), _tcp_socket(std::move(tcp_socket))
 {
@@ -52,8 +79,19 @@ size_t TCPConnection::read(uint8_t* buffer, size_t length)
         THROW_EXCEPTION(SocketFail);
     }
 
-    errno       = 0;
-    auto count  = ::recv(_tcp_socket->_socket_fd, buffer, length, MSG_WAITALL);
+    if (auto count = take_read_ahead(buffer, length)) {
+        return count;
+    }
+
+    errno = 0;
+    ssize_t count;
+    if (length < _read_ahead.size() && ring_read_ahead(count)) {
+        if (count > 0) {
+            count = static_cast< ssize_t >(take_read_ahead(buffer, length));
+        }
+    } else if (!ring_recv(buffer, length, MSG_WAITALL, count)) {
+        count = ::recv(_tcp_socket->_socket_fd, buffer, length, MSG_WAITALL);
+    }
     int errno_r = errno;
 
     if (count < 0) {
@@ -86,7 +124,15 @@ size_t TCPConnection::write(const uint8_t* buffer, size_t length)
     }
 
     // We need MSG_NOSIGNAL so we don't get SIGPIPE, and we can throw.
-    auto count = ::send(_tcp_socket->_socket_fd, buffer, length, MSG_NOSIGNAL);
+    iovec iov{const_cast< uint8_t* >(buffer), length};
+    msghdr msg{};
+    msg.msg_iov    = &iov;
+    msg.msg_iovlen = 1;
+
+    ssize_t count;
+    if (!ring_sendmsg(&msg, MSG_NOSIGNAL, count)) {
+        count = ::send(_tcp_socket->_socket_fd, buffer, length, MSG_NOSIGNAL);
+    }
 
     if (count < 0) {
         THROW_EXCEPTION(WriteFail, "Error sending message.");
@@ -95,6 +141,210 @@ size_t TCPConnection::write(const uint8_t* buffer, size_t length)
     return static_cast< size_t >(count);
 }
 
+size_t TCPConnection::writev(const iovec* iov, int iovcnt)
+{
+    if (!_tcp_socket) {
+        THROW_EXCEPTION(SocketFail);
+    }
+
+    msghdr msg{};
+    msg.msg_iov    = const_cast< iovec* >(iov);
+    msg.msg_iovlen = std::min(iovcnt, IOV_MAX);
+
+    // We need MSG_NOSIGNAL so we don't get SIGPIPE, and we can throw.
+    ssize_t count;
+    if (!ring_sendmsg(&msg, MSG_NOSIGNAL, count)) {
+        count = ::sendmsg(_tcp_socket->_socket_fd, &msg, MSG_NOSIGNAL);
+    }
+
+    if (count < 0) {
+        THROW_EXCEPTION(WriteFail, "Error sending message.");
+    }
+
+    return static_cast< size_t >(count);
+}
+
+size_t TCPConnection::read_some(uint8_t* buffer, size_t length)
+{
+    if (!_tcp_socket) {
+        THROW_EXCEPTION(SocketFail);
+    }
+
+    if (auto count = take_read_ahead(buffer, length)) {
+        return count;
+    }
+
+    errno       = 0;
+    auto count  = ::recv(_tcp_socket->_socket_fd, buffer, length, MSG_DONTWAIT);
+    int errno_r = errno;
+
+    if (count < 0) {
+        DISABLE_WARNING(logical-op)
+        if (errno_r == EAGAIN || errno_r == EWOULDBLOCK || errno_r == EINTR) {
+            return 0;
+        }
+        ENABLE_WARNING(logical-op)
+
+        THROW_EXCEPTION(ReadFail, errno_r, "recv()", 0);
+    } else if (count == 0) {
+        THROW_EXCEPTION(ConnectionShutDown, "Peer Closed Connection.");
+    }
+
+    return static_cast< size_t >(count);
+}
+
+size_t TCPConnection::write_some(const uint8_t* buffer, size_t length)
+{
+    if (!_tcp_socket) {
+        THROW_EXCEPTION(SocketFail);
+    }
+
+    errno       = 0;
+    auto count  = ::send(_tcp_socket->_socket_fd, buffer, length, MSG_NOSIGNAL | MSG_DONTWAIT);
+    int errno_r = errno;
+
+    if (count < 0) {
+        DISABLE_WARNING(logical-op)
+        if (errno_r == EAGAIN || errno_r == EWOULDBLOCK || errno_r == EINTR) {
+            return 0;
+        }
+        ENABLE_WARNING(logical-op)
+
+        THROW_EXCEPTION(WriteFail, errno_r, "send()", 0);
+    }
+
+    return static_cast< size_t >(count);
+}
+
+void TCPConnection::set_nonblocking(bool nonblocking)
+{
+    if (!_tcp_socket || !_tcp_socket->set_nonblocking(nonblocking)) {
+        THROW_EXCEPTION(SocketFail, "Unable to change blocking mode");
+    }
+}
+
+int TCPConnection::native_handle() const { return _tcp_socket ? _tcp_socket->native_handle() : -1; }
+
+size_t TCPConnection::write_file(int file_fd, off_t offset, size_t count)
+{
+    if (!_tcp_socket) {
+        THROW_EXCEPTION(SocketFail);
+    }
+
+    errno       = 0;
+    auto sent   = _tcp_socket->send_file(file_fd, offset, count);
+    int errno_r = errno;
+
+    if (sent < 0) {
+        THROW_EXCEPTION(WriteFail, errno_r, "sendfile()", 0);
+    }
+
+    return static_cast< size_t >(sent);
+}
+
+void TCPConnection::cork(bool corked)
+{
+    if (_tcp_socket) {
+        _tcp_socket->cork(corked);
+    }
+}
+
+bool TCPConnection::enable_io_uring()
+{
+    _read_ring  = IoUring::create();
+    _write_ring = IoUring::create();
+
+    if (!_read_ring || !_write_ring) {
+        _read_ring.reset();
+        _write_ring.reset();
+
+        return false;
+    }
+
+    _read_ahead.resize(IO_URING_READ_AHEAD_SIZE);
+    _read_ahead_registered = _read_ring->register_buffer(_read_ahead.data(), _read_ahead.size());
+
+    return true;
+}
+
+bool TCPConnection::io_uring_enabled() const { return _read_ring && _write_ring; }
+
+uint64_t TCPConnection::io_uring_enters() const
+{
+    return (_read_ring ? _read_ring->enters() : 0) + (_write_ring ? _write_ring->enters() : 0);
+}
+
+bool TCPConnection::ring_recv(uint8_t* buffer, size_t length, int flags, ssize_t& count)
+{
+    if (!_read_ring) {
+        return false;
+    }
+
+    iovec iov{buffer, length};
+    msghdr msg{};
+    msg.msg_iov    = &iov;
+    msg.msg_iovlen = 1;
+
+    auto result = _read_ring->recvmsg(_tcp_socket->_socket_fd, &msg, flags);
+
+    return complete(_read_ring, result, count);
+}
+
+bool TCPConnection::ring_read_ahead(ssize_t& count)
+{
+    if (!_read_ring) {
+        return false;
+    }
+
+    ssize_t result;
+
+    if (_read_ahead_registered) {
+        result = _read_ring->read_fixed(
+            _tcp_socket->_socket_fd, _read_ahead.data(), _read_ahead.size());
+    } else {
+        iovec iov{_read_ahead.data(), _read_ahead.size()};
+        msghdr msg{};
+        msg.msg_iov    = &iov;
+        msg.msg_iovlen = 1;
+
+        result = _read_ring->recvmsg(_tcp_socket->_socket_fd, &msg, 0);
+    }
+
+    if (!complete(_read_ring, result, count)) {
+        return false;
+    }
+
+    if (count > 0) {
+        _read_ahead_begin = 0;
+        _read_ahead_end   = static_cast< size_t >(count);
+    }
+
+    return true;
+}
+
+size_t TCPConnection::take_read_ahead(uint8_t* buffer, size_t length)
+{
+    auto count = std::min(length, _read_ahead_end - _read_ahead_begin);
+
+    if (count > 0) {
+        std::memcpy(buffer, _read_ahead.data() + _read_ahead_begin, count);
+        _read_ahead_begin += count;
+    }
+
+    return count;
+}
+
+bool TCPConnection::ring_sendmsg(const msghdr* msg, int flags, ssize_t& count)
+{
+    if (!_write_ring) {
+        return false;
+    }
+
+    auto result = _write_ring->sendmsg(_tcp_socket->_socket_fd, msg, flags);
+
+    return complete(_write_ring, result, count);
+}
+
 std::string TCPConnection::get_source() const { return _tcp_socket->print_source(); }
 
 short TCPConnection::get_source_family() const { return _tcp_socket->source_family(); }
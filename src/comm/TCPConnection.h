@@ -32,8 +32,10 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "comm/Connection.h"
+#include "comm/IoUring.h"
 #include "util/Macros.h"
 #include "comm/TCPSocket.h"
 
@@ -57,11 +59,50 @@ class TCPConnection : public Connection
     bool is_open() override;
     void shutdown() override;
 
+    // Routes the blocking reads and writes through io_uring. Returns false,
+    // and keeps using plain socket calls, if the kernel does not support it.
+    // Small reads are served from a buffer registered with the ring, which
+    // is refilled with whatever the socket has, so that a frame header and
+    // a small body take a single trip to the kernel.
+    bool enable_io_uring();
+    bool io_uring_enabled() const;
+
+    // Number of io_uring_enter() calls made for the connection.
+    uint64_t io_uring_enters() const;
+
    protected:
     size_t read(uint8_t* buffer, size_t length) override;
     size_t write(const uint8_t* buffer, size_t length) override;
+    size_t writev(const iovec* iov, int iovcnt) override;
+    size_t write_file(int file_fd, off_t offset, size_t count) override;
+    void cork(bool corked) override;
+    size_t read_some(uint8_t* buffer, size_t length) override;
+    size_t write_some(const uint8_t* buffer, size_t length) override;
+    void set_nonblocking(bool nonblocking) override;
+    int native_handle() const override;
 
     std::unique_ptr< TCPSocket > _tcp_socket;
+
+   private:
+    // Each return true if the ring served the request, with the result in
+    // 'count' as a system call would return it. Otherwise the ring is
+    // dropped and the caller must fall back to the system call.
+    bool ring_recv(uint8_t* buffer, size_t length, int flags, ssize_t& count);
+    bool ring_sendmsg(const msghdr* msg, int flags, ssize_t& count);
+    // Same, for refilling the read-ahead buffer, which must be empty.
+    bool ring_read_ahead(ssize_t& count);
+
+    // Copies out what was read ahead, up to 'length' bytes.
+    size_t take_read_ahead(uint8_t* buffer, size_t length);
+
+    // One ring per direction, as reads and writes may run concurrently.
+    std::unique_ptr< IoUring > _read_ring{};
+    std::unique_ptr< IoUring > _write_ring{};
+
+    std::vector< uint8_t > _read_ahead{};
+    size_t _read_ahead_begin{0};
+    size_t _read_ahead_end{0};
+    bool _read_ahead_registered{false};
 };
 
 };  // namespace comm
@@ -4,12 +4,22 @@
 
 #include "comm/TCPSocket.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cstring>
+#include <fstream>
+#include <limits>
+#include <fcntl.h>
 #include <netdb.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <vector>
 #include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
 #include "util/gcc_util.h"
 DISABLE_WARNING(effc++)
@@ -19,11 +29,39 @@ ENABLE_WARNING(suggest-override)
 ENABLE_WARNING(effc++)
 
 #include "comm/Exception.h"
+#include "comm/ResolverCache.h"
+#include "comm/SigpipeGuard.h"
 #include "comm/Variables.h"
 
 using namespace comm;
-TCPSocket::TCPSocket(int socket_fd, sockaddr_in address)
-    : _socket_fd(socket_fd), _source_family(AF_INET), _source(std::move(address))
+
+namespace
+{
+
+// Largest buffer the kernel autotunes TCP sockets to: the last of the
+// three values in net.ipv4.tcp_wmem or net.ipv4.tcp_rmem, or 0 if unknown.
+uint32_t autotune_max(const char* path)
+{
+    std::ifstream file(path);
+    uint64_t low     = 0;
+    uint64_t initial = 0;
+    uint64_t high    = 0;
+
+    if (!(file >> low >> initial >> high)) {
+        return 0;
+    }
+
+    return static_cast< uint32_t >(
+        std::min< uint64_t >(high, std::numeric_limits< uint32_t >::max()));
+}
+
+const uint32_t TCP_WMEM_MAX = autotune_max("/proc/sys/net/ipv4/tcp_wmem");
+const uint32_t TCP_RMEM_MAX = autotune_max("/proc/sys/net/ipv4/tcp_rmem");
+
+}  // namespace
+
+TCPSocket::TCPSocket(int socket_fd, int family, const sockaddr_storage& source)
+    : _socket_fd(socket_fd), _family(family), _source_family(family), _source(source)
 {
 }
 
@@ -39,9 +77,20 @@ static long msec_diff(const struct timespec& a, const struct timespec& b)
     return (a.tv_sec - b.tv_sec) * 1000 + (a.tv_nsec - b.tv_nsec) / 1000000;
 }
 
+std::unique_ptr< TCPSocket > TCPSocket::accepted(const TCPSocket& listening_socket,
+                                                 int socket_fd,
+                                                 const sockaddr_storage& address)
+{
+    auto socket = std::unique_ptr< TCPSocket >(
+        new TCPSocket(socket_fd, listening_socket._family, address));
+    socket->tune(listening_socket._tuning);
+
+    return socket;
+}
+
 std::unique_ptr< TCPSocket > TCPSocket::accept(const std::unique_ptr< TCPSocket >& listening_socket)
 {
-    struct sockaddr_in clnt_addr;
+    struct sockaddr_storage clnt_addr;
     socklen_t len = sizeof(clnt_addr);  // store size of the address
 
     // This is where client connects.
@@ -69,7 +118,32 @@ again:
     }
     // MAGICK can be done here
 
-    return std::unique_ptr< TCPSocket >(new TCPSocket(connected_socket, std::move(clnt_addr)));
+    return accepted(*listening_socket, connected_socket, clnt_addr);
+}
+
+std::unique_ptr< TCPSocket > TCPSocket::try_accept(
+    const std::unique_ptr< TCPSocket >& listening_socket)
+{
+    struct sockaddr_storage clnt_addr;
+    socklen_t len = sizeof(clnt_addr);  // store size of the address
+
+    errno = 0;
+    int connected_socket =
+        ::accept(listening_socket->_socket_fd, reinterpret_cast< sockaddr* >(&clnt_addr), &len);
+
+    int errno_r = errno;
+    if (connected_socket < 0) {
+        DISABLE_WARNING(logical-op)
+        if (errno_r == EAGAIN || errno_r == EWOULDBLOCK || errno_r == EINTR ||
+            errno_r == ECONNABORTED) {
+            return nullptr;
+        }
+        ENABLE_WARNING(logical-op)
+
+        THROW_EXCEPTION(ConnectionError, errno_r, "accept()", 0);
+    }
+
+    return accepted(*listening_socket, connected_socket, clnt_addr);
 }
 
 bool TCPSocket::bind(int port)
@@ -85,50 +159,470 @@ bool TCPSocket::bind(int port)
            0;
 }
 
-bool TCPSocket::connect(const Address& address)
+bool TCPSocket::bind(const std::string& path)
 {
-    struct hostent* server = gethostbyname(address.addr.c_str());
+    struct sockaddr_un svr_addr;
+    memset(&svr_addr, 0, sizeof(svr_addr));
+    svr_addr.sun_family = AF_UNIX;
 
-    if (server == NULL) {
-        THROW_EXCEPTION(ServerAddError);
+    if (path.size() >= sizeof(svr_addr.sun_path)) {
+        return false;
     }
 
-    struct sockaddr_in svr_addr;
-    memset(&svr_addr, 0, sizeof(svr_addr));
-    svr_addr.sin_family = AF_INET;
+    memcpy(svr_addr.sun_path, path.c_str(), path.size());
+
+    // Only a stale socket is ever removed, one nothing listens on anymore;
+    // never a file that happens to be there, nor the socket of a server
+    // still running.
+    struct stat status;
+    if (::lstat(path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) {
+        int probe = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+        if (probe < 0) {
+            return false;
+        }
+
+        bool stale = ::connect(probe,
+                               reinterpret_cast< const sockaddr* >(&svr_addr),
+                               sizeof(svr_addr)) != 0 &&
+                     errno == ECONNREFUSED;
+        ::close(probe);
 
-    memcpy(&svr_addr.sin_addr.s_addr, server->h_addr, server->h_length);
-    svr_addr.sin_port = htons(address.port);
+        if (stale) {
+            ::unlink(path.c_str());
+        }
+    }
 
-    return ::connect(
-               _socket_fd, reinterpret_cast< const sockaddr* >(&svr_addr), sizeof(svr_addr)) == 0;
+    return ::bind(_socket_fd, reinterpret_cast< const sockaddr* >(&svr_addr), sizeof(svr_addr)) ==
+           0;
 }
 
-std::unique_ptr< TCPSocket > TCPSocket::create()
+namespace
 {
-    int tcp_socket = ::socket(AF_INET, SOCK_STREAM, 0);
-    sockaddr_in source;
-    memset(&source, 0, sizeof(_source));
+
+using Clock = std::chrono::steady_clock;
+
+// Addresses in the order they are tried: the family of the first one the
+// resolver returned, then alternating between IPv6 and IPv4.
+std::vector< const ResolvedAddress* > interleave(const ResolverCache::Addresses& addresses)
+{
+    std::vector< const ResolvedAddress* > first, second;
+
+    for (auto& address : addresses) {
+        (address.family == addresses.front().family ? first : second).push_back(&address);
+    }
+
+    std::vector< const ResolvedAddress* > ordered;
+
+    for (size_t i = 0; i < std::max(first.size(), second.size()); ++i) {
+        if (i < first.size()) {
+            ordered.push_back(first[i]);
+        }
+        if (i < second.size()) {
+            ordered.push_back(second[i]);
+        }
+    }
+
+    return ordered;
+}
+
+int milliseconds_until(Clock::time_point when)
+{
+    auto left = std::chrono::duration_cast< std::chrono::milliseconds >(when - Clock::now());
+
+    return static_cast< int >(std::max< int64_t >(left.count(), 0));
+}
+
+}  // namespace
+
+int TCPSocket::start_connect(const ResolvedAddress& address, bool& connected) const
+{
+    connected = false;
+
+    int fd = ::socket(address.family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    for (auto& option : _options) {
+        ::setsockopt(fd,
+                     option.level,
+                     option.name,
+                     option.value.data(),
+                     static_cast< socklen_t >(option.value.size()));
+    }
+
+    if (::connect(fd, reinterpret_cast< const sockaddr* >(&address.address), address.length) ==
+        0) {
+        connected = true;
+    } else if (errno != EINPROGRESS) {
+        auto errno_r = errno;
+        ::close(fd);
+        errno = errno_r;
+        return -1;
+    }
+
+    return fd;
+}
+
+bool TCPSocket::connect(const Address& address, unsigned timeout_ms)
+{
+    // Resolving the name counts against the timeout.
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    if (address.is_unix()) {
+        auto path = address.unix_path();
+
+        struct sockaddr_un svr_addr;
+        memset(&svr_addr, 0, sizeof(svr_addr));
+        svr_addr.sun_family = AF_UNIX;
+
+        if (path.size() >= sizeof(svr_addr.sun_path)) {
+            THROW_EXCEPTION(ServerAddError, "Unix socket path too long");
+        }
+
+        memcpy(svr_addr.sun_path, path.c_str(), path.size());
+
+        // A Unix domain socket connects at once, unless the server's
+        // backlog is full; then it waits for room, up to the send timeout.
+        timeval saved_timeout{};
+        socklen_t timeout_len = sizeof(saved_timeout);
+
+        if (timeout_ms != 0) {
+            timeval timeout{static_cast< time_t >(timeout_ms / 1000),
+                            static_cast< suseconds_t >(timeout_ms % 1000 * 1000)};
+
+            if (::getsockopt(_socket_fd, SOL_SOCKET, SO_SNDTIMEO, &saved_timeout, &timeout_len)) {
+                return false;
+            }
+
+            if (::setsockopt(_socket_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout))) {
+                return false;
+            }
+        }
+
+        bool connected = ::connect(_socket_fd,
+                                   reinterpret_cast< const sockaddr* >(&svr_addr),
+                                   sizeof(svr_addr)) == 0;
+        auto errno_r   = errno;
+
+        if (timeout_ms != 0) {
+            ::setsockopt(_socket_fd, SOL_SOCKET, SO_SNDTIMEO, &saved_timeout, timeout_len);
+        }
+
+        errno = errno_r == EAGAIN ? ETIMEDOUT : errno_r;
+        return connected;
+    }
+
+    auto resolved   = ResolverCache::instance().resolve(address.addr, address.port);
+    auto candidates = interleave(resolved);
+
+    // Attempts in flight, and the address each one is for.
+    std::vector< pollfd > attempts;
+    std::vector< const ResolvedAddress* > attempt_addresses;
+
+    size_t next                   = 0;
+    auto next_attempt             = Clock::now();
+    int connected_fd              = -1;
+    const ResolvedAddress* winner = nullptr;
+    int errno_r                   = ECONNREFUSED;
+
+    while (connected_fd == -1) {
+        // Start the next attempt once the previous one had its head start,
+        // or right away if none is left in flight.
+        while (next < candidates.size() && (attempts.empty() || Clock::now() >= next_attempt)) {
+            bool connected;
+            int fd = start_connect(*candidates[next], connected);
+
+            if (fd == -1) {
+                errno_r = errno;
+                ++next;
+                continue;
+            }
+
+            if (connected) {
+                connected_fd = fd;
+                winner       = candidates[next];
+                break;
+            }
+
+            attempts.push_back({fd, POLLOUT, 0});
+            attempt_addresses.push_back(candidates[next]);
+            next_attempt = Clock::now() + std::chrono::milliseconds(CONNECTION_ATTEMPT_DELAY_MS);
+            ++next;
+        }
+
+        if (connected_fd != -1 || attempts.empty()) {
+            break;
+        }
+
+        if (timeout_ms != 0 && Clock::now() >= deadline) {
+            errno_r = ETIMEDOUT;
+            break;
+        }
+
+        int wait = -1;
+        if (next < candidates.size()) {
+            wait = milliseconds_until(next_attempt);
+        }
+        if (timeout_ms != 0) {
+            auto left = milliseconds_until(deadline);
+            wait      = wait == -1 ? left : std::min(wait, left);
+        }
+
+        if (::poll(attempts.data(), attempts.size(), wait) < 0 && errno != EINTR) {
+            errno_r = errno;
+            break;
+        }
+
+        for (size_t i = 0; i < attempts.size();) {
+            if (attempts[i].revents == 0) {
+                ++i;
+                continue;
+            }
+
+            int socket_error    = 0;
+            socklen_t error_len = sizeof(socket_error);
+            ::getsockopt(attempts[i].fd, SOL_SOCKET, SO_ERROR, &socket_error, &error_len);
+
+            if (socket_error == 0) {
+                connected_fd = attempts[i].fd;
+                winner       = attempt_addresses[i];
+                attempts.erase(attempts.begin() + static_cast< long >(i));
+                break;
+            }
+
+            // A failed attempt hands over to the next address at once.
+            errno_r = socket_error;
+            ::close(attempts[i].fd);
+            attempts.erase(attempts.begin() + static_cast< long >(i));
+            attempt_addresses.erase(attempt_addresses.begin() + static_cast< long >(i));
+            next_attempt = Clock::now();
+        }
+    }
+
+    for (auto& attempt : attempts) {
+        ::close(attempt.fd);
+    }
+
+    if (connected_fd == -1) {
+        // The name may point somewhere else by now.
+        ResolverCache::instance().invalidate(address.addr, address.port);
+
+        errno = errno_r;
+        return false;
+    }
+
+    ::close(_socket_fd);
+    _socket_fd     = connected_fd;
+    _family        = winner->family;
+    _source_family = static_cast< short >(winner->family);
+    _source        = winner->address;
+
+    // Blocking, like the socket it replaces.
+    return set_nonblocking(false);
+}
+
+std::unique_ptr< TCPSocket > TCPSocket::create(int family)
+{
+    int tcp_socket = ::socket(family, SOCK_STREAM, 0);
 
     if (tcp_socket < 0) {
         THROW_EXCEPTION(SocketFail);
     }
 
-    return std::unique_ptr< TCPSocket >(new TCPSocket(tcp_socket, std::move(source)));
+    return std::unique_ptr< TCPSocket >(new TCPSocket(tcp_socket, family, sockaddr_storage{}));
 }
 
 bool TCPSocket::listen() { return ::listen(_socket_fd, MAX_CONN_QUEUE) == 0; }
 
+bool TCPSocket::set_option(int level, int option_name, const void* value, socklen_t size)
+{
+    if (::setsockopt(_socket_fd, level, option_name, value, size) != 0) {
+        return false;
+    }
+
+    auto option = std::find_if(_options.begin(), _options.end(), [&](const Option& o) {
+        return o.level == level && o.name == option_name;
+    });
+
+    if (option == _options.end()) {
+        option = _options.insert(_options.end(), Option{level, option_name, {}});
+    }
+
+    option->value.assign(static_cast< const uint8_t* >(value), size);
+
+    return true;
+}
+
 bool TCPSocket::set_boolean_option(int level, int option_name, bool value)
 {
     int option = value ? 1 : 0;
 
-    return ::setsockopt(_socket_fd, level, option_name, &option, sizeof(option)) == 0;
+    return set_option(level, option_name, &option, sizeof(option));
 }
 
 bool TCPSocket::set_timeval_option(int level, int option_name, timeval value)
 {
-    return ::setsockopt(_socket_fd, level, option_name, &value, sizeof(value)) == 0;
+    return set_option(level, option_name, &value, sizeof(value));
+}
+
+bool TCPSocket::set_int_option(int level, int option_name, int value)
+{
+    return set_option(level, option_name, &value, sizeof(value));
+}
+
+void TCPSocket::tune(const SocketTuning& tuning)
+{
+    _tuning = tuning;
+
+    // Setting a buffer size turns autotuning off for the socket, so a size
+    // derived from the bandwidth-delay product is left to autotuning when
+    // it would get there anyway. The kernel doubles the size it is given,
+    // to account for its own bookkeeping, and autotuning goes up to the
+    // doubled figure. Explicit sizes are always set.
+    auto set_buffer = [this](int option_name,
+                             const char* call,
+                             uint32_t size,
+                             bool explicit_size,
+                             uint32_t autotune_max) {
+        if (size == 0) {
+            return;
+        }
+
+        if (!explicit_size && _family != AF_UNIX && 2 * uint64_t{size} <= autotune_max) {
+            VLOG(1) << call << " skipped: autotuning goes up to " << autotune_max << " bytes";
+            return;
+        }
+
+        if (!set_int_option(SOL_SOCKET, option_name, static_cast< int >(size))) {
+            THROW_EXCEPTION(SocketFail, errno, call, 0);
+        }
+
+        // Capped by net.core.wmem_max or net.core.rmem_max.
+        int effective    = 0;
+        socklen_t length = sizeof(effective);
+
+        if (::getsockopt(_socket_fd, SOL_SOCKET, option_name, &effective, &length) == 0 &&
+            static_cast< uint64_t >(effective) < 2 * uint64_t{size}) {
+            VLOG(1) << call << ": " << size << " bytes asked, " << effective / 2 << " granted";
+        }
+    };
+
+    set_buffer(SO_SNDBUF,
+               "setsockopt(SO_SNDBUF)",
+               tuning.send_buffer(),
+               tuning.send_buffer_size != 0,
+               TCP_WMEM_MAX);
+    set_buffer(SO_RCVBUF,
+               "setsockopt(SO_RCVBUF)",
+               tuning.receive_buffer(),
+               tuning.receive_buffer_size != 0,
+               TCP_RMEM_MAX);
+
+    // The rest only applies to TCP.
+    if (_family == AF_UNIX) {
+        return;
+    }
+
+    if (tuning.notsent_lowat != 0) {
+        if (!set_int_option(
+                IPPROTO_TCP, TCP_NOTSENT_LOWAT, static_cast< int >(tuning.notsent_lowat))) {
+            THROW_EXCEPTION(SocketFail, errno, "setsockopt(TCP_NOTSENT_LOWAT)", 0);
+        }
+    }
+
+    // Raising the busy poll time may be reserved to privileged processes.
+    if (tuning.busy_poll_us != 0) {
+        if (!set_int_option(SOL_SOCKET, SO_BUSY_POLL, static_cast< int >(tuning.busy_poll_us))) {
+            VLOG(1) << "setsockopt(SO_BUSY_POLL): " << std::strerror(errno);
+        }
+    }
+}
+
+void TCPSocket::cork(bool corked)
+{
+    if (_tuning.cork && _family != AF_UNIX) {
+        set_boolean_option(IPPROTO_TCP, TCP_CORK, corked);
+    }
+}
+
+bool TCPSocket::set_nonblocking(bool nonblocking)
+{
+    int flags = ::fcntl(_socket_fd, F_GETFL, 0);
+
+    if (flags < 0) {
+        return false;
+    }
+
+    flags = nonblocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+
+    return ::fcntl(_socket_fd, F_SETFL, flags) == 0;
+}
+
+ssize_t TCPSocket::send_file(int file_fd, off_t offset, size_t count)
+{
+    SigpipeGuard guard;
+
+    return ::sendfile(_socket_fd, file_fd, &offset, count);
+}
+
+bool TCPSocket::send_fds(const int* fds, size_t count)
+{
+    uint8_t byte = 0;
+    iovec iov{&byte, sizeof(byte)};
+
+    std::vector< uint8_t > control(CMSG_SPACE(count * sizeof(int)));
+
+    msghdr msg{};
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control.data();
+    msg.msg_controllen = control.size();
+
+    auto cmsg        = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(count * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, count * sizeof(int));
+
+    return ::sendmsg(_socket_fd, &msg, MSG_NOSIGNAL) == 1;
+}
+
+bool TCPSocket::recv_fds(int* fds, size_t count)
+{
+    uint8_t byte;
+    iovec iov{&byte, sizeof(byte)};
+
+    std::vector< uint8_t > control(CMSG_SPACE(count * sizeof(int)));
+
+    msghdr msg{};
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control.data();
+    msg.msg_controllen = control.size();
+
+    if (::recvmsg(_socket_fd, &msg, MSG_CMSG_CLOEXEC) != 1) {
+        return false;
+    }
+
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+        return false;
+    }
+
+    size_t received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(fds, CMSG_DATA(cmsg), std::min(received, count) * sizeof(int));
+
+    // Don't leak what we did not ask for.
+    if (received != count || (msg.msg_flags & MSG_CTRUNC)) {
+        for (size_t i = 0; i < std::min(received, count); ++i) {
+            ::close(fds[i]);
+        }
+        return false;
+    }
+
+    return true;
 }
 
 void TCPSocket::shutdown() { ::shutdown(_socket_fd, SHUT_RDWR); }
@@ -137,15 +631,39 @@ std::string TCPSocket::print_source()
 {
     if (_source_family == AF_UNSPEC) {
         return "";
+    } else if (_source_family == AF_UNIX) {
+        return "unix";
+    }
+
+    char host[INET6_ADDRSTRLEN] = {};
+
+    if (_source.ss_family == AF_INET6) {
+        auto& source = reinterpret_cast< const sockaddr_in6& >(_source);
+        ::inet_ntop(AF_INET6, &source.sin6_addr, host, sizeof(host));
     } else {
-        return std::string(inet_ntoa(_source.sin_addr));
+        auto& source = reinterpret_cast< const sockaddr_in& >(_source);
+        ::inet_ntop(AF_INET, &source.sin_addr, host, sizeof(host));
     }
+
+    return host;
 }
 
 short TCPSocket::source_family() { return _source_family; }
 
+int TCPSocket::family() const { return _family; }
+
+int TCPSocket::native_handle() const { return _socket_fd; }
+
 bool TCPSocket::is_open()
 {
+    // Unix domain sockets have no TCP_INFO; a closed one reads as EOF.
+    if (_family == AF_UNIX) {
+        uint8_t byte;
+        auto count = ::recv(_socket_fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+
+        return count > 0 || (count < 0 && errno == EAGAIN);
+    }
+
     tcp_info socket_info;
     socklen_t socket_info_length = sizeof(socket_info);
     if (getsockopt(_socket_fd, SOL_TCP, TCP_INFO, &socket_info, &socket_info_length) == -1) {
@@ -32,13 +32,20 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 #include <netinet/ip.h>
+#include <sys/socket.h>
 
 #include "comm/Address.h"
+#include "comm/SocketTuning.h"
 
 namespace comm
 {
 
+struct ResolvedAddress;
+
+// A stream socket: TCP/IP, or a Unix domain socket for peers on the same
+// host, which skips the TCP stack altogether.
 class TCPSocket
 {
     friend class TCPConnection;
@@ -50,27 +57,93 @@ class TCPSocket
 
     TCPSocket& operator=(const TCPSocket&) = delete;
 
-    static std::unique_ptr< TCPSocket > create();
+    // 'family' is AF_INET or AF_UNIX.
+    static std::unique_ptr< TCPSocket > create(int family = AF_INET);
     static std::unique_ptr< TCPSocket > accept(
         const std::unique_ptr< TCPSocket >& listening_socket);
 
+    // Like accept(), but returns nullptr right away when the (non-blocking)
+    // listening socket has no pending connection.
+    static std::unique_ptr< TCPSocket > try_accept(
+        const std::unique_ptr< TCPSocket >& listening_socket);
+
     bool bind(int port);
-    bool connect(const Address& address);
+
+    // Binds a Unix domain socket to 'path', replacing a socket a previous
+    // server left there, but not one a server still listens on. The socket
+    // file gets the permissions the process umask leaves.
+    bool bind(const std::string& path);
+
+    // Resolves the address, through the ResolverCache, and connects to the first of its addresses
+    // that answers. Attempts are staggered, alternating between IPv6 and
+    // IPv4, as in RFC 8305 ("Happy Eyeballs"): an address that does not
+    // answer only holds up the next one for a moment. Gives up after
+    // 'timeout_ms', resolution included, unless 0, with errno set to
+    // ETIMEDOUT; a Unix domain socket only waits on a full backlog. The
+    // socket takes the family of the address it connected to, and keeps
+    // the options set on it so far; print_source() shows that address.
+    bool connect(const Address& address, unsigned timeout_ms = 0);
     bool listen();
     bool set_boolean_option(int level, int option_name, bool value);
     bool set_timeval_option(int level, int option_name, timeval value);
+    bool set_int_option(int level, int option_name, int value);
+    bool set_nonblocking(bool nonblocking);
     bool is_open();
+
+    // Applies the options of 'tuning'. Buffer sizes only take full effect
+    // if set before connect() or listen(). Sockets returned by accept()
+    // inherit the tuning of the listening socket.
+    void tune(const SocketTuning& tuning);
+
+    // Holds back partial segments until uncorked, if the tuning asks for it.
+    void cork(bool corked);
+
+    // sendfile(2) from 'file_fd' to this socket, without raising SIGPIPE.
+    // Returns the number of bytes sent, or -1 with errno set.
+    ssize_t send_file(int file_fd, off_t offset, size_t count);
+
+    // Hand open file descriptors to the peer of a Unix domain socket, along
+    // with a single byte of data. recv_fds() expects exactly 'count' of them.
+    bool send_fds(const int* fds, size_t count);
+    bool recv_fds(int* fds, size_t count);
     void shutdown();
 
     std::string print_source();
     short source_family();
+    int native_handle() const;
+
+    // AF_INET, AF_INET6 or AF_UNIX.
+    int family() const;
 
    private:
-    explicit TCPSocket(int socket_fd, sockaddr_in);
+    struct Option {
+        int level;
+        int name;
+        std::basic_string< uint8_t > value;
+    };
+
+    explicit TCPSocket(int socket_fd, int family, const sockaddr_storage& source);
+
+    bool set_option(int level, int option_name, const void* value, socklen_t size);
+
+    // Opens a socket for 'address', with the options set so far, and starts
+    // connecting it. Returns -1, with errno set, if that failed right away.
+    int start_connect(const ResolvedAddress& address, bool& connected) const;
+
+    static std::unique_ptr< TCPSocket > accepted(const TCPSocket& listening_socket,
+                                                 int socket_fd,
+                                                 const sockaddr_storage& address);
 
     int _socket_fd{-1};
+    int _family{AF_INET};
     short _source_family{AF_UNSPEC};
-    struct sockaddr_in _source;
+    // The peer: the client of an accepted socket, the server of a
+    // connected one.
+    sockaddr_storage _source{};
+    SocketTuning _tuning{};
+
+    // Replayed on the sockets connect() opens, one per option.
+    std::vector< Option > _options{};
 };
 
 };  // namespace comm
@@ -2,19 +2,35 @@
  * @copyright Copyright (c) 2021 ApertureData Inc.
  */
 
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
 #include <memory>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__aarch64__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
 #include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
 
 #include "comm/Exception.h"
 #include "comm/TLS.h"
 
-DEFINE_OPENSSL_DELETER(BIGNUM, BN_free);
 DEFINE_OPENSSL_DELETER(BIO, BIO_free);
 DEFINE_OPENSSL_DELETER(EVP_PKEY, EVP_PKEY_free);
-DEFINE_OPENSSL_DELETER(RSA, RSA_free);
+DEFINE_OPENSSL_DELETER(EVP_PKEY_CTX, EVP_PKEY_CTX_free);
 DEFINE_OPENSSL_DELETER(X509, X509_free);
 
+// Validity of auto-generated certificates.
+static constexpr int CERTIFICATE_LIFETIME = 24 * 3600;  // seconds
+
 std::string bio_to_string(const OpenSSLPointer< BIO >& bio);
 OpenSSLPointer< BIO > string_to_bio(const std::string& string);
 
@@ -86,30 +102,57 @@ OpenSSLPointer< SSL_CTX > create_server_context()
     return OpenSSLPointer< SSL_CTX >{ctx};
 }
 
-Certificate generate_certificate()
+static int key_type_id(comm::CertificateKeyType key_type)
+{
+    switch (key_type) {
+        case comm::CertificateKeyType::RSA_2048:
+            return EVP_PKEY_RSA;
+        case comm::CertificateKeyType::ECDSA_P256:
+            return EVP_PKEY_EC;
+        case comm::CertificateKeyType::Ed25519:
+            return EVP_PKEY_ED25519;
+    }
+
+    THROW_EXCEPTION(TLSError, "Unknown key type");
+}
+
+static OpenSSLPointer< EVP_PKEY > generate_key(comm::CertificateKeyType key_type)
 {
     constexpr int rsa_key_length = 2048;
-    constexpr int expires_in     = 24 * 3600;  // seconds
 
-    OpenSSLPointer< RSA > rsa{RSA_new()};
-    OpenSSLPointer< BIGNUM > bn{BN_new()};
+    OpenSSLPointer< EVP_PKEY_CTX > ctx{EVP_PKEY_CTX_new_id(key_type_id(key_type), nullptr)};
+
+    if (!ctx || EVP_PKEY_keygen_init(ctx.get()) != 1) {
+        THROW_EXCEPTION(TLSError, "Unable to create the private key");
+    }
 
-    BN_set_word(bn.get(), RSA_F4);
+    int res = 1;
 
-    int res = RSA_generate_key_ex(rsa.get(), rsa_key_length, bn.get(), nullptr);
+    if (key_type == comm::CertificateKeyType::RSA_2048) {
+        res = EVP_PKEY_CTX_set_rsa_keygen_bits(ctx.get(), rsa_key_length);
+    } else if (key_type == comm::CertificateKeyType::ECDSA_P256) {
+        res = EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx.get(), NID_X9_62_prime256v1);
+    }
 
-    if (res != 1) {
+    EVP_PKEY* pkey = nullptr;
+
+    if (res != 1 || EVP_PKEY_keygen(ctx.get(), &pkey) != 1) {
         THROW_EXCEPTION(TLSError, "Unable to create the private key");
     }
 
+    return OpenSSLPointer< EVP_PKEY >{pkey};
+}
+
+Certificate generate_certificate(comm::CertificateKeyType key_type)
+{
+    auto pkey = generate_key(key_type);
+
     OpenSSLPointer< X509 > cert{X509_new()};
-    OpenSSLPointer< EVP_PKEY > pkey{EVP_PKEY_new()};
 
-    EVP_PKEY_assign(pkey.get(), EVP_PKEY_RSA, reinterpret_cast< char* >(rsa.release()));
     ASN1_INTEGER_set(X509_get_serialNumber(cert.get()), 1);
 
     X509_gmtime_adj(X509_get_notBefore(cert.get()), 0);  // now
-    X509_gmtime_adj(X509_get_notAfter(cert.get()), expires_in);
+    X509_gmtime_adj(X509_get_notAfter(cert.get()), CERTIFICATE_LIFETIME);
 
     X509_set_pubkey(cert.get(), pkey.get());
 
@@ -124,12 +167,18 @@ Certificate generate_certificate()
     X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, common_name, -1, -1, 0);
 
     X509_set_issuer_name(cert.get(), name);
-    X509_sign(cert.get(), pkey.get(), EVP_sha256());
+
+    // Ed25519 signs the message itself, without a separate digest.
+    auto digest = key_type == comm::CertificateKeyType::Ed25519 ? nullptr : EVP_sha256();
+
+    if (X509_sign(cert.get(), pkey.get(), digest) == 0) {
+        THROW_EXCEPTION(TLSError, "Unable to sign the certificate");
+    }
 
     OpenSSLPointer< BIO > private_key_bio{BIO_new(BIO_s_mem())};
     OpenSSLPointer< BIO > cert_bio{BIO_new(BIO_s_mem())};
 
-    res = PEM_write_bio_PrivateKey(
+    int res = PEM_write_bio_PrivateKey(
         private_key_bio.get(), pkey.get(), nullptr, nullptr, 0, nullptr, nullptr);
 
     if (res != 1) {
@@ -149,6 +198,116 @@ Certificate generate_certificate()
     return c;
 }
 
+// Reads a certificate cache file, which holds the certificate and then
+// its private key, in PEM format. A file that is not ours, or that others
+// could have written to, is not trusted with the key.
+static bool load_certificate(const std::string& cache_path,
+                             comm::CertificateKeyType key_type,
+                             Certificate& certificate)
+{
+    int fd = ::open(cache_path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat status;
+    std::string content;
+
+    if (::fstat(fd, &status) == 0 && S_ISREG(status.st_mode) && status.st_uid == ::geteuid() &&
+        (status.st_mode & (S_IWGRP | S_IWOTH)) == 0) {
+        char buffer[4096];
+        ssize_t count;
+
+        while ((count = ::read(fd, buffer, sizeof(buffer))) > 0) {
+            content.append(buffer, static_cast< size_t >(count));
+        }
+    }
+
+    ::close(fd);
+
+    if (content.empty()) {
+        return false;
+    }
+
+    // The BIO reads from the string in place, so it must outlive it.
+    auto bio = string_to_bio(content);
+
+    OpenSSLPointer< X509 > cert{PEM_read_bio_X509(bio.get(), nullptr, nullptr, nullptr)};
+    OpenSSLPointer< EVP_PKEY > pkey{PEM_read_bio_PrivateKey(bio.get(), nullptr, nullptr, nullptr)};
+
+    if (!cert || !pkey || EVP_PKEY_base_id(pkey.get()) != key_type_id(key_type) ||
+        X509_check_private_key(cert.get(), pkey.get()) != 1) {
+        return false;
+    }
+
+    // Leave the certificate at least half of its lifetime to serve.
+    time_t renew_after = std::time(nullptr) + CERTIFICATE_LIFETIME / 2;
+
+    if (X509_cmp_time(X509_get0_notAfter(cert.get()), &renew_after) <= 0) {
+        return false;
+    }
+
+    OpenSSLPointer< BIO > private_key_bio{BIO_new(BIO_s_mem())};
+    OpenSSLPointer< BIO > cert_bio{BIO_new(BIO_s_mem())};
+
+    if (PEM_write_bio_PrivateKey(
+            private_key_bio.get(), pkey.get(), nullptr, nullptr, 0, nullptr, nullptr) != 1 ||
+        PEM_write_bio_X509(cert_bio.get(), cert.get()) != 1) {
+        return false;
+    }
+
+    certificate.private_key = bio_to_string(private_key_bio);
+    certificate.cert        = bio_to_string(cert_bio);
+
+    return true;
+}
+
+// Writes the cache file atomically, readable by the owner only. Failing to
+// do so only costs a new certificate next time, so errors are ignored.
+static void store_certificate(const std::string& cache_path, const Certificate& certificate)
+{
+    std::string temporary_path = cache_path + ".XXXXXX";
+
+    int fd = ::mkstemp(&temporary_path[0]);
+
+    if (fd < 0) {
+        return;
+    }
+
+    std::string content = certificate.cert + certificate.private_key;
+
+    bool written = ::fchmod(fd, S_IRUSR | S_IWUSR) == 0 &&
+                   ::write(fd, content.data(), content.size()) ==
+                       static_cast< ssize_t >(content.size());
+
+    ::close(fd);
+
+    if (!written || std::rename(temporary_path.c_str(), cache_path.c_str()) != 0) {
+        ::unlink(temporary_path.c_str());
+    }
+}
+
+Certificate load_or_generate_certificate(const std::string& cache_path,
+                                         comm::CertificateKeyType key_type)
+{
+    Certificate certificate;
+
+    if (cache_path.empty()) {
+        return generate_certificate(key_type);
+    }
+
+    if (load_certificate(cache_path, key_type, certificate)) {
+        return certificate;
+    }
+
+    certificate = generate_certificate(key_type);
+
+    store_certificate(cache_path, certificate);
+
+    return certificate;
+}
+
 void set_ca_certificate(SSL_CTX* ssl_ctx, const std::string& ca_certificate)
 {
     auto bio = string_to_bio(ca_certificate);
@@ -229,17 +388,99 @@ void set_tls_private_key(SSL_CTX* ssl_ctx, const std::string& tls_private_key)
     }
 
     // TODO: add support for setting a passphrase
-    auto rsa = PEM_read_bio_RSAPrivateKey(bio.get(), nullptr, nullptr, nullptr);
+    OpenSSLPointer< EVP_PKEY > pkey{PEM_read_bio_PrivateKey(bio.get(), nullptr, nullptr, nullptr)};
 
-    if (!rsa) {
+    if (!pkey) {
         THROW_EXCEPTION(TLSError, "Unable to read the certificate");
     }
 
-    auto res = SSL_CTX_use_RSAPrivateKey(ssl_ctx, rsa);
+    auto res = SSL_CTX_use_PrivateKey(ssl_ctx, pkey.get());
 
     if (res != 1) {
-        RSA_free(rsa);
-
         THROW_EXCEPTION(TLSError, "Unable to load the certificate");
     }
-}
\ No newline at end of file
+}
+
+bool enable_ktls(SSL_CTX* ssl_ctx)
+{
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_CTX_set_options(ssl_ctx, SSL_OP_ENABLE_KTLS);
+    return true;
+#else
+    (void)ssl_ctx;
+    return false;
+#endif
+}
+
+bool ktls_enabled(const SSL_CTX* ssl_ctx)
+{
+#ifdef SSL_OP_ENABLE_KTLS
+    return (SSL_CTX_get_options(ssl_ctx) & SSL_OP_ENABLE_KTLS) != 0;
+#else
+    (void)ssl_ctx;
+    return false;
+#endif
+}
+
+bool has_aes_acceleration()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_cpu_supports("aes");
+#elif defined(__aarch64__)
+    return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+#else
+    return false;
+#endif
+}
+
+void set_tls_policy(SSL_CTX* ssl_ctx, const comm::TLSPolicy& policy)
+{
+    auto min_version = policy.min_version == comm::TLSVersion::TLS1_3 ? TLS1_3_VERSION
+                                                                       : TLS1_2_VERSION;
+
+    if (SSL_CTX_set_min_proto_version(ssl_ctx, min_version) != 1) {
+        THROW_EXCEPTION(TLSError, "Unable to set the minimum TLS version");
+    }
+
+    auto cipher_suites = policy.cipher_suites;
+
+    if (cipher_suites.empty()) {
+        constexpr char aes_first[] =
+            "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256";
+        constexpr char chacha_first[] =
+            "TLS_CHACHA20_POLY1305_SHA256:TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384";
+
+        switch (policy.cipher_preference) {
+            case comm::CipherPreference::Auto:
+                // OpenSSL's defaults already favor AES-GCM.
+                if (!has_aes_acceleration()) {
+                    cipher_suites = chacha_first;
+                }
+                break;
+            case comm::CipherPreference::AES_GCM:
+                cipher_suites = aes_first;
+                break;
+            case comm::CipherPreference::ChaCha20:
+                cipher_suites = chacha_first;
+                break;
+        }
+    }
+
+    if (!cipher_suites.empty() && SSL_CTX_set_ciphersuites(ssl_ctx, cipher_suites.c_str()) != 1) {
+        THROW_EXCEPTION(TLSError, "Invalid TLS 1.3 cipher suites: " + cipher_suites);
+    }
+
+    if (!policy.cipher_list.empty() &&
+        SSL_CTX_set_cipher_list(ssl_ctx, policy.cipher_list.c_str()) != 1) {
+        THROW_EXCEPTION(TLSError, "Invalid TLS 1.2 cipher list: " + policy.cipher_list);
+    }
+
+    if (!policy.groups.empty() && SSL_CTX_set1_groups_list(ssl_ctx, policy.groups.c_str()) != 1) {
+        THROW_EXCEPTION(TLSError, "Invalid key exchange groups: " + policy.groups);
+    }
+}
+
+void set_server_cipher_preference(SSL_CTX* ssl_ctx)
+{
+    SSL_CTX_set_options(ssl_ctx, SSL_OP_CIPHER_SERVER_PREFERENCE);
+}
@@ -10,6 +10,9 @@
 
 #include <openssl/ssl.h>
 
+#include "comm/CertificateKeyType.h"
+#include "comm/TLSPolicy.h"
+
 struct Certificate {
     std::string private_key{};
     std::string cert{};
@@ -41,8 +44,32 @@ using OpenSSLPointer = std::unique_ptr< T, OpenSSLDeleter< T > >;
 
 OpenSSLPointer< SSL_CTX > create_client_context();
 OpenSSLPointer< SSL_CTX > create_server_context();
-Certificate generate_certificate();
+Certificate generate_certificate(
+    comm::CertificateKeyType key_type = comm::CertificateKeyType::ECDSA_P256);
+
+// Reuses the certificate kept in 'cache_path' if it has the requested key
+// type and is valid for a while longer; otherwise generates a new one and
+// stores it there. An empty path always generates a new certificate.
+Certificate load_or_generate_certificate(const std::string& cache_path,
+                                         comm::CertificateKeyType key_type);
 void set_ca_certificate(SSL_CTX* ssl_ctx, const std::string& ca_certificate);
 bool set_default_verify_paths(SSL_CTX* ssl_ctx);
 void set_tls_certificate(SSL_CTX* ssl_ctx, const std::string& tls_certificate);
 void set_tls_private_key(SSL_CTX* ssl_ctx, const std::string& tls_private_key);
+
+// Restricts the protocol versions, cipher suites and key exchange groups
+// a context negotiates. Whatever the policy leaves empty keeps OpenSSL's
+// defaults. Throws TLSError if OpenSSL rejects any of them.
+void set_tls_policy(SSL_CTX* ssl_ctx, const comm::TLSPolicy& policy);
+
+// Makes a server context pick from its own list of cipher suites, in its
+// own order, so that its policy holds whatever order the client offers.
+void set_server_cipher_preference(SSL_CTX* ssl_ctx);
+
+// Whether the CPU has AES instructions (AES-NI, ARMv8 crypto extensions).
+bool has_aes_acceleration();
+
+// Lets OpenSSL hand the record keys to the kernel (kTLS) after the handshake.
+// Returns false if this OpenSSL was built without kTLS support.
+bool enable_ktls(SSL_CTX* ssl_ctx);
+bool ktls_enabled(const SSL_CTX* ssl_ctx);
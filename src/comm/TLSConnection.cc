@@ -4,10 +4,13 @@
 
 #include "comm/TLSConnection.h"
 
+#include <algorithm>
 #include <assert.h>
+#include <climits>
 #include <cstdlib>
 #include <errno.h>
 #include <netdb.h>
+#include <poll.h>
 #include <string>
 #include <unistd.h>
 
@@ -19,51 +22,150 @@ ENABLE_WARNING(suggest-override)
 ENABLE_WARNING(effc++)
 
 #include "comm/Exception.h"
+#include "comm/SigpipeGuard.h"
 
 using namespace comm;
 
+// Largest plaintext that fits in a single TLS record.
+static constexpr size_t TLS_RECORD_SIZE = 16 * 1024;
+
 TLSConnection::TLSConnection(std::unique_ptr< TLSSocket > tls_socket, ConnMetrics* metrics)
     : Connection(metrics), _tls_socket(std::move(tls_socket))
 {
+    // Blocking calls wait outside of _ssl_mutex, in wait_ready(); only the
+    // calls into OpenSSL hold it. A write that could not complete must be
+    // retried with the same arguments unless OpenSSL is told the buffer
+    // may move between calls.
+    if (_tls_socket) {
+        if (!_tls_socket->_tcp_socket->set_nonblocking(true)) {
+            THROW_EXCEPTION(SocketFail, "Unable to change blocking mode");
+        }
+
+        SSL_set_mode(_tls_socket->_ssl,
+                     SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    }
 }
 
-static long msec_diff(const struct timespec& a, const struct timespec& b)
+size_t TLSConnection::read(uint8_t* buffer, size_t length)
 {
-    return (a.tv_sec - b.tv_sec) * 1000 + (a.tv_nsec - b.tv_nsec) / 1000000;
+    size_t count;
+
+    while ((count = read_some(buffer, length)) == 0) {
+        wait_ready(POLLIN, -1);
+    }
+
+    return count;
 }
 
-size_t TLSConnection::read(uint8_t* buffer, size_t length)
+size_t TLSConnection::write(const uint8_t* buffer, size_t length)
+{
+    if (_tls_socket->ktls_send()) {
+        iovec iov{const_cast< uint8_t* >(buffer), length};
+        return writev(&iov, 1);
+    }
+
+    size_t count;
+
+    while ((count = write_some(buffer, length)) == 0) {
+        wait_ready(POLLOUT, -1);
+    }
+
+    return count;
+}
+
+size_t TLSConnection::writev(const iovec* iov, int iovcnt)
+{
+    // With kTLS, the kernel frames the records; hand it everything at once.
+    if (_tls_socket->ktls_send()) {
+        size_t count;
+
+        while ((count = send_plaintext(iov, iovcnt)) == 0) {
+            wait_ready(POLLOUT, -1);
+        }
+
+        return count;
+    }
+
+    // SSL_write has no gather variant, and every call emits at least one
+    // record. Buffers that fill a record on their own are written in place;
+    // smaller ones are packed together so the size header and short bodies
+    // travel in a single record.
+    if (iovcnt > 0 && iov[0].iov_len >= TLS_RECORD_SIZE) {
+        return write(static_cast< const uint8_t* >(iov[0].iov_base), iov[0].iov_len);
+    }
+
+    _record_buffer.clear();
+
+    for (int i = 0; i < iovcnt && _record_buffer.size() < TLS_RECORD_SIZE; ++i) {
+        auto length = std::min(iov[i].iov_len, TLS_RECORD_SIZE - _record_buffer.size());
+        _record_buffer.append(static_cast< const uint8_t* >(iov[i].iov_base), length);
+    }
+
+    return write(_record_buffer.data(), _record_buffer.size());
+}
+
+size_t TLSConnection::write_file(int file_fd, off_t offset, size_t count)
+{
+    if (!_tls_socket->ktls_send()) {
+        return Connection::write_file(file_fd, offset, count);
+    }
+
+    ssize_t sent;
+
+    errno = 0;
+    while ((sent = _tls_socket->_tcp_socket->send_file(file_fd, offset, count)) < 0 &&
+           errno == EAGAIN) {
+        wait_ready(POLLOUT, -1);
+    }
+
+    if (sent < 0) {
+        THROW_EXCEPTION(WriteFail, errno, "sendfile()", 0);
+    }
+
+    return static_cast< size_t >(sent);
+}
+
+void TLSConnection::cork(bool corked) { _tls_socket->_tcp_socket->cork(corked); }
+
+size_t TLSConnection::send_plaintext(const iovec* iov, int iovcnt)
+{
+    msghdr msg{};
+    msg.msg_iov    = const_cast< iovec* >(iov);
+    msg.msg_iovlen = std::min(iovcnt, IOV_MAX);
+
+    errno       = 0;
+    auto count  = ::sendmsg(_tls_socket->native_handle(), &msg, MSG_NOSIGNAL);
+    int errno_r = errno;
+
+    if (count < 0) {
+        if (errno_r == EAGAIN) {
+            return 0;
+        }
+
+        THROW_EXCEPTION(WriteFail, errno_r, "sendmsg()", 0);
+    }
+
+    return static_cast< size_t >(count);
+}
+
+size_t TLSConnection::read_some(uint8_t* buffer, size_t length)
 {
-again:
-    timespec t1;
-    clock_gettime(CLOCK_REALTIME_COARSE, &t1);
+    std::lock_guard< std::mutex > lock(*_ssl_mutex);
 
     errno       = 0;
-    auto count  = SSL_read(_tls_socket->_ssl, buffer, length);
+    auto count  = SSL_read(_tls_socket->_ssl, buffer, static_cast< int >(length));
     int errno_r = errno;
 
     if (count <= 0) {
         auto error = SSL_get_error(_tls_socket->_ssl, count);
 
-        if (error == SSL_ERROR_ZERO_RETURN) {
-            THROW_EXCEPTION(ConnectionShutDown,  // FIXME -- misleading 'ConnectionShutDown'
-                            errno_r,
-                            "SSL_read()",
-                            error);  // Peer closed conn for writing, so no more reads
-        } else if (error == SSL_ERROR_WANT_READ) {
-            if (errno_r == EAGAIN) {
-                timespec t2;
-                clock_gettime(CLOCK_REALTIME_COARSE, &t2);
-                auto dt = msec_diff(t2, t1);
-                VLOG(3) << "SSL_read(): no activity for " << dt << " msec. Going back to reading";
-                goto again;
-            } else {
-                // This error is recoverable. Consider handling it.
-                THROW_EXCEPTION(ReadFail, errno_r, "SSL_read()", error);
-            }
-        } else if (error == SSL_ERROR_SYSCALL || error == SSL_ERROR_SSL) {
+        if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) {
+            _read_wants = error == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT;
+            return 0;
+        } else if (error == SSL_ERROR_ZERO_RETURN || error == SSL_ERROR_SYSCALL ||
+                   error == SSL_ERROR_SSL) {
+            // Peer closed the connection, for writing at least.
             THROW_EXCEPTION(ConnectionShutDown, errno_r, "SSL_read()", error);
-            // FIXME: *we* must close the conn
         } else {
             THROW_EXCEPTION(ReadFail, errno_r, "SSL_read()", error);
         }
@@ -72,19 +174,46 @@ again:
     return static_cast< size_t >(count);
 }
 
-size_t TLSConnection::write(const uint8_t* buffer, size_t length)
+size_t TLSConnection::write_some(const uint8_t* buffer, size_t length)
 {
+    std::lock_guard< std::mutex > lock(*_ssl_mutex);
+
+    SigpipeGuard guard(_tls_socket->_native_bio);
+
     errno       = 0;
     auto count  = SSL_write(_tls_socket->_ssl, buffer, static_cast< int >(length));
     int errno_r = errno;
+
     if (count <= 0) {
         auto error = SSL_get_error(_tls_socket->_ssl, count);
+
+        if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) {
+            _write_wants = error == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT;
+            return 0;
+        }
+
         THROW_EXCEPTION(WriteFail, errno_r, "SSL_write()", error);
     }
 
     return static_cast< size_t >(count);
 }
 
+// The socket stays non-blocking; blocking calls wait in wait_ready().
+void TLSConnection::set_nonblocking(bool /*nonblocking*/) {}
+
+// SSL_read() may have to write before it can read, and SSL_write() read
+// before it can write.
+bool TLSConnection::wait_ready(short events, int timeout_ms)
+{
+    return Connection::wait_ready(events == POLLIN ? _read_wants : _write_wants, timeout_ms);
+}
+
+int TLSConnection::native_handle() const { return _tls_socket ? _tls_socket->native_handle() : -1; }
+
+std::string TLSConnection::cipher() const { return _tls_socket->cipher(); }
+
+bool TLSConnection::session_reused() const { return _tls_socket->session_reused(); }
+
 std::string TLSConnection::get_source() const { return _tls_socket->print_source(); }
 
 short TLSConnection::get_source_family() const { return _tls_socket->source_family(); }
@@ -5,8 +5,11 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
 #include <string>
 
+#include <poll.h>
+
 #include "comm/Connection.h"
 #include "util/Macros.h"
 #include "comm/TLSSocket.h"
@@ -28,11 +31,42 @@ class TLSConnection : public Connection
     bool is_open() override;
     void shutdown() override;
 
+    // Whether the handshake resumed an earlier TLS session.
+    bool session_reused() const;
+
+    // Name of the negotiated cipher suite.
+    std::string cipher() const;
+
    protected:
     size_t read(uint8_t* buffer, size_t length) override;
     size_t write(const uint8_t* buffer, size_t length) override;
+    size_t writev(const iovec* iov, int iovcnt) override;
+    size_t write_file(int file_fd, off_t offset, size_t count) override;
+    void cork(bool corked) override;
+    size_t read_some(uint8_t* buffer, size_t length) override;
+    size_t write_some(const uint8_t* buffer, size_t length) override;
+    void set_nonblocking(bool nonblocking) override;
+    bool wait_ready(short events, int timeout_ms) override;
+    int native_handle() const override;
+
+   private:
+    // Writes straight to a kTLS socket, bypassing SSL_write.
+    size_t send_plaintext(const iovec* iov, int iovcnt);
 
     std::unique_ptr< TLSSocket > _tls_socket;
+
+    // OpenSSL does not let two threads into the same SSL object at once,
+    // while a pipelined client sends and receives on threads of their own.
+    // The socket is non-blocking, so that neither holds this while waiting.
+    std::unique_ptr< std::mutex > _ssl_mutex{new std::mutex};
+
+    // What the last SSL_read() and SSL_write() that could not go on waited
+    // for: POLLIN or POLLOUT. Each is only touched by its own direction.
+    short _read_wants{POLLIN};
+    short _write_wants{POLLOUT};
+
+    // Used to pack small buffers into a single TLS record.
+    std::basic_string< uint8_t > _record_buffer{};
 };
 
 };  // namespace comm
@@ -0,0 +1,372 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#include "comm/TLSSession.h"
+
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <deque>
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#endif
+
+#include "comm/Exception.h"
+
+using namespace comm;
+
+namespace
+{
+
+// Function-local statics are not thread-safe with -fno-threadsafe-statics,
+// so make sure the cache is constructed at load time.
+[[maybe_unused]] TLSSessionCache* cache_instance = &TLSSessionCache::instance();
+
+// The address, followed by a digest of the trust settings.
+std::string session_key(const Address& address, const std::string& trust)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_size = 0;
+
+    if (EVP_Digest(trust.data(), trust.size(), digest, &digest_size, EVP_sha256(), nullptr) != 1) {
+        THROW_EXCEPTION(TLSError, "Unable to digest the session trust settings");
+    }
+
+    static constexpr char hex[] = "0123456789abcdef";
+
+    std::string key = address.addr + ":" + std::to_string(address.port) + "/";
+
+    for (unsigned int i = 0; i < digest_size; ++i) {
+        key += hex[digest[i] >> 4];
+        key += hex[digest[i] & 0xf];
+    }
+
+    return key;
+}
+
+void free_address_key(void*, void* ptr, CRYPTO_EX_DATA*, int, long, void*)
+{
+    delete static_cast< std::string* >(ptr);
+}
+
+// Keys protecting the session tickets of one server context.
+class SessionTicketKeys
+{
+   public:
+    static constexpr std::size_t NAME_SIZE = 16;
+
+    struct Key {
+        unsigned char name[NAME_SIZE];
+        unsigned char aes_key[32];
+        unsigned char hmac_key[32];
+    };
+
+    explicit SessionTicketKeys(std::chrono::seconds rotation_interval)
+        : _rotation_interval(rotation_interval)
+    {
+        rotate();
+    }
+
+    // Key for new tickets. Replaces the current key if it is due.
+    Key encryption_key()
+    {
+        std::lock_guard< std::mutex > lock(_mutex);
+
+        if (std::chrono::steady_clock::now() - _rotated_at >= _rotation_interval) {
+            rotate();
+        }
+
+        return _keys.front();
+    }
+
+    // Looks up the key a ticket was issued with.
+    bool decryption_key(const unsigned char* name, Key& key)
+    {
+        std::lock_guard< std::mutex > lock(_mutex);
+
+        for (auto& candidate : _keys) {
+            if (std::memcmp(candidate.name, name, NAME_SIZE) == 0) {
+                key = candidate;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+   private:
+    static constexpr std::size_t KEPT_KEYS = 3;
+
+    void rotate()
+    {
+        Key key;
+
+        if (RAND_bytes(reinterpret_cast< unsigned char* >(&key), sizeof(key)) != 1) {
+            THROW_EXCEPTION(TLSError, "Unable to generate a session ticket key");
+        }
+
+        _keys.push_front(key);
+
+        if (_keys.size() > KEPT_KEYS) {
+            _keys.pop_back();
+        }
+
+        _rotated_at = std::chrono::steady_clock::now();
+    }
+
+    std::mutex _mutex{};
+    std::deque< Key > _keys{};
+    std::chrono::seconds _rotation_interval;
+    std::chrono::steady_clock::time_point _rotated_at{};
+};
+
+void free_ticket_keys(void*, void* ptr, CRYPTO_EX_DATA*, int, long, void*)
+{
+    delete static_cast< SessionTicketKeys* >(ptr);
+}
+
+const int ticket_keys_index =
+    SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, free_ticket_keys);
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+using MacContext = EVP_MAC_CTX;
+
+bool init_mac(MacContext* mac_ctx, const unsigned char* hmac_key)
+{
+    char digest[] = "SHA256";
+
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_octet_string(
+            OSSL_MAC_PARAM_KEY, const_cast< unsigned char* >(hmac_key), 32),
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+        OSSL_PARAM_construct_end()};
+
+    return EVP_MAC_CTX_set_params(mac_ctx, params) == 1;
+}
+#else
+using MacContext = HMAC_CTX;
+
+bool init_mac(MacContext* mac_ctx, const unsigned char* hmac_key)
+{
+    return HMAC_Init_ex(mac_ctx, hmac_key, 32, EVP_sha256(), nullptr) == 1;
+}
+#endif
+
+// Returns 1 to use the key, 2 to use it and issue a new ticket,
+// 0 when the ticket cannot be decrypted, and -1 on errors.
+int ticket_key_callback(SSL* ssl,
+                        unsigned char* key_name,
+                        unsigned char* iv,
+                        EVP_CIPHER_CTX* cipher_ctx,
+                        MacContext* mac_ctx,
+                        int encrypt)
+{
+    auto keys = static_cast< SessionTicketKeys* >(
+        SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ticket_keys_index));
+
+    if (!keys) {
+        return -1;
+    }
+
+    SessionTicketKeys::Key key;
+
+    if (encrypt) {
+        key = keys->encryption_key();
+
+        std::memcpy(key_name, key.name, SessionTicketKeys::NAME_SIZE);
+
+        if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1 ||
+            EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), nullptr, key.aes_key, iv) != 1 ||
+            !init_mac(mac_ctx, key.hmac_key)) {
+            return -1;
+        }
+
+        return 1;
+    }
+
+    if (!keys->decryption_key(key_name, key)) {
+        return 0;
+    }
+
+    if (EVP_DecryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), nullptr, key.aes_key, iv) != 1 ||
+        !init_mac(mac_ctx, key.hmac_key)) {
+        return -1;
+    }
+
+    // Clients use a TLS 1.3 ticket only once, so always have a fresh one
+    // issued for the next connection.
+    return 2;
+}
+
+}  // namespace
+
+TLSSessionCache& TLSSessionCache::instance()
+{
+    static TLSSessionCache cache;
+
+    return cache;
+}
+
+TLSSessionCache::TLSSessionCache()
+    : _address_index(SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, free_address_key))
+    , _mutex()
+    , _sessions()
+{
+}
+
+void TLSSessionCache::attach(SSL_CTX* ssl_ctx, const Address& address, const std::string& trust)
+{
+    auto key = new std::string(session_key(address, trust));
+
+    if (!SSL_CTX_set_ex_data(ssl_ctx, _address_index, key)) {
+        delete key;
+        return;
+    }
+
+    // Sessions are handed to us as they arrive; TLS 1.3 tickets only come
+    // after the handshake, so the cache cannot be filled from connect().
+    SSL_CTX_set_session_cache_mode(ssl_ctx,
+                                   SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ssl_ctx, new_session_callback);
+}
+
+void TLSSessionCache::resume(SSL* ssl)
+{
+    auto key =
+        static_cast< std::string* >(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), _address_index));
+
+    if (!key) {
+        return;
+    }
+
+    SessionPointer session;
+
+    {
+        std::lock_guard< std::mutex > lock(_mutex);
+
+        auto it = _sessions.find(*key);
+
+        if (it == _sessions.end()) {
+            return;
+        }
+
+        auto& sessions = it->second;
+        auto now       = std::time(nullptr);
+
+        // Tickets are meant to be used once (RFC 8446, appendix C.4);
+        // the server sends a new one with every handshake.
+        while (!session && !sessions.empty()) {
+            auto candidate = std::move(sessions.back());
+            sessions.pop_back();
+
+            auto expires = SSL_SESSION_get_time(candidate.get()) +
+                           SSL_SESSION_get_timeout(candidate.get());
+
+            if (SSL_SESSION_is_resumable(candidate.get()) && now < expires) {
+                session = std::move(candidate);
+            }
+        }
+
+        if (sessions.empty()) {
+            _sessions.erase(it);
+        }
+    }
+
+    if (session) {
+        SSL_set_session(ssl, session.get());
+    }
+}
+
+std::size_t TLSSessionCache::size() const
+{
+    std::lock_guard< std::mutex > lock(_mutex);
+
+    std::size_t size = 0;
+
+    for (auto& entry : _sessions) {
+        size += entry.second.size();
+    }
+
+    return size;
+}
+
+void TLSSessionCache::clear()
+{
+    std::lock_guard< std::mutex > lock(_mutex);
+
+    _sessions.clear();
+}
+
+int TLSSessionCache::new_session_callback(SSL* ssl, SSL_SESSION* session)
+{
+    auto& cache = instance();
+
+    auto key = static_cast< std::string* >(
+        SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), cache._address_index));
+
+    if (!key) {
+        return 0;
+    }
+
+    // Not one to resume without verifying the server again.
+    if ((SSL_get_verify_mode(ssl) & SSL_VERIFY_PEER) && SSL_get_verify_result(ssl) != X509_V_OK) {
+        return 0;
+    }
+
+    cache.store(*key, session);
+
+    // We keep the reference OpenSSL handed us.
+    return 1;
+}
+
+void TLSSessionCache::store(const std::string& key, SSL_SESSION* session)
+{
+    SessionPointer pointer(session, SSL_SESSION_free);
+
+    std::lock_guard< std::mutex > lock(_mutex);
+
+    if (_sessions.size() >= MAX_SERVERS && _sessions.find(key) == _sessions.end()) {
+        _sessions.erase(_sessions.begin());
+    }
+
+    auto& sessions = _sessions[key];
+
+    sessions.push_back(std::move(pointer));
+
+    if (sessions.size() > MAX_SESSIONS_PER_SERVER) {
+        sessions.pop_front();
+    }
+}
+
+void comm::enable_session_tickets(SSL_CTX* ssl_ctx, unsigned rotation_interval)
+{
+    if (rotation_interval == 0) {
+        SSL_CTX_set_options(ssl_ctx, SSL_OP_NO_TICKET);
+        return;
+    }
+
+    auto keys = new SessionTicketKeys(std::chrono::seconds(rotation_interval));
+
+    if (!SSL_CTX_set_ex_data(ssl_ctx, ticket_keys_index, keys)) {
+        delete keys;
+        THROW_EXCEPTION(TLSError, "Unable to install the session ticket keys");
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    SSL_CTX_set_tlsext_ticket_key_evp_cb(ssl_ctx, ticket_key_callback);
+#else
+    SSL_CTX_set_tlsext_ticket_key_cb(ssl_ctx, ticket_key_callback);
+#endif
+
+    // A ticket is only useful as long as its key is kept around.
+    SSL_CTX_set_timeout(ssl_ctx, static_cast< long >(rotation_interval) * 2);
+
+    constexpr unsigned char session_id_context[] = "libcomm";
+    SSL_CTX_set_session_id_context(ssl_ctx, session_id_context, sizeof(session_id_context) - 1);
+}
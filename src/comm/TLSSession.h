@@ -0,0 +1,78 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <openssl/ssl.h>
+
+#include "comm/Address.h"
+#include "util/Macros.h"
+
+namespace comm
+{
+
+// Process-wide store of TLS sessions, keyed by server address, so that a
+// new client context reconnecting to a server it talked to before can
+// resume the session instead of going through a full handshake.
+//
+// A resumed session skips certificate verification, so sessions are only
+// offered to contexts that trust servers the same way as the one that got
+// them, and sessions from handshakes that failed verification are dropped.
+class TLSSessionCache
+{
+   public:
+    static TLSSessionCache& instance();
+
+    NOT_COPYABLE(TLSSessionCache);
+    NOT_MOVEABLE(TLSSessionCache);
+
+    // Makes connections created from 'ssl_ctx' store the sessions (and
+    // TLS 1.3 tickets) they get from 'address' in the cache. 'trust' must
+    // tell apart contexts that verify, or negotiate with, servers
+    // differently: whether they verify, the CAs, the TLS policy.
+    void attach(SSL_CTX* ssl_ctx, const Address& address, const std::string& trust);
+
+    // Offers the newest cached session, if any, on a connection about to
+    // connect. Does nothing if the context of 'ssl' was not attached.
+    void resume(SSL* ssl);
+
+    // Number of sessions cached, across servers.
+    std::size_t size() const;
+    void clear();
+
+   private:
+    using SessionPointer = std::shared_ptr< SSL_SESSION >;
+
+    static constexpr std::size_t MAX_SERVERS = 1024;
+
+    // A ticket resumes a single connection, so a few are kept per server
+    // for pools that open several connections at once.
+    static constexpr std::size_t MAX_SESSIONS_PER_SERVER = 16;
+
+    TLSSessionCache();
+
+    static int new_session_callback(SSL* ssl, SSL_SESSION* session);
+
+    void store(const std::string& key, SSL_SESSION* session);
+
+    int _address_index;  // SSL_CTX ex_data slot holding the cache key
+
+    mutable std::mutex _mutex;
+    std::unordered_map< std::string, std::deque< SessionPointer > > _sessions;
+};
+
+// Turns on stateless session resumption (session tickets) on a server
+// context. Tickets are protected with keys generated in-process and
+// replaced every 'rotation_interval' seconds; tickets issued with the two
+// previous keys are still accepted. Every resumption gets a new ticket.
+void enable_session_tickets(SSL_CTX* ssl_ctx, unsigned rotation_interval);
+
+};  // namespace comm
@@ -8,23 +8,29 @@
 #include <cstring>
 #include <netdb.h>
 #include <netinet/ip.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
 #include "comm/Exception.h"
 #include "comm/OpenSSLBio.h"
+#include "comm/SigpipeGuard.h"
+#include "comm/TLS.h"
+#include "comm/TLSSession.h"
 #include "comm/Variables.h"
 
 using namespace comm;
 
-TLSSocket::TLSSocket(std::unique_ptr< TCPSocket > tcp_socket, SSL* ssl)
-    : _ssl(ssl), _tcp_socket(std::move(tcp_socket))
+TLSSocket::TLSSocket(std::unique_ptr< TCPSocket > tcp_socket, SSL* ssl, bool native_bio)
+    : _ssl(ssl), _native_bio(native_bio), _tcp_socket(std::move(tcp_socket))
 {
 }
 
 TLSSocket::~TLSSocket()
 {
     if (_ssl) {
+        SigpipeGuard guard(_native_bio);
+
         int status = SSL_get_shutdown(_ssl);
         if ((status & (SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN)) == 0) {
             SSL_shutdown(_ssl);
@@ -42,32 +48,90 @@ void TLSSocket::accept()
     if (result < 1) {
         THROW_EXCEPTION(TLSError, errno_r, "SSL_accept()", result);
     }
+
+    check_ktls();
 }
 
-void TLSSocket::connect()
+void TLSSocket::connect(const Deadline& deadline)
 {
-    errno       = 0;
-    auto result = ::SSL_connect(_ssl);
-    int errno_r = errno;
+    TLSSessionCache::instance().resume(_ssl);
 
-    if (result < 1) {
-        THROW_EXCEPTION(TLSError, errno_r, "SSL_connect()", result);
+    // With a deadline, the handshake runs on the non-blocking socket, and
+    // waits for it between steps.
+    if (deadline.is_set() && !_tcp_socket->set_nonblocking(true)) {
+        THROW_EXCEPTION(SocketFail, "Unable to change blocking mode");
+    }
+
+    while (true) {
+        errno       = 0;
+        auto result = ::SSL_connect(_ssl);
+        int errno_r = errno;
+
+        if (result == 1) {
+            break;
+        }
+
+        auto error = SSL_get_error(_ssl, result);
+
+        if (!deadline.is_set() ||
+            (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE)) {
+            THROW_EXCEPTION(TLSError, errno_r, "SSL_connect()", result);
+        }
+
+        pollfd fd{_tcp_socket->native_handle(),
+                  static_cast< short >(error == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT),
+                  0};
+
+        if (::poll(&fd, 1, deadline.remaining_ms()) == 0) {
+            THROW_EXCEPTION(Timeout, "Deadline passed during the TLS handshake");
+        }
+    }
+
+    if (deadline.is_set() && !_tcp_socket->set_nonblocking(false)) {
+        THROW_EXCEPTION(SocketFail, "Unable to change blocking mode");
     }
+
+    check_ktls();
+}
+
+void TLSSocket::check_ktls()
+{
+#if defined(BIO_get_ktls_send)
+    _ktls_send = BIO_get_ktls_send(SSL_get_wbio(_ssl));
+#endif
 }
 
+bool TLSSocket::ktls_send() const { return _ktls_send; }
+
+std::string TLSSocket::cipher() const { return SSL_get_cipher_name(_ssl); }
+
+bool TLSSocket::session_reused() const { return SSL_session_reused(_ssl) == 1; }
+
 std::unique_ptr< TLSSocket > TLSSocket::create(std::unique_ptr< TCPSocket > tcp_socket,
                                                const std::shared_ptr< SSL_CTX >& ssl_ctx)
 {
     auto ssl = SSL_new(ssl_ctx.get());
 
-    auto bio = BIO_new(comm_openssl_bio());
+    // OpenSSL only offloads to the kernel through its own socket BIO, which
+    // knows how to send and receive kTLS records with their control messages.
+    bool native_bio = ktls_enabled(ssl_ctx.get());
+
+    BIO* bio;
+
+    if (native_bio) {
+        bio = BIO_new_socket(tcp_socket->_socket_fd, BIO_NOCLOSE);
+    } else {
+        bio = BIO_new(comm_openssl_bio());
+        BIO_set_fd(bio, tcp_socket->_socket_fd, BIO_NOCLOSE);
+    }
 
-    BIO_set_fd(bio, tcp_socket->_socket_fd, BIO_NOCLOSE);
     SSL_set_bio(ssl, bio, bio);
 
-    return std::unique_ptr< TLSSocket >(new TLSSocket(std::move(tcp_socket), ssl));
+    return std::unique_ptr< TLSSocket >(new TLSSocket(std::move(tcp_socket), ssl, native_bio));
 }
 
 std::string TLSSocket::print_source() { return _tcp_socket->print_source(); }
 
 short TLSSocket::source_family() { return _tcp_socket->source_family(); }
+
+int TLSSocket::native_handle() const { return _tcp_socket->native_handle(); }
@@ -9,6 +9,7 @@
 
 #include <openssl/ssl.h>
 
+#include "comm/Deadline.h"
 #include "TCPSocket.h"
 
 namespace comm
@@ -28,16 +29,35 @@ class TLSSocket
                                                const std::shared_ptr< SSL_CTX >& ssl_ctx);
 
     void accept();
-    void connect();
+
+    // Throws Timeout if the handshake is not done by 'deadline'.
+    void connect(const Deadline& deadline = {});
 
     std::string print_source();
     short source_family();
+    int native_handle() const;
+
+    // Whether the kernel encrypts what is written to the socket, so plain
+    // send() and sendfile() produce valid TLS records.
+    bool ktls_send() const;
+
+    // Whether the handshake resumed an earlier session.
+    bool session_reused() const;
+
+    // Name of the negotiated cipher suite.
+    std::string cipher() const;
 
    private:
-    explicit TLSSocket(std::unique_ptr< TCPSocket > tcp_socket, SSL* ssl);
+    explicit TLSSocket(std::unique_ptr< TCPSocket > tcp_socket, SSL* ssl, bool native_bio);
+
+    void check_ktls();
 
     SSL* _ssl{nullptr};
 
+    // OpenSSL's socket BIO, required for kTLS, writes without MSG_NOSIGNAL.
+    bool _native_bio{false};
+    bool _ktls_send{false};
+
     // Even if this member is not used, it is necessary to keep it alive
     // until the destructor is called.
     std::unique_ptr< TCPSocket > _tcp_socket;
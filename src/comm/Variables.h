@@ -4,18 +4,47 @@
 
 #pragma once
 
+#include <cstdint>
+
 namespace comm
 {
 
-const unsigned PROTOCOL_VERSION = 1;
+const unsigned PROTOCOL_VERSION        = 2;
+const unsigned LEGACY_PROTOCOL_VERSION = 1;  // Fixed-size HelloMessage
 
 const unsigned MAX_PORT_NUMBER = 65535;
 
 const unsigned MAX_CONN_QUEUE        = 2048;
 const unsigned MAX_RECV_TIMEOUT_SECS = 600;  // 10 mins should be plenty
 
+// Head start each address gets before the next one is tried, see RFC 8305.
+const unsigned CONNECTION_ATTEMPT_DELAY_MS = 250;
+
+const unsigned DEFAULT_RESOLVER_CACHE_TTL_SECS = 30;
+
 const unsigned MIN_BUFFER_SIZE     = 1024 * 1;            //   1KB
 const unsigned MAX_BUFFER_SIZE     = 1024 * 1024 * 1024;  //   1GB
 const unsigned DEFAULT_BUFFER_SIZE = 1024 * 1024 * 256;   // 256MB
 
+// Between peers that negotiated chunked messages, the high bit of a frame
+// header tells that the message goes on in the next frame.
+const uint32_t FRAME_CONTINUED = 0x80000000;
+const uint32_t FRAME_SIZE_MASK = 0x7fffffff;
+
+const unsigned MESSAGE_CHUNK_SIZE = 1024 * 1024 * 64;  //  64MB
+
+// Largest piece of a raw frame handed to a MessageSink at once.
+const unsigned STREAM_BUFFER_SIZE = 1024 * 1024 * 1;  //   1MB
+
+// Bytes an io_uring connection reads ahead of the caller, so that a frame
+// header and a small body come in through a single io_uring_enter().
+const unsigned IO_URING_READ_AHEAD_SIZE = 1024 * 64;  //  64KB
+
+// Capacity of each direction of a shared memory connection.
+const unsigned SHARED_MEMORY_RING_SIZE = 1024 * 1024 * 16;  //  16MB
+
+const unsigned DEFAULT_COMPRESSION_THRESHOLD = 1024;  // 1KB
+
+const unsigned DEFAULT_BUFFER_POOL_HIGH_WATER = 1024 * 1024 * 256;  // 256MB
+
 };  // namespace comm
@@ -0,0 +1,65 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#include "comm/WorkerPool.h"
+
+#include <algorithm>
+
+using namespace comm;
+
+WorkerPool::WorkerPool(unsigned number_of_threads)
+{
+    number_of_threads = std::max(1u, number_of_threads);
+
+    _threads.reserve(number_of_threads);
+
+    for (unsigned i = 0; i < number_of_threads; ++i) {
+        _threads.emplace_back(&WorkerPool::run, this);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard< std::mutex > lock(_mutex);
+        _stop = true;
+    }
+
+    _cv.notify_all();
+
+    for (auto& thread : _threads) {
+        thread.join();
+    }
+}
+
+void WorkerPool::submit(Task task)
+{
+    {
+        std::lock_guard< std::mutex > lock(_mutex);
+        _tasks.push_back(std::move(task));
+    }
+
+    _cv.notify_one();
+}
+
+void WorkerPool::run()
+{
+    while (true) {
+        Task task;
+
+        {
+            std::unique_lock< std::mutex > lock(_mutex);
+            _cv.wait(lock, [this]() { return _stop || !_tasks.empty(); });
+
+            if (_tasks.empty()) {
+                return;
+            }
+
+            task = std::move(_tasks.front());
+            _tasks.pop_front();
+        }
+
+        task();
+    }
+}
@@ -0,0 +1,44 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "util/Macros.h"
+
+namespace comm
+{
+
+// Fixed set of threads running tasks in submission order.
+// Destroying the pool runs the tasks already submitted, then joins.
+class WorkerPool
+{
+   public:
+    using Task = std::function< void() >;
+
+    explicit WorkerPool(unsigned number_of_threads);
+    ~WorkerPool();
+
+    NOT_COPYABLE(WorkerPool);
+    NOT_MOVEABLE(WorkerPool);
+
+    void submit(Task task);
+
+   private:
+    void run();
+
+    std::mutex _mutex{};
+    std::condition_variable _cv{};
+    std::deque< Task > _tasks{};
+    bool _stop{false};
+    std::vector< std::thread > _threads{};
+};
+
+};  // namespace comm
@@ -35,10 +35,7 @@ std::string AuthEnabledVDMSServer::random_string(size_t length)
 AuthEnabledVDMSServer::AuthEnabledVDMSServer(int port, AuthEnabledVDMSServerConfig config)
     : _server(port, config.connServerConfig)
 {
-    auto thread_function = [&]() {
-        std::shared_ptr< comm::Connection > server_conn =
-            _server.negotiate_protocol(_server.accept());
-
+    auto connection_function = [this, config](std::shared_ptr< comm::Connection > server_conn) {
         while (!_stop_signal) {
             protobufs::queryMessage protobuf_request;
 
@@ -85,6 +82,16 @@ AuthEnabledVDMSServer::AuthEnabledVDMSServer(int port, AuthEnabledVDMSServerConf
         }
     };
 
+    // Each connection is served by its own thread
+    auto thread_function = [this, config, connection_function]() {
+        for (int i = 0; i < config.number_of_connections; ++i) {
+            std::shared_ptr< comm::Connection > server_conn =
+                _server.negotiate_protocol(_server.accept());
+
+            _connection_threads.emplace_back(connection_function, std::move(server_conn));
+        }
+    };
+
     _work_thread = std::unique_ptr< std::thread >(new std::thread(thread_function));
 }
 
@@ -95,6 +102,10 @@ AuthEnabledVDMSServer::~AuthEnabledVDMSServer()
     if (_work_thread->joinable()) {
         _work_thread->join();
     }
+
+    for (auto& connection_thread : _connection_threads) {
+        connection_thread.join();
+    }
 }
 
 bool AuthEnabledVDMSServer::is_authenticate_request(const protobufs::queryMessage& protobuf_request)
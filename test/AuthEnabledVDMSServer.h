@@ -26,13 +26,16 @@ struct AuthEnabledVDMSServerConfig {
     comm::ConnServerConfig connServerConfig{};
     int32_t refresh_token_expires_in = 24 * 60 * 60;
     int32_t session_token_expires_in = 60 * 60;
+    int number_of_connections        = 1;
 
     AuthEnabledVDMSServerConfig(comm::ConnServerConfig connServerConfig_ = {},
                                 int32_t refresh_token_expires_in_        = 24 * 60 * 60,
-                                int32_t session_token_expires_in_        = 60 * 60)
+                                int32_t session_token_expires_in_        = 60 * 60,
+                                int number_of_connections_               = 1)
         : connServerConfig(std::move(connServerConfig_))
         , refresh_token_expires_in(refresh_token_expires_in_)
         , session_token_expires_in(session_token_expires_in_)
+        , number_of_connections(number_of_connections_)
     {
     }
 };
@@ -57,6 +60,7 @@ class AuthEnabledVDMSServer
 
     std::atomic< bool > _stop_signal{false};
     std::unique_ptr< std::thread > _work_thread{};
+    std::vector< std::thread > _connection_threads{};
     std::string session_token{};
     std::string refresh_token{};
 };
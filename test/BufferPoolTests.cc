@@ -0,0 +1,82 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#include <stdexcept>
+
+#include "gtest/gtest.h"
+
+#include "comm/BufferPool.h"
+
+class BufferPoolTests : public testing::Test
+{
+   protected:
+    void SetUp() override
+    {
+        high_water_mark = pool.high_water_mark();
+        pool.clear();
+    }
+
+    void TearDown() override
+    {
+        pool.set_high_water_mark(high_water_mark);
+        pool.clear();
+    }
+
+    comm::BufferPool& pool{comm::BufferPool::instance()};
+    std::size_t high_water_mark{};
+};
+
+TEST_F(BufferPoolTests, AcquireHasCapacity)
+{
+    for (std::size_t size : {0, 1, 1000, 1024, 1025, 300 * 1024, 5 * 1024 * 1024}) {
+        auto buffer = pool.acquire(size);
+        EXPECT_TRUE(buffer.empty());
+        EXPECT_GE(buffer.capacity(), size);
+    }
+}
+
+TEST_F(BufferPoolTests, ReleasedBufferIsReused)
+{
+    auto buffer = pool.acquire(100 * 1024);
+    buffer.resize(100 * 1024, 'x');
+    const auto* data = buffer.data();
+
+    pool.release(std::move(buffer));
+    EXPECT_GT(pool.pooled_bytes(), 0u);
+
+    auto reused = pool.acquire(90 * 1024);
+    EXPECT_EQ(data, reused.data());
+    EXPECT_TRUE(reused.empty());
+    EXPECT_EQ(0u, pool.pooled_bytes());
+}
+
+TEST_F(BufferPoolTests, HighWaterMark)
+{
+    pool.set_high_water_mark(3 * 1024 * 1024);
+
+    for (int i = 0; i < 4; ++i) {
+        pool.release(pool.acquire(1024 * 1024));
+        EXPECT_LE(pool.pooled_bytes(), pool.high_water_mark());
+    }
+
+    // Larger than the whole pool: not kept at all
+    pool.release(pool.acquire(4 * 1024 * 1024));
+    EXPECT_LE(pool.pooled_bytes(), pool.high_water_mark());
+
+    // Lowering the mark frees idle buffers
+    pool.set_high_water_mark(0);
+    EXPECT_EQ(0u, pool.pooled_bytes());
+}
+
+TEST_F(BufferPoolTests, LeaseReleasesOnException)
+{
+    try {
+        comm::BufferPool::Lease lease(100 * 1024);
+        lease.buffer().resize(100 * 1024, 'x');
+        throw std::runtime_error("sink failed");
+    } catch (const std::runtime_error&) {
+    }
+
+    EXPECT_GE(pool.pooled_bytes(), 100u * 1024);
+}
@@ -0,0 +1,290 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "comm/ConnClient.h"
+#include "comm/ConnServer.h"
+#include "comm/EventLoop.h"
+#include "comm/Exception.h"
+#include "comm/TLS.h"
+
+#define SERVER_PORT_EVENT_LOOP 43444
+#define NUMBER_OF_MESSAGES     20
+#define NUMBER_OF_CLIENTS      4
+
+typedef std::basic_string< uint8_t > BytesBuffer;
+
+namespace
+{
+
+BytesBuffer echo(const comm::Connection&, BytesBuffer& request) { return request; }
+
+// Runs an event loop over a server in the background.
+class EventLoopServer
+{
+   public:
+    EventLoopServer(comm::ConnServerConfig config,
+                    comm::RequestHandler handler,
+                    comm::EventLoopConfig loop_config = comm::EventLoopConfig(2))
+        : _server(SERVER_PORT_EVENT_LOOP, std::move(config))
+        , _loop(_server, std::move(handler), std::move(loop_config))
+        , _thread([this]() { _loop.run(); })
+    {
+    }
+
+    ~EventLoopServer()
+    {
+        _loop.stop();
+        _thread.join();
+    }
+
+    comm::EventLoop& loop() { return _loop; }
+
+   private:
+    comm::ConnServer _server;
+    comm::EventLoop _loop;
+    std::thread _thread;
+};
+
+}  // namespace
+
+// Several clients exchange messages with the same loop concurrently.
+TEST(EventLoopTests, ManyClients)
+{
+    EventLoopServer server(comm::ConnServerConfig{comm::Protocol::TCP}, echo);
+
+    std::vector< std::thread > clients;
+
+    for (int c = 0; c < NUMBER_OF_CLIENTS; ++c) {
+        clients.emplace_back([c]() {
+            comm::ConnClient conn_client({"localhost", SERVER_PORT_EVENT_LOOP},
+                                         comm::ConnClientConfig{comm::Protocol::TCP});
+
+            auto connection = conn_client.connect();
+
+            for (int i = 0; i < NUMBER_OF_MESSAGES; ++i) {
+                std::string message = "client " + std::to_string(c) + " message " +
+                                      std::to_string(i);
+
+                connection->send_message(reinterpret_cast< const uint8_t* >(message.data()),
+                                         message.size());
+
+                auto& received = connection->recv_message();
+                ASSERT_EQ(message,
+                          std::string(reinterpret_cast< const char* >(received.data()),
+                                      received.size()));
+            }
+        });
+    }
+
+    for (auto& client : clients) {
+        client.join();
+    }
+}
+
+// Compressed and raw frames both make it through the loop.
+TEST(EventLoopTests, Compressed)
+{
+    comm::ConnServerConfig server_config(comm::Protocol::TCP);
+    server_config.capabilities = comm::Capabilities(comm::Compression::Zstd);
+
+    EventLoopServer server(server_config, echo);
+
+    comm::ConnClientConfig client_config(comm::Protocol::TCP);
+    client_config.capabilities = comm::Capabilities(comm::Compression::Zstd);
+
+    comm::ConnClient conn_client({"localhost", SERVER_PORT_EVENT_LOOP}, client_config);
+
+    auto connection = conn_client.connect();
+
+    for (size_t size : {16, 256 * 1024}) {
+        BytesBuffer message(size, 'c');
+
+        connection->send_message(message.data(), message.size());
+        ASSERT_EQ(message, connection->recv_message());
+    }
+}
+
+// Requests and responses larger than the negotiated frame size are
+// reassembled from their chunks.
+TEST(EventLoopTests, ChunkedMessages)
+{
+    for (auto codec : {comm::Compression::None, comm::Compression::Zstd}) {
+        comm::ConnServerConfig server_config(comm::Protocol::TCP);
+        server_config.capabilities = comm::Capabilities(codec, 64 * 1024);
+
+        EventLoopServer server(server_config, echo);
+
+        comm::ConnClientConfig client_config(comm::Protocol::TCP);
+        client_config.capabilities = comm::Capabilities(codec);
+
+        comm::ConnClient conn_client({"localhost", SERVER_PORT_EVENT_LOOP}, client_config);
+
+        auto connection = conn_client.connect();
+
+        for (size_t size : {16, 64 * 1024, 1024 * 1024 + 3}) {
+            BytesBuffer message(size, 0);
+            for (size_t i = 0; i < size; ++i) {
+                message[i] = static_cast< uint8_t >(i / 16);
+            }
+
+            connection->send_message(message.data(), message.size());
+            ASSERT_EQ(message, connection->recv_message());
+        }
+    }
+}
+
+// Requests sent back-to-back over TLS are answered in order, including
+// some larger than a socket buffer.
+TEST(EventLoopTests, PipelinedTLS)
+{
+    auto certificates = generate_certificate();
+
+    EventLoopServer server(comm::ConnServerConfig{comm::Protocol::TLS,
+                                                  false,
+                                                  "",
+                                                  certificates.cert,
+                                                  certificates.private_key},
+                           echo);
+
+    comm::ConnClient conn_client({"localhost", SERVER_PORT_EVENT_LOOP},
+                                 comm::ConnClientConfig{comm::Protocol::TLS, "", false});
+
+    auto connection = conn_client.connect();
+
+    std::vector< BytesBuffer > messages;
+
+    for (int i = 0; i < NUMBER_OF_MESSAGES; ++i) {
+        size_t size = (i % 4 == 0) ? 4 * 1024 * 1024 : 16 + i;
+        messages.emplace_back(size, static_cast< uint8_t >('a' + i));
+    }
+
+    std::thread sender([&]() {
+        for (auto& message : messages) {
+            connection->send_message(message.data(), message.size());
+        }
+    });
+
+    for (auto& message : messages) {
+        auto& received = connection->recv_message();
+        ASSERT_EQ(message, received);
+    }
+
+    sender.join();
+}
+
+// A client that keeps sending without reading the responses is held back
+// by flow control once its queue is full, while other clients are served.
+TEST(EventLoopTests, SenderThatDoesNotRead)
+{
+    constexpr int number_of_requests = 64;
+
+    std::atomic< int > handled{0};
+
+    EventLoopServer server(comm::ConnServerConfig{comm::Protocol::TCP},
+                           [&handled](const comm::Connection& connection, BytesBuffer& request) {
+                               ++handled;
+                               return echo(connection, request);
+                           },
+                           comm::EventLoopConfig(2, 256, 4));
+
+    comm::ConnClient conn_client({"localhost", SERVER_PORT_EVENT_LOOP},
+                                 comm::ConnClientConfig{comm::Protocol::TCP});
+
+    auto connection = conn_client.connect();
+
+    BytesBuffer message(1024 * 1024, 'f');
+
+    std::thread sender([&]() {
+        for (int i = 0; i < number_of_requests; ++i) {
+            connection->send_message(message.data(), message.size());
+        }
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    // What socket buffers and the queue hold, but not all of it.
+    EXPECT_LT(handled, number_of_requests);
+
+    comm::ConnClient other_client({"localhost", SERVER_PORT_EVENT_LOOP},
+                                  comm::ConnClientConfig{comm::Protocol::TCP});
+
+    auto other = other_client.connect();
+
+    BytesBuffer ping(16, 'p');
+    other->send_message(ping.data(), ping.size());
+    EXPECT_EQ(ping, other->recv_message());
+
+    for (int i = 0; i < number_of_requests; ++i) {
+        EXPECT_EQ(message, connection->recv_message());
+    }
+
+    sender.join();
+
+    ASSERT_EQ(number_of_requests + 1, handled);
+}
+
+// A client that never says hello is dropped once the handshake times out,
+// and does not keep the only handshake thread from serving other clients.
+TEST(EventLoopTests, HandshakeTimeout)
+{
+    EventLoopServer server(
+        comm::ConnServerConfig{comm::Protocol::TCP},
+        echo,
+        comm::EventLoopConfig(2, 256, 16, 16, comm::HandshakeExecutorConfig(1, 200)));
+
+    int silent_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+
+    sockaddr_in address{};
+    address.sin_family      = AF_INET;
+    address.sin_port        = htons(SERVER_PORT_EVENT_LOOP);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    ASSERT_EQ(0, ::connect(silent_fd, reinterpret_cast< sockaddr* >(&address), sizeof(address)));
+
+    // The server hangs up on it.
+    uint8_t byte;
+    ASSERT_EQ(0, ::recv(silent_fd, &byte, sizeof(byte), 0));
+    ::close(silent_fd);
+
+    comm::ConnClient conn_client({"localhost", SERVER_PORT_EVENT_LOOP},
+                                 comm::ConnClientConfig{comm::Protocol::TCP});
+
+    auto connection = conn_client.connect();
+
+    BytesBuffer message(16, 'h');
+    connection->send_message(message.data(), message.size());
+    ASSERT_EQ(message, connection->recv_message());
+}
+
+// A handler that throws closes the connection it was serving.
+TEST(EventLoopTests, HandlerErrorClosesConnection)
+{
+    EventLoopServer server(comm::ConnServerConfig{comm::Protocol::TCP},
+                           [](const comm::Connection&, BytesBuffer&) -> BytesBuffer {
+                               throw std::runtime_error("handler failed");
+                           });
+
+    comm::ConnClient conn_client({"localhost", SERVER_PORT_EVENT_LOOP},
+                                 comm::ConnClientConfig{comm::Protocol::TCP});
+
+    auto connection = conn_client.connect();
+
+    std::string message("this request fails");
+    connection->send_message(reinterpret_cast< const uint8_t* >(message.data()), message.size());
+
+    ASSERT_THROW(connection->recv_message(), comm::Exception);
+}
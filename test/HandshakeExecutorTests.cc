@@ -0,0 +1,118 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "comm/ConnClient.h"
+#include "comm/ConnServer.h"
+#include "comm/HandshakeExecutor.h"
+
+#define SERVER_PORT_HANDSHAKE 43444
+
+typedef std::basic_string< uint8_t > BytesBuffer;
+
+namespace
+{
+
+// Opens a TCP connection to the server that never says hello.
+int connect_silent_client()
+{
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+
+    sockaddr_in address{};
+    address.sin_family      = AF_INET;
+    address.sin_port        = htons(SERVER_PORT_HANDSHAKE);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    EXPECT_EQ(0, ::connect(fd, reinterpret_cast< sockaddr* >(&address), sizeof(address)));
+
+    return fd;
+}
+
+}  // namespace
+
+// A client that stalls its handshake neither delays the clients accepted
+// after it, nor holds on to a thread past the timeout.
+TEST(HandshakeExecutorTests, SlowClientDoesNotBlock)
+{
+    std::string message("handshake");
+
+    comm::ConnServer server(SERVER_PORT_HANDSHAKE, comm::ConnServerConfig{comm::Protocol::TLS});
+    comm::HandshakeExecutor handshakes(server, comm::HandshakeExecutorConfig(2, 2000));
+
+    std::thread acceptor([&]() {
+        for (int i = 0; i < 2; ++i) {
+            handshakes.submit(server.accept());
+        }
+    });
+
+    int silent_fd = connect_silent_client();
+
+    comm::ConnClient conn_client({"localhost", SERVER_PORT_HANDSHAKE},
+                                 comm::ConnClientConfig{comm::Protocol::TLS});
+
+    std::thread client([&]() {
+        auto connection = conn_client.connect();
+
+        connection->send_message(reinterpret_cast< const uint8_t* >(message.data()),
+                                 message.length());
+        BytesBuffer message_received = connection->recv_message();
+        ASSERT_EQ(message, std::string(message_received.begin(), message_received.end()));
+    });
+
+    // Well before the silent client times out.
+    auto server_conn = handshakes.next(std::chrono::milliseconds(1500));
+    ASSERT_NE(nullptr, server_conn);
+
+    BytesBuffer message_received = server_conn->recv_message();
+    server_conn->send_message(message_received.data(), message_received.size());
+
+    client.join();
+    acceptor.join();
+
+    while (handshakes.pending() > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    ASSERT_EQ(1u, handshakes.failed());
+
+    ::close(silent_fd);
+}
+
+// stop() aborts handshakes in flight and wakes up next().
+TEST(HandshakeExecutorTests, Stop)
+{
+    comm::ConnServer server(SERVER_PORT_HANDSHAKE, comm::ConnServerConfig{comm::Protocol::TCP});
+    comm::HandshakeExecutor handshakes(server, comm::HandshakeExecutorConfig(1, 60000));
+
+    int silent_fd = connect_silent_client();
+
+    handshakes.submit(server.accept());
+
+    std::thread stopper([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        handshakes.stop();
+    });
+
+    ASSERT_EQ(nullptr, handshakes.next());
+
+    stopper.join();
+
+    while (handshakes.pending() > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    ASSERT_EQ(1u, handshakes.failed());
+
+    ::close(silent_fd);
+}
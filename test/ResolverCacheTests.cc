@@ -0,0 +1,84 @@
+/**
+ * @copyright Copyright (c) 2022 ApertureData Inc.
+ */
+
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "comm/Exception.h"
+#include "comm/ResolverCache.h"
+
+class ResolverCacheTests : public testing::Test
+{
+   protected:
+    void SetUp() override
+    {
+        ttl = cache.ttl();
+        cache.set_ttl(60);
+    }
+
+    void TearDown() override { cache.set_ttl(ttl); }
+
+    comm::ResolverCache& cache{comm::ResolverCache::instance()};
+    unsigned ttl{};
+};
+
+TEST_F(ResolverCacheTests, Hits)
+{
+    auto hits   = cache.hits();
+    auto misses = cache.misses();
+
+    auto addresses = cache.resolve("localhost", 1234);
+    ASSERT_FALSE(addresses.empty());
+    ASSERT_EQ(misses + 1, cache.misses());
+
+    std::vector< std::thread > threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&]() {
+            auto cached = cache.resolve("localhost", 1234);
+            ASSERT_EQ(addresses.size(), cached.size());
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    ASSERT_EQ(hits + 4, cache.hits());
+    ASSERT_EQ(misses + 1, cache.misses());
+    ASSERT_EQ(1u, cache.size());
+
+    // Ports are part of the address.
+    cache.resolve("localhost", 4321);
+    ASSERT_EQ(misses + 2, cache.misses());
+
+    cache.invalidate("localhost", 1234);
+    cache.resolve("localhost", 1234);
+    ASSERT_EQ(misses + 3, cache.misses());
+}
+
+TEST_F(ResolverCacheTests, Disabled)
+{
+    cache.set_ttl(0);
+
+    auto misses = cache.misses();
+
+    cache.resolve("localhost", 1234);
+    cache.resolve("localhost", 1234);
+
+    ASSERT_EQ(misses + 2, cache.misses());
+    ASSERT_EQ(0u, cache.size());
+}
+
+TEST_F(ResolverCacheTests, FailuresAreNotCached)
+{
+    auto misses = cache.misses();
+
+    ASSERT_THROW(cache.resolve("unreachable.com.ar.something", 5555), comm::Exception);
+    ASSERT_THROW(cache.resolve("unreachable.com.ar.something", 5555), comm::Exception);
+
+    ASSERT_EQ(misses + 2, cache.misses());
+    ASSERT_EQ(0u, cache.size());
+}
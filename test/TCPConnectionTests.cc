@@ -2,8 +2,19 @@
  * @copyright Copyright (c) 2021 ApertureData Inc.
  */
 
+#include <chrono>
+#include <cstdio>
+#include <memory>
 #include <string>
 #include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include "gtest/gtest.h"
 
@@ -11,7 +22,9 @@
 #include "comm/ConnClient.h"
 #include "comm/ConnServer.h"
 #include "comm/Exception.h"
+#include "comm/ShmConnection.h"
 #include "comm/TCPConnection.h"
+#include "comm/TCPSocket.h"
 
 #define SERVER_PORT_INTERCHANGE 43444
 #define SERVER_PORT_MULTIPLE    43444
@@ -173,6 +186,1061 @@ TEST(TCPConnectionTests, SendArrayInts)
     server_thread.join();
 }
 
+TEST(TCPConnectionTests, SendFragments)
+{
+    std::string header("query header");
+    std::string body(4 * 1024 * 1024, 'x');
+
+    Barrier barrier(2);
+
+    std::thread server_thread([&]() {
+        comm::ConnServer server(SERVER_PORT_INTERCHANGE);
+
+        barrier.wait();
+
+        auto server_conn = server.negotiate_protocol(server.accept());
+
+        // Fragments go out as a single message
+        server_conn->send_message(
+            {{reinterpret_cast< const uint8_t* >(header.data()), header.length()},
+             {nullptr, 0},
+             {reinterpret_cast< const uint8_t* >(body.data()), body.length()}});
+    });
+
+    comm::ConnClient conn_client({"localhost", SERVER_PORT_INTERCHANGE});
+
+    barrier.wait();
+
+    auto connection = conn_client.connect();
+
+    BytesBuffer message_received = connection->recv_message();
+    std::string recv_message(message_received.begin(), message_received.end());
+    ASSERT_EQ(header + body, recv_message);
+
+    server_thread.join();
+}
+
+TEST(TCPConnectionTests, SendFile)
+{
+    BytesBuffer content(3 * 1024 * 1024 + 17, 0);
+    for (size_t i = 0; i < content.size(); ++i) {
+        content[i] = static_cast< uint8_t >(i * 7);
+    }
+
+    FILE* file = std::tmpfile();
+    ASSERT_NE(nullptr, file);
+    ASSERT_EQ(content.size(), std::fwrite(content.data(), 1, content.size(), file));
+    std::fflush(file);
+
+    const off_t offset = 1000;
+
+    Barrier barrier(2);
+
+    std::thread server_thread([&]() {
+        comm::ConnServer server(SERVER_PORT_INTERCHANGE);
+
+        barrier.wait();
+
+        auto server_conn = server.negotiate_protocol(server.accept());
+
+        server_conn->send_file(fileno(file), offset, content.size() - offset);
+    });
+
+    comm::ConnClient conn_client({"localhost", SERVER_PORT_INTERCHANGE});
+
+    barrier.wait();
+
+    auto connection = conn_client.connect();
+
+    ASSERT_EQ(content.substr(offset), connection->recv_message());
+
+    server_thread.join();
+    std::fclose(file);
+}
+
+TEST(TCPConnectionTests, RecvIntoCallerBuffer)
+{
+    std::string server_to_client("this awesome library seems to work :)");
+
+    Barrier barrier(2);
+
+    std::thread server_thread([&]() {
+        comm::ConnServer server(SERVER_PORT_INTERCHANGE);
+
+        barrier.wait();
+
+        auto server_conn = server.negotiate_protocol(server.accept());
+
+        for (int i = 0; i < NUMBER_OF_MESSAGES; ++i) {
+            server_conn->send_message(reinterpret_cast< const uint8_t* >(server_to_client.c_str()),
+                                      server_to_client.length() - i);
+        }
+    });
+
+    comm::ConnClient conn_client({"localhost", SERVER_PORT_INTERCHANGE});
+
+    barrier.wait();
+
+    auto connection = conn_client.connect();
+
+    BytesBuffer message_received;
+
+    for (int i = 0; i < NUMBER_OF_MESSAGES; ++i) {
+        connection->recv_message(message_received);
+        std::string recv_message(message_received.begin(), message_received.end());
+        ASSERT_EQ(server_to_client.substr(0, server_to_client.length() - i), recv_message);
+    }
+
+    server_thread.join();
+}
+
+// Same exchange with io_uring enabled on both ends. Small messages come in
+// with their header, through a single io_uring_enter().
+TEST(TCPConnectionTests, SyncMessagesIoUring)
+{
+    if (!comm::IoUring::create()) {
+        GTEST_SKIP() << "io_uring is not available";
+    }
+
+    BytesBuffer client_to_server(64 * 1024, 'c');
+    BytesBuffer server_to_client(3 * 1024 * 1024, 's');
+    BytesBuffer small(16, 'm');
+
+    comm::ConnServerConfig server_config(comm::Protocol::TCP);
+    server_config.use_io_uring = true;
+
+    comm::ConnClientConfig client_config(comm::Protocol::TCP);
+    client_config.use_io_uring = true;
+
+    Barrier barrier(2);
+
+    std::thread server_thread([&]() {
+        comm::ConnServer server(SERVER_PORT_INTERCHANGE, server_config);
+
+        barrier.wait();
+
+        auto server_conn = server.negotiate_protocol(server.accept());
+
+        auto tcp_connection = dynamic_cast< comm::TCPConnection* >(server_conn.get());
+        ASSERT_NE(nullptr, tcp_connection);
+        ASSERT_TRUE(tcp_connection->io_uring_enabled());
+
+        for (int i = 0; i < NUMBER_OF_MESSAGES; ++i) {
+            ASSERT_EQ(client_to_server, server_conn->recv_message());
+
+            server_conn->send_message(server_to_client.data(), server_to_client.size());
+        }
+
+        for (int i = 0; i < NUMBER_OF_MESSAGES; ++i) {
+            ASSERT_EQ(small, server_conn->recv_message());
+
+            server_conn->send_message(small.data(), small.size());
+        }
+    });
+
+    comm::ConnClient conn_client({"localhost", SERVER_PORT_INTERCHANGE}, client_config);
+
+    barrier.wait();
+
+    auto connection = conn_client.connect();
+
+    auto tcp_connection = dynamic_cast< comm::TCPConnection* >(connection.get());
+    ASSERT_NE(nullptr, tcp_connection);
+    ASSERT_TRUE(tcp_connection->io_uring_enabled());
+
+    for (int i = 0; i < NUMBER_OF_MESSAGES; ++i) {
+        connection->send_message(client_to_server.data(), client_to_server.size());
+
+        ASSERT_EQ(server_to_client, connection->recv_message());
+    }
+
+    auto enters = tcp_connection->io_uring_enters();
+
+    // One to send, one to receive.
+    for (int i = 0; i < NUMBER_OF_MESSAGES; ++i) {
+        connection->send_message(small.data(), small.size());
+
+        ASSERT_EQ(small, connection->recv_message());
+    }
+
+    ASSERT_EQ(enters + 2 * NUMBER_OF_MESSAGES, tcp_connection->io_uring_enters());
+
+    server_thread.join();
+}
+
+// Both ends settle on the capabilities they have in common.
+TEST(TCPConnectionTests, Capabilities)
+{
+    comm::ConnServerConfig server_config(comm::Protocol::TCP);
+    server_config.capabilities = comm::Capabilities(comm::Compression::Zstd, 1024 * 1024, 0, 1000);
+
+    comm::ConnClientConfig client_config(comm::Protocol::TCP);
+    client_config.capabilities =
+        comm::Capabilities(comm::Compression::Zstd | comm::Compression::LZ4, 64 * 1024 * 1024, 8);
+
+    auto check = [](const comm::Capabilities& capabilities) {
+        ASSERT_EQ(comm::Compression::Zstd, capabilities.compression);
+        ASSERT_EQ(1024u * 1024u, capabilities.max_frame_size);
+        ASSERT_EQ(8u, capabilities.pipelining_depth);
+        ASSERT_EQ(1000u, capabilities.keepalive_ms);
+        ASSERT_TRUE(capabilities.chunked_messages);
+    };
+
+    Barrier barrier(2);
+
+    std::thread server_thread([&]() {
+        comm::ConnServer server(SERVER_PORT_INTERCHANGE, server_config);
+
+        barrier.wait();
+
+        auto server_conn = server.negotiate_protocol(server.accept());
+        check(server_conn->capabilities());
+
+        // Over the maximum message size.
+        server_conn->set_max_message_size(1024 * 1024);
+        BytesBuffer large(2 * 1024 * 1024, 'x');
+        ASSERT_THROW(server_conn->send_message(large.data(), large.size()), comm::Exception);
+
+        BytesBuffer message_received = server_conn->recv_message();
+        server_conn->send_message(message_received.data(), message_received.size());
+    });
+
+    comm::ConnClient conn_client({"localhost", SERVER_PORT_INTERCHANGE}, client_config);
+
+    barrier.wait();
+
+    auto connection = conn_client.connect();
+    check(connection->capabilities());
+
+    BytesBuffer message(16, 'y');
+    connection->send_message(message.data(), message.size());
+    ASSERT_EQ(message, connection->recv_message());
+
+    server_thread.join();
+}
+
+namespace
+{
+
+class ByteCounter : public comm::ConnMetrics
+{
+   public:
+    void observe_bytes_sent(std::size_t bytes_sent) override
+    {
+        sent += bytes_sent;
+        ++frames;
+    }
+
+    std::size_t sent{0};
+    std::size_t frames{0};
+};
+
+}  // namespace
+
+// Messages are compressed with the negotiated codec, except those too small
+// or already compressed.
+TEST(TCPConnectionTests, Compression)
+{
+    std::string json;
+
+    while (json.size() < 64 * 1024) {
+        json += R"({"AddEntity": {"class": "Person", "properties": {"id": )" +
+                std::to_string(json.size()) + "}}},";
+    }
+
+    BytesBuffer large(json.begin(), json.end());
+    BytesBuffer small(100, 'a');
+    BytesBuffer jpeg(64 * 1024, 'b');
+    jpeg[0] = 0xff;
+    jpeg[1] = 0xd8;
+    jpeg[2] = 0xff;
+
+    for (auto codec : {comm::Compression::Zstd, comm::Compression::LZ4}) {
+        comm::ConnServerConfig server_config(comm::Protocol::TCP);
+        server_config.capabilities = comm::Capabilities(codec | comm::Compression::LZ4);
+
+        ByteCounter counter;
+        comm::ConnClientConfig client_config(comm::Protocol::TCP, "", false, &counter);
+        client_config.capabilities = comm::Capabilities(codec);
+
+        Barrier barrier(2);
+
+        std::thread server_thread([&]() {
+            comm::ConnServer server(SERVER_PORT_INTERCHANGE, server_config);
+
+            barrier.wait();
+
+            auto server_conn = server.negotiate_protocol(server.accept());
+            ASSERT_EQ(codec, server_conn->capabilities().compression);
+
+            for (int i = 0; i < 3; ++i) {
+                BytesBuffer message_received = server_conn->recv_message();
+                server_conn->send_message(message_received.data(), message_received.size());
+            }
+        });
+
+        comm::ConnClient conn_client({"localhost", SERVER_PORT_INTERCHANGE}, client_config);
+
+        barrier.wait();
+
+        auto connection = conn_client.connect();
+
+        auto exchange = [&](const BytesBuffer& message) {
+            auto sent_before = counter.sent;
+
+            connection->send_message(message.data(), message.size());
+            EXPECT_EQ(message, connection->recv_message());
+
+            return counter.sent - sent_before;
+        };
+
+        ASSERT_LT(exchange(large), large.size() / 4);
+
+        // Raw, behind the codec byte.
+        ASSERT_EQ(small.size() + 1, exchange(small));
+        ASSERT_EQ(jpeg.size() + 1, exchange(jpeg));
+
+        server_thread.join();
+    }
+}
+
+// Messages larger than the negotiated frame size go out in several frames,
+// compressed or not, and come back whole.
+TEST(TCPConnectionTests, ChunkedMessages)
+{
+    const size_t max_frame_size = 64 * 1024;
+
+    BytesBuffer content(max_frame_size * 10 + 17, 0);
+    for (size_t i = 0; i < content.size(); ++i) {
+        content[i] = static_cast< uint8_t >(i / 8);
+    }
+
+    FILE* file = std::tmpfile();
+    ASSERT_NE(nullptr, file);
+    ASSERT_EQ(content.size(), std::fwrite(content.data(), 1, content.size(), file));
+    std::fflush(file);
+
+    for (auto codec : {comm::Compression::None, comm::Compression::LZ4}) {
+        comm::ConnServerConfig server_config(comm::Protocol::TCP);
+        server_config.capabilities = comm::Capabilities(codec, max_frame_size);
+
+        ByteCounter counter;
+        comm::ConnClientConfig client_config(comm::Protocol::TCP, "", false, &counter);
+        client_config.capabilities = comm::Capabilities(codec);
+
+        Barrier barrier(2);
+
+        std::thread server_thread([&]() {
+            comm::ConnServer server(SERVER_PORT_INTERCHANGE, server_config);
+
+            barrier.wait();
+
+            auto server_conn = server.negotiate_protocol(server.accept());
+
+            BytesBuffer message_received = server_conn->recv_message();
+            server_conn->send_message({{message_received.data(), 1000},
+                                       {message_received.data() + 1000,
+                                        message_received.size() - 1000}});
+
+            server_conn->send_file(fileno(file), 0, content.size());
+        });
+
+        comm::ConnClient conn_client({"localhost", SERVER_PORT_INTERCHANGE}, client_config);
+
+        barrier.wait();
+
+        auto connection = conn_client.connect();
+        ASSERT_TRUE(connection->capabilities().chunked_messages);
+
+        auto frames_before = counter.frames;
+        connection->send_message(content.data(), content.size());
+        ASSERT_EQ(11u, counter.frames - frames_before);
+
+        ASSERT_EQ(content, connection->recv_message());
+
+        // Streamed, a frame holds at most one piece.
+        BytesBuffer streamed;
+        size_t pieces = 0;
+
+        connection->recv_message([&](const uint8_t* data, size_t size) {
+            streamed.append(data, size);
+            ++pieces;
+        });
+
+        ASSERT_EQ(content, streamed);
+        ASSERT_LE(11u, pieces);
+
+        server_thread.join();
+    }
+
+    std::fclose(file);
+}
+
+// Chunked messages are held to the maximum buffer size unless the server
+// opts into more, whatever the frame size.
+TEST(TCPConnectionTests, ChunkedMessageLimit)
+{
+    comm::ConnServerConfig server_config(comm::Protocol::TCP);
+    server_config.capabilities     = comm::Capabilities(comm::Compression::None, 64 * 1024);
+    server_config.max_message_size = 1024 * 1024;
+
+    Barrier barrier(2);
+
+    std::thread server_thread([&]() {
+        comm::ConnServer server(SERVER_PORT_INTERCHANGE, server_config);
+
+        barrier.wait();
+
+        auto server_conn = server.negotiate_protocol(server.accept());
+
+        BytesBuffer message_received = server_conn->recv_message();
+        ASSERT_EQ(1024u * 1024u, message_received.size());
+
+        try {
+            server_conn->recv_message();
+            FAIL() << "Message over the limit received";
+        } catch (const comm::Exception& e) {
+            ASSERT_EQ(comm::InvalidMessageSize, e.num);
+        }
+    });
+
+    comm::ConnClient conn_client({"localhost", SERVER_PORT_INTERCHANGE},
+                                 comm::ConnClientConfig(comm::Protocol::TCP));
+
+    barrier.wait();
+
+    auto connection = conn_client.connect();
+    ASSERT_TRUE(connection->capabilities().chunked_messages);
+    ASSERT_EQ(256u * 1024 * 1024, connection->max_message_size());
+
+    BytesBuffer message(1024 * 1024, 'x');
+    connection->send_message(message.data(), message.size());
+
+    // The server gives up, and hangs up, partway through.
+    message.push_back('x');
+    try {
+        connection->send_message(message.data(), message.size());
+    } catch (const comm::Exception&) {
+    }
+
+    server_thread.join();
+}
+
+// Clients opt into larger chunked messages the same way.
+TEST(TCPConnectionTests, ClientMessageLimit)
+{
+    Barrier barrier(2);
+
+    std::thread server_thread([&]() {
+        comm::ConnServer server(SERVER_PORT_INTERCHANGE);
+
+        barrier.wait();
+
+        auto server_conn = server.negotiate_protocol(server.accept());
+        ASSERT_EQ(256u * 1024 * 1024, server_conn->max_message_size());
+    });
+
+    comm::ConnClientConfig client_config(comm::Protocol::TCP);
+    client_config.max_message_size = 1024ul * 1024 * 1024 * 4;
+
+    comm::ConnClient conn_client({"localhost", SERVER_PORT_INTERCHANGE}, client_config);
+
+    barrier.wait();
+
+    auto connection = conn_client.connect();
+    ASSERT_EQ(1024ul * 1024 * 1024 * 4, connection->max_message_size());
+
+    server_thread.join();
+}
+
+// What a version 1 peer sends: {version = 1, protocol = TCP}.
+static const BytesBuffer LEGACY_HELLO = {1, 0, 0, 0, 1, 0, 0, 0};
+
+// A server still speaks to clients sending the version 1 hello.
+TEST(TCPConnectionTests, LegacyClient)
+{
+    Barrier barrier(2);
+
+    std::thread server_thread([&]() {
+        comm::ConnServer server(SERVER_PORT_INTERCHANGE);
+
+        barrier.wait();
+
+        auto server_conn = server.negotiate_protocol(server.accept());
+
+        BytesBuffer message_received = server_conn->recv_message();
+        server_conn->send_message(message_received.data(), message_received.size());
+    });
+
+    barrier.wait();
+
+    auto tcp_socket = comm::TCPSocket::create();
+    ASSERT_TRUE(tcp_socket->connect({"localhost", SERVER_PORT_INTERCHANGE}));
+
+    comm::TCPConnection connection(std::move(tcp_socket));
+    connection.send_message(LEGACY_HELLO.data(), LEGACY_HELLO.size());
+    ASSERT_EQ(LEGACY_HELLO, connection.recv_message());
+
+    BytesBuffer message(16, 'y');
+    connection.send_message(message.data(), message.size());
+    ASSERT_EQ(message, connection.recv_message());
+
+    server_thread.join();
+}
+
+// A client falls back to the version 1 hello when the server hangs up on
+// the extensible one, as version 1 servers do.
+TEST(TCPConnectionTests, LegacyServer)
+{
+    Barrier barrier(2);
+
+    std::thread server_thread([&]() {
+        comm::ConnServer server(SERVER_PORT_INTERCHANGE);
+
+        barrier.wait();
+
+        {
+            auto rejected = server.accept();
+            ASSERT_NE(LEGACY_HELLO.size(), rejected->recv_message().size());
+        }
+
+        auto server_conn = server.accept();
+        ASSERT_EQ(LEGACY_HELLO, server_conn->recv_message());
+        server_conn->send_message(LEGACY_HELLO.data(), LEGACY_HELLO.size());
+
+        BytesBuffer message_received = server_conn->recv_message();
+        server_conn->send_message(message_received.data(), message_received.size());
+    });
+
+    comm::ConnClientConfig client_config(comm::Protocol::TCP);
+    client_config.capabilities = comm::Capabilities(comm::Compression::Zstd);
+
+    comm::ConnClient conn_client({"localhost", SERVER_PORT_INTERCHANGE}, client_config);
+
+    barrier.wait();
+
+    auto connection = conn_client.connect();
+    ASSERT_EQ(comm::Compression::None, connection->capabilities().compression);
+
+    BytesBuffer message(16, 'y');
+    connection->send_message(message.data(), message.size());
+    ASSERT_EQ(message, connection->recv_message());
+
+    server_thread.join();
+}
+
+// A server that answers part of a hello and hangs up is not taken for a
+// version 1 one, and neither is any server once the fallback is turned off.
+TEST(TCPConnectionTests, LegacyFallbackLimits)
+{
+    auto listening_socket = comm::TCPSocket::create();
+    ASSERT_TRUE(listening_socket->set_boolean_option(SOL_SOCKET, SO_REUSEADDR, true));
+    ASSERT_TRUE(listening_socket->bind(SERVER_PORT_INTERCHANGE));
+    ASSERT_TRUE(listening_socket->listen());
+
+    for (bool cut_short : {true, false}) {
+        std::thread server_thread([&]() {
+            auto server_socket = comm::TCPSocket::accept(listening_socket);
+            int fd             = server_socket->native_handle();
+            comm::TCPConnection server_conn(std::move(server_socket));
+            server_conn.recv_message();
+
+            if (cut_short) {
+                uint8_t header[2] = {8, 0};
+                ASSERT_EQ(2, ::write(fd, header, sizeof(header)));
+            }
+        });
+
+        comm::ConnClientConfig client_config(comm::Protocol::TCP);
+        client_config.legacy_fallback = cut_short;
+
+        comm::ConnClient conn_client({"localhost", SERVER_PORT_INTERCHANGE}, client_config);
+
+        try {
+            conn_client.connect(comm::Deadline::after(std::chrono::seconds(5)));
+            FAIL() << "Connected to a server that hung up";
+        } catch (const comm::Exception& e) {
+            ASSERT_EQ(comm::ConnectionShutDown, e.num);
+        }
+
+        server_thread.join();
+    }
+}
+
+// Sockets accepted by a tuned listening socket are tuned the same way.
+TEST(TCPConnectionTests, SocketTuning)
+{
+    comm::SocketTuning tuning;
+    tuning.send_buffer_size    = 64 * 1024;
+    tuning.receive_buffer_size = 96 * 1024;
+    tuning.notsent_lowat       = 16 * 1024;
+    tuning.cork                = true;
+
+    auto option = [](const comm::TCPSocket& socket, int level, int option_name) {
+        int value        = 0;
+        socklen_t length = sizeof(value);
+        getsockopt(socket.native_handle(), level, option_name, &value, &length);
+        return value;
+    };
+
+    auto check = [&](const comm::TCPSocket& socket) {
+        // The kernel reports twice the requested buffer sizes.
+        ASSERT_EQ(2 * 64 * 1024, option(socket, SOL_SOCKET, SO_SNDBUF));
+        ASSERT_EQ(2 * 96 * 1024, option(socket, SOL_SOCKET, SO_RCVBUF));
+        ASSERT_EQ(16 * 1024, option(socket, IPPROTO_TCP, TCP_NOTSENT_LOWAT));
+    };
+
+    auto listening_socket = comm::TCPSocket::create();
+    ASSERT_TRUE(listening_socket->set_boolean_option(SOL_SOCKET, SO_REUSEADDR, true));
+    listening_socket->tune(tuning);
+    ASSERT_TRUE(listening_socket->bind(SERVER_PORT_INTERCHANGE));
+    ASSERT_TRUE(listening_socket->listen());
+
+    auto client_socket = comm::TCPSocket::create();
+    client_socket->tune(tuning);
+    ASSERT_TRUE(client_socket->connect({"localhost", SERVER_PORT_INTERCHANGE}));
+    check(*client_socket);
+
+    auto server_socket = comm::TCPSocket::accept(listening_socket);
+    check(*server_socket);
+
+    server_socket->cork(true);
+    ASSERT_EQ(1, option(*server_socket, IPPROTO_TCP, TCP_CORK));
+    server_socket->cork(false);
+    ASSERT_EQ(0, option(*server_socket, IPPROTO_TCP, TCP_CORK));
+
+    // Bandwidth-delay product of 10Gb/s over a 1ms round trip.
+    auto throughput = comm::SocketTuning::high_throughput(10000000000ull, 1000);
+    ASSERT_EQ(1250000u, throughput.send_buffer());
+    ASSERT_EQ(1250000u, throughput.receive_buffer());
+
+    // 1Gb/s over a 1ms round trip is left to autotuning, which goes above
+    // 125KB with the kernel defaults.
+    auto untuned_socket = comm::TCPSocket::create();
+    auto default_size   = option(*untuned_socket, SOL_SOCKET, SO_RCVBUF);
+
+    auto autotuned_socket = comm::TCPSocket::create();
+    autotuned_socket->tune(comm::SocketTuning::high_throughput(1000000000ull, 1000));
+    ASSERT_EQ(default_size, option(*autotuned_socket, SOL_SOCKET, SO_RCVBUF));
+}
+
+// Clients on the same host can go through a Unix domain socket, with the
+// same handshake, over plain TCP framing or TLS.
+TEST(TCPConnectionTests, UnixSocket)
+{
+    std::string path = "/tmp/comm_test_" + std::to_string(::getpid()) + ".sock";
+
+    for (auto protocol : {comm::Protocol::TCP, comm::Protocol::TLS}) {
+        comm::ConnServerConfig server_config(protocol);
+        server_config.unix_socket_path = path;
+
+        Barrier barrier(2);
+
+        std::thread server_thread([&]() {
+            comm::ConnServer server(0, server_config);
+
+            barrier.wait();
+
+            auto server_conn = server.negotiate_protocol(server.accept());
+            ASSERT_EQ(AF_UNIX, server_conn->get_source_family());
+            ASSERT_EQ("unix", server_conn->source_family_name(server_conn->get_source_family()));
+
+            for (int i = 0; i < NUMBER_OF_MESSAGES; ++i) {
+                BytesBuffer message_received = server_conn->recv_message();
+                server_conn->send_message(message_received.data(), message_received.size());
+            }
+        });
+
+        comm::ConnClient conn_client({comm::UNIX_ADDRESS_PREFIX + path, 0},
+                                     comm::ConnClientConfig(protocol));
+
+        barrier.wait();
+
+        auto connection = conn_client.connect();
+        ASSERT_TRUE(connection->is_open());
+
+        for (int i = 0; i < NUMBER_OF_MESSAGES; ++i) {
+            BytesBuffer message(16 + i * 1024, static_cast< uint8_t >('a' + i));
+            connection->send_message(message.data(), message.size());
+            ASSERT_EQ(message, connection->recv_message());
+        }
+
+        server_thread.join();
+
+        // The server removes its socket when it goes away.
+        ASSERT_NE(0, ::access(path.c_str(), F_OK));
+    }
+}
+
+// A socket left behind by a server that is gone is replaced, but not the
+// socket of one still running.
+TEST(TCPConnectionTests, UnixSocketInUse)
+{
+    std::string path = "/tmp/comm_test_" + std::to_string(::getpid()) + ".sock";
+
+    {
+        auto stale_socket = comm::TCPSocket::create(AF_UNIX);
+        ASSERT_TRUE(stale_socket->bind(path));
+        ASSERT_TRUE(stale_socket->listen());
+    }
+    ASSERT_EQ(0, ::access(path.c_str(), F_OK));
+
+    comm::ConnServerConfig server_config(comm::Protocol::TCP);
+    server_config.unix_socket_path = path;
+
+    comm::ConnServer server(0, server_config);
+
+    ASSERT_THROW(comm::ConnServer(0, server_config), comm::Exception);
+
+    auto client_socket = comm::TCPSocket::create(AF_UNIX);
+    ASSERT_TRUE(client_socket->connect({comm::UNIX_ADDRESS_PREFIX + path, 0}));
+}
+
+TEST(TCPConnectionTests, SharedMemory)
+{
+    std::string path = "/tmp/comm_test_" + std::to_string(::getpid()) + ".sock";
+
+    // Larger than a ring, so that both sides have to wait on each other.
+    BytesBuffer content(40 * 1024 * 1024 + 17, 0);
+    for (size_t i = 0; i < content.size(); ++i) {
+        content[i] = static_cast< uint8_t >(i * 7);
+    }
+
+    FILE* file = std::tmpfile();
+    ASSERT_NE(nullptr, file);
+    ASSERT_EQ(content.size(), std::fwrite(content.data(), 1, content.size(), file));
+    std::fflush(file);
+
+    comm::ConnServerConfig server_config;
+    server_config.unix_socket_path  = path;
+    server_config.use_shared_memory = true;
+
+    Barrier barrier(2);
+
+    std::thread server_thread([&]() {
+        comm::ConnServer server(0, server_config);
+
+        barrier.wait();
+
+        auto server_conn = server.negotiate_protocol(server.accept());
+        ASSERT_TRUE(server_conn->capabilities().shared_memory);
+        ASSERT_EQ(AF_UNIX, server_conn->get_source_family());
+
+        for (int i = 0; i < NUMBER_OF_MESSAGES; ++i) {
+            BytesBuffer message_received = server_conn->recv_message();
+            server_conn->send_message(message_received.data(), message_received.size());
+        }
+
+        ASSERT_EQ(content, server_conn->recv_message());
+        server_conn->send_file(fileno(file), 0, content.size());
+    });
+
+    comm::ConnClientConfig client_config;
+    client_config.use_shared_memory = true;
+
+    comm::ConnClient conn_client({comm::UNIX_ADDRESS_PREFIX + path, 0}, client_config);
+
+    barrier.wait();
+
+    auto connection = conn_client.connect();
+    ASSERT_TRUE(connection->capabilities().shared_memory);
+    ASSERT_TRUE(connection->is_open());
+
+    for (int i = 0; i < NUMBER_OF_MESSAGES; ++i) {
+        BytesBuffer message(16 + i * 1024, static_cast< uint8_t >('a' + i));
+        connection->send_message(message.data(), message.size());
+        ASSERT_EQ(message, connection->recv_message());
+    }
+
+    // Nothing is on its way yet.
+    connection->set_deadline(comm::Deadline::after(std::chrono::milliseconds(50)));
+    ASSERT_THROW(connection->recv_message(), comm::Exception);
+    connection->set_deadline({});
+
+    connection->send_message(content.data(), content.size());
+    ASSERT_EQ(content, connection->recv_message());
+
+    server_thread.join();
+    std::fclose(file);
+
+    // The server hung up, which wakes up a waiting reader.
+    ASSERT_THROW(connection->recv_message(), comm::Exception);
+}
+
+// The server only maps a memfd the client can no longer resize, and only
+// waits on eventfds.
+TEST(TCPConnectionTests, SharedMemoryUntrusted)
+{
+    std::string path = "/tmp/comm_test_" + std::to_string(::getpid()) + ".sock";
+
+    auto listening_socket = comm::TCPSocket::create(AF_UNIX);
+    ASSERT_TRUE(listening_socket->bind(path));
+    ASSERT_TRUE(listening_socket->listen());
+
+    auto exchange = [&](const int (&fds)[5]) {
+        auto client_socket = comm::TCPSocket::create(AF_UNIX);
+        ASSERT_TRUE(client_socket->connect({comm::UNIX_ADDRESS_PREFIX + path, 0}));
+        ASSERT_TRUE(client_socket->send_fds(fds, 5));
+
+        try {
+            comm::ShmConnection::accept(comm::TCPSocket::accept(listening_socket));
+            FAIL() << "Untrusted shared memory accepted";
+        } catch (const comm::Exception& e) {
+            ASSERT_EQ(comm::ProtocolError, e.num);
+        }
+    };
+
+    int pipe_fds[2];
+    ASSERT_EQ(0, ::pipe(pipe_fds));
+
+    int unsealed = ::memfd_create("comm_test", MFD_CLOEXEC);
+    ASSERT_EQ(0, ::ftruncate(unsealed, 1024 * 1024));
+
+    int sealed = ::memfd_create("comm_test", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    ASSERT_EQ(0, ::ftruncate(sealed, 1024 * 1024));
+    ASSERT_EQ(0, ::fcntl(sealed, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL));
+
+    int event_fd = ::eventfd(0, EFD_CLOEXEC);
+
+    exchange({unsealed, event_fd, event_fd, event_fd, event_fd});
+    exchange({sealed, event_fd, pipe_fds[0], event_fd, event_fd});
+
+    for (auto fd : {pipe_fds[0], pipe_fds[1], unsealed, sealed, event_fd}) {
+        ::close(fd);
+    }
+
+    ::unlink(path.c_str());
+}
+
+TEST(TCPConnectionTests, ConnectIPv6)
+{
+    int listening = ::socket(AF_INET6, SOCK_STREAM, 0);
+    ASSERT_LE(0, listening);
+
+    sockaddr_in6 address{};
+    address.sin6_family = AF_INET6;
+    address.sin6_addr   = in6addr_loopback;
+    socklen_t length    = sizeof(address);
+
+    if (::bind(listening, reinterpret_cast< sockaddr* >(&address), length) != 0) {
+        ::close(listening);
+        GTEST_SKIP() << "No IPv6 loopback";
+    }
+
+    ASSERT_EQ(0, ::listen(listening, 1));
+    ASSERT_EQ(0, ::getsockname(listening, reinterpret_cast< sockaddr* >(&address), &length));
+
+    // Options set beforehand carry over to the socket that connects.
+    auto socket = comm::TCPSocket::create();
+    ASSERT_TRUE(socket->set_boolean_option(IPPROTO_TCP, TCP_NODELAY, true));
+    ASSERT_TRUE(socket->connect({"::1", ntohs(address.sin6_port)}, 1000));
+    ASSERT_EQ(AF_INET6, socket->family());
+    ASSERT_EQ("::1", socket->print_source());
+
+    int nodelay       = 0;
+    socklen_t opt_len = sizeof(nodelay);
+    ASSERT_EQ(0,
+              ::getsockopt(socket->native_handle(), IPPROTO_TCP, TCP_NODELAY, &nodelay, &opt_len));
+    ASSERT_EQ(1, nodelay);
+
+    ::close(listening);
+}
+
+TEST(TCPConnectionTests, ConnectTimeout)
+{
+    // Not routed anywhere; without a timeout the kernel retries for minutes.
+    auto socket = comm::TCPSocket::create();
+    auto start  = std::chrono::steady_clock::now();
+
+    ASSERT_FALSE(socket->connect({"10.255.255.1", 9}, 200));
+    ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(2));
+
+    // A Unix domain socket waits while the server's backlog is full.
+    std::string path = "/tmp/comm_test_" + std::to_string(::getpid()) + ".sock";
+
+    auto listening_socket = comm::TCPSocket::create(AF_UNIX);
+    ASSERT_TRUE(listening_socket->bind(path));
+    ASSERT_EQ(0, ::listen(listening_socket->native_handle(), 0));
+
+    std::vector< std::unique_ptr< comm::TCPSocket > > queued;
+    int errno_r = 0;
+
+    for (int i = 0; i < 4 && errno_r != ETIMEDOUT; ++i) {
+        queued.push_back(comm::TCPSocket::create(AF_UNIX));
+
+        start = std::chrono::steady_clock::now();
+        if (!queued.back()->connect({comm::UNIX_ADDRESS_PREFIX + path, 0}, 200)) {
+            errno_r = errno;
+        }
+    }
+
+    ASSERT_EQ(ETIMEDOUT, errno_r);
+    ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(2));
+
+    ::unlink(path.c_str());
+}
+
+TEST(TCPConnectionTests, Deadlines)
+{
+    const std::chrono::milliseconds timeout(100);
+
+    for (auto protocol : {comm::Protocol::TCP, comm::Protocol::TLS}) {
+        Barrier barrier(2);
+        Barrier done(2);
+
+        std::thread server_thread([&]() {
+            comm::ConnServer server(SERVER_PORT_INTERCHANGE, comm::ConnServerConfig(protocol));
+
+            barrier.wait();
+
+            // Leaves the first client hanging in the handshake.
+            auto silent = server.accept();
+
+            auto server_conn = server.negotiate_protocol(server.accept());
+
+            BytesBuffer message_received = server_conn->recv_message();
+            server_conn->send_message(message_received.data(), message_received.size());
+
+            done.wait();
+        });
+
+        barrier.wait();
+
+        comm::ConnClient silent_client({"localhost", SERVER_PORT_INTERCHANGE},
+                                       comm::ConnClientConfig(protocol));
+
+        auto start = std::chrono::steady_clock::now();
+
+        try {
+            silent_client.connect(comm::Deadline::after(timeout));
+            FAIL() << "Connected to a server that never answered";
+        } catch (const comm::Exception& e) {
+            ASSERT_EQ(comm::Timeout, e.num);
+        }
+
+        ASSERT_LT(std::chrono::steady_clock::now() - start, 10 * timeout);
+
+        comm::ConnClient conn_client({"localhost", SERVER_PORT_INTERCHANGE},
+                                     comm::ConnClientConfig(protocol));
+
+        auto connection = conn_client.connect(comm::Deadline::after(std::chrono::seconds(5)));
+
+        // Met...
+        connection->set_deadline(comm::Deadline::after(std::chrono::seconds(5)));
+
+        BytesBuffer message(16, 'd');
+        connection->send_message(message.data(), message.size());
+        ASSERT_EQ(message, connection->recv_message());
+
+        // ...and missed, as the server has nothing more to say.
+        connection->set_deadline(comm::Deadline::after(timeout));
+
+        start = std::chrono::steady_clock::now();
+
+        try {
+            connection->recv_message();
+            FAIL() << "Received a message that was never sent";
+        } catch (const comm::Exception& e) {
+            ASSERT_EQ(comm::Timeout, e.num);
+        }
+
+        ASSERT_LT(std::chrono::steady_clock::now() - start, 10 * timeout);
+
+        done.wait();
+        server_thread.join();
+    }
+}
+
+// A Timeout partway through a message shuts the connection down, as the
+// rest of that message would be read as the next one.
+TEST(TCPConnectionTests, DeadlineMidMessage)
+{
+    auto listening_socket = comm::TCPSocket::create();
+    ASSERT_TRUE(listening_socket->set_boolean_option(SOL_SOCKET, SO_REUSEADDR, true));
+    ASSERT_TRUE(listening_socket->bind(SERVER_PORT_INTERCHANGE));
+    ASSERT_TRUE(listening_socket->listen());
+
+    auto client_socket = comm::TCPSocket::create();
+    ASSERT_TRUE(client_socket->connect({"localhost", SERVER_PORT_INTERCHANGE}));
+    comm::TCPConnection connection(std::move(client_socket));
+
+    auto server_socket = comm::TCPSocket::accept(listening_socket);
+
+    // The header of a 100 byte frame, and the first 10 bytes of it.
+    uint32_t header = 100;
+    BytesBuffer partial(reinterpret_cast< const uint8_t* >(&header), sizeof(header));
+    partial.append(10, 'p');
+    ASSERT_EQ(static_cast< ssize_t >(partial.size()),
+              ::write(server_socket->native_handle(), partial.data(), partial.size()));
+
+    connection.set_deadline(comm::Deadline::after(std::chrono::milliseconds(100)));
+
+    try {
+        connection.recv_message();
+        FAIL() << "Received a message that was never finished";
+    } catch (const comm::Exception& e) {
+        ASSERT_EQ(comm::Timeout, e.num);
+    }
+
+    try {
+        connection.recv_message();
+        FAIL() << "Received from a connection left partway through a message";
+    } catch (const comm::Exception& e) {
+        ASSERT_EQ(comm::ConnectionError, e.num);
+    }
+
+    // The server sees the connection go down.
+    uint8_t byte;
+    ASSERT_EQ(0, ::read(server_socket->native_handle(), &byte, 1));
+}
+
+// So does a Timeout waiting for the reply to a message sent, even before
+// the first byte of it: the late reply would be read as the next one's.
+TEST(TCPConnectionTests, DeadlineWithReplyDue)
+{
+    auto listening_socket = comm::TCPSocket::create();
+    ASSERT_TRUE(listening_socket->set_boolean_option(SOL_SOCKET, SO_REUSEADDR, true));
+    ASSERT_TRUE(listening_socket->bind(SERVER_PORT_INTERCHANGE));
+    ASSERT_TRUE(listening_socket->listen());
+
+    auto client_socket = comm::TCPSocket::create();
+    ASSERT_TRUE(client_socket->connect({"localhost", SERVER_PORT_INTERCHANGE}));
+    comm::TCPConnection connection(std::move(client_socket));
+
+    auto server_socket = comm::TCPSocket::accept(listening_socket);
+
+    BytesBuffer request(16, 'q');
+    connection.send_message(request.data(), request.size());
+
+    connection.set_deadline(comm::Deadline::after(std::chrono::milliseconds(100)));
+
+    try {
+        connection.recv_message();
+        FAIL() << "Received a reply that was never sent";
+    } catch (const comm::Exception& e) {
+        ASSERT_EQ(comm::Timeout, e.num);
+    }
+
+    try {
+        connection.recv_message();
+        FAIL() << "Received from a connection left waiting for a reply";
+    } catch (const comm::Exception& e) {
+        ASSERT_EQ(comm::ConnectionError, e.num);
+    }
+
+    // The server gets the request, then sees the connection go down.
+    uint8_t buffer[64];
+    ssize_t count;
+    ssize_t total = 0;
+
+    while ((count = ::read(server_socket->native_handle(), buffer, sizeof(buffer))) > 0) {
+        total += count;
+    }
+
+    ASSERT_EQ(0, count);
+    ASSERT_EQ(static_cast< ssize_t >(sizeof(uint32_t) + request.size()), total);
+}
+
 TEST(TCPConnectionTests, MoveCopy)
 {
     comm::TCPConnection a(comm::TCPSocket::create());
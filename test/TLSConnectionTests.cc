@@ -2,8 +2,15 @@
  * @copyright Copyright (c) 2021 ApertureData Inc.
  */
 
+#include <cstdio>
+#include <fstream>
+#include <sstream>
 #include <string>
 #include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "gtest/gtest.h"
 
@@ -12,6 +19,7 @@
 #include "comm/ConnServer.h"
 #include "comm/Exception.h"
 #include "comm/TLS.h"
+#include "comm/TLSConnection.h"
 
 #define SERVER_PORT_INTERCHANGE 43444
 #define SERVER_PORT_MULTIPLE    43444
@@ -192,6 +200,403 @@ TEST_F(TLSConnectionTests, SendArrayInts)
     server_thread.join();
 }
 
+TEST_F(TLSConnectionTests, SendFragments)
+{
+    std::string header("query header");
+    std::string body(4 * 1024 * 1024, 'x');
+
+    Barrier barrier(2);
+
+    std::thread server_thread([&]() {
+        comm::ConnServer server(SERVER_PORT_INTERCHANGE, connServerConfig);
+
+        barrier.wait();
+
+        auto server_conn = server.negotiate_protocol(server.accept());
+
+        // Fragments go out as a single message
+        server_conn->send_message(
+            {{reinterpret_cast< const uint8_t* >(header.data()), header.length()},
+             {nullptr, 0},
+             {reinterpret_cast< const uint8_t* >(body.data()), body.length()}});
+    });
+
+    comm::ConnClient conn_client({"localhost", SERVER_PORT_INTERCHANGE}, connClientConfig);
+
+    barrier.wait();
+
+    auto connection = conn_client.connect();
+
+    BytesBuffer message_received = connection->recv_message();
+    std::string recv_message(message_received.begin(), message_received.end());
+    ASSERT_EQ(header + body, recv_message);
+
+    server_thread.join();
+}
+
+// Messages and files go through, whether or not the kernel takes over the
+// record encryption.
+TEST_F(TLSConnectionTests, KernelTLS)
+{
+    BytesBuffer content(2 * 1024 * 1024 + 5, 'k');
+
+    FILE* file = std::tmpfile();
+    ASSERT_NE(nullptr, file);
+    ASSERT_EQ(content.size(), std::fwrite(content.data(), 1, content.size(), file));
+    std::fflush(file);
+
+    connServerConfig.enable_ktls = true;
+    connClientConfig.enable_ktls = true;
+
+    Barrier barrier(2);
+
+    std::thread server_thread([&]() {
+        comm::ConnServer server(SERVER_PORT_INTERCHANGE, connServerConfig);
+
+        barrier.wait();
+
+        auto server_conn = server.negotiate_protocol(server.accept());
+
+        for (int i = 0; i < NUMBER_OF_MESSAGES; ++i) {
+            BytesBuffer message_received = server_conn->recv_message();
+            server_conn->send_message(message_received.data(), message_received.size());
+        }
+
+        server_conn->send_file(fileno(file), 0, content.size());
+    });
+
+    comm::ConnClient conn_client({"localhost", SERVER_PORT_INTERCHANGE}, connClientConfig);
+
+    barrier.wait();
+
+    auto connection = conn_client.connect();
+
+    for (int i = 0; i < NUMBER_OF_MESSAGES; ++i) {
+        BytesBuffer message(1000 * (i + 1), static_cast< uint8_t >(i));
+        connection->send_message(message.data(), message.size());
+        ASSERT_EQ(message, connection->recv_message());
+    }
+
+    ASSERT_EQ(content, connection->recv_message());
+
+    server_thread.join();
+    std::fclose(file);
+}
+
+// A client reconnecting to the same server resumes its TLS session.
+TEST_F(TLSConnectionTests, SessionResumption)
+{
+    constexpr int number_of_connections = 3;
+
+    std::string message("resume me");
+
+    Barrier barrier(2);
+
+    std::thread server_thread([&]() {
+        comm::ConnServer server(SERVER_PORT_INTERCHANGE, connServerConfig);
+
+        barrier.wait();
+
+        for (int i = 0; i < number_of_connections; ++i) {
+            auto server_conn = server.negotiate_protocol(server.accept());
+
+            BytesBuffer message_received = server_conn->recv_message();
+            server_conn->send_message(message_received.data(), message_received.size());
+        }
+    });
+
+    barrier.wait();
+
+    for (int i = 0; i < number_of_connections; ++i) {
+        comm::ConnClient conn_client({"localhost", SERVER_PORT_INTERCHANGE}, connClientConfig);
+
+        auto connection = conn_client.connect();
+
+        connection->send_message(reinterpret_cast< const uint8_t* >(message.data()),
+                                 message.length());
+        connection->recv_message();
+
+        auto tls_connection = std::dynamic_pointer_cast< comm::TLSConnection >(connection);
+        ASSERT_NE(nullptr, tls_connection);
+
+        // The first connection may offer a session from an earlier test's
+        // server, which this one cannot resume.
+        if (i > 0) {
+            ASSERT_TRUE(tls_connection->session_reused());
+        }
+    }
+
+    server_thread.join();
+}
+
+// Several connections opened at once, as by a pool, all resume sessions
+// from the tickets an earlier one got.
+TEST_F(TLSConnectionTests, SessionResumptionConcurrent)
+{
+    constexpr int number_of_connections = 2;
+
+    std::string message("resume us");
+
+    Barrier barrier(2);
+
+    std::thread server_thread([&]() {
+        comm::ConnServer server(SERVER_PORT_INTERCHANGE, connServerConfig);
+
+        barrier.wait();
+
+        std::vector< std::unique_ptr< comm::Connection > > server_conns;
+
+        for (int i = 0; i < number_of_connections + 1; ++i) {
+            server_conns.push_back(server.negotiate_protocol(server.accept()));
+
+            // The first one gets its tickets before the others connect.
+            if (i == 0) {
+                BytesBuffer message_received = server_conns[0]->recv_message();
+                server_conns[0]->send_message(message_received.data(), message_received.size());
+            }
+        }
+
+        for (int i = 1; i < number_of_connections + 1; ++i) {
+            BytesBuffer message_received = server_conns[i]->recv_message();
+            server_conns[i]->send_message(message_received.data(), message_received.size());
+        }
+    });
+
+    barrier.wait();
+
+    auto round_trip = [&message](comm::Connection& connection) {
+        connection.send_message(reinterpret_cast< const uint8_t* >(message.data()),
+                                message.length());
+        connection.recv_message();
+    };
+
+    comm::ConnClient first_client({"localhost", SERVER_PORT_INTERCHANGE}, connClientConfig);
+    round_trip(*first_client.connect());
+
+    std::vector< std::unique_ptr< comm::ConnClient > > clients;
+    std::vector< std::shared_ptr< comm::Connection > > connections;
+
+    for (int i = 0; i < number_of_connections; ++i) {
+        clients.emplace_back(new comm::ConnClient({"localhost", SERVER_PORT_INTERCHANGE},
+                                                  connClientConfig));
+        connections.push_back(clients.back()->connect());
+    }
+
+    for (auto& connection : connections) {
+        round_trip(*connection);
+
+        auto tls_connection = std::dynamic_pointer_cast< comm::TLSConnection >(connection);
+        ASSERT_NE(nullptr, tls_connection);
+        EXPECT_TRUE(tls_connection->session_reused());
+    }
+
+    server_thread.join();
+}
+
+// A session from a client that does not verify the server is not offered
+// by one that does, which has to go through a full handshake instead.
+TEST_F(TLSConnectionTests, SessionResumptionKeepsVerification)
+{
+    std::string message("verify me");
+
+    Barrier barrier(2);
+
+    std::thread server_thread([&]() {
+        comm::ConnServer server(SERVER_PORT_INTERCHANGE, connServerConfig);
+
+        barrier.wait();
+
+        for (int i = 0; i < 3; ++i) {
+            try {
+                auto server_conn = server.negotiate_protocol(server.accept());
+
+                BytesBuffer message_received = server_conn->recv_message();
+                server_conn->send_message(message_received.data(), message_received.size());
+            } catch (const comm::Exception&) {
+                // The verifying client rejects the certificate.
+            }
+        }
+    });
+
+    barrier.wait();
+
+    comm::ConnClientConfig verifying_config = connClientConfig;
+    verifying_config.verify_certificate     = true;
+
+    for (auto& config : {connClientConfig, connClientConfig, verifying_config}) {
+        comm::ConnClient conn_client({"localhost", SERVER_PORT_INTERCHANGE}, config);
+
+        if (config.verify_certificate) {
+            // The certificate is self-signed, and no CA was given.
+            EXPECT_THROW(conn_client.connect(), comm::Exception);
+            continue;
+        }
+
+        auto connection = conn_client.connect();
+
+        connection->send_message(reinterpret_cast< const uint8_t* >(message.data()),
+                                 message.length());
+        connection->recv_message();
+    }
+
+    server_thread.join();
+}
+
+// Clients can talk to servers using any of the auto-generated key types.
+TEST_F(TLSConnectionTests, CertificateKeyTypes)
+{
+    std::string message("key type");
+
+    for (auto key_type : {comm::CertificateKeyType::RSA_2048,
+                          comm::CertificateKeyType::ECDSA_P256,
+                          comm::CertificateKeyType::Ed25519}) {
+        comm::ConnServerConfig server_config(comm::Protocol::TLS);
+        server_config.certificate_key_type = key_type;
+
+        Barrier barrier(2);
+
+        std::thread server_thread([&]() {
+            comm::ConnServer server(SERVER_PORT_INTERCHANGE, server_config);
+
+            barrier.wait();
+
+            auto server_conn = server.negotiate_protocol(server.accept());
+
+            BytesBuffer message_received = server_conn->recv_message();
+            server_conn->send_message(message_received.data(), message_received.size());
+        });
+
+        comm::ConnClient conn_client({"localhost", SERVER_PORT_INTERCHANGE}, connClientConfig);
+
+        barrier.wait();
+
+        auto connection = conn_client.connect();
+
+        connection->send_message(reinterpret_cast< const uint8_t* >(message.data()),
+                                 message.length());
+        BytesBuffer message_received = connection->recv_message();
+        ASSERT_EQ(message, std::string(message_received.begin(), message_received.end()));
+
+        server_thread.join();
+    }
+}
+
+// A cached certificate is reused by the next server, unless the key type
+// changes, or others could have written to the cache.
+TEST_F(TLSConnectionTests, CertificateCache)
+{
+    std::string cache_path = "/tmp/comm_test_certificate_" + std::to_string(::getpid()) + ".pem";
+
+    auto read_cache = [&cache_path]() {
+        std::ifstream file(cache_path);
+        std::stringstream content;
+        content << file.rdbuf();
+        return content.str();
+    };
+
+    comm::ConnServerConfig server_config(comm::Protocol::TLS);
+    server_config.certificate_cache = cache_path;
+
+    { comm::ConnServer server(SERVER_PORT_INTERCHANGE, server_config); }
+
+    auto first = read_cache();
+    ASSERT_NE(std::string::npos, first.find("BEGIN CERTIFICATE"));
+    ASSERT_NE(std::string::npos, first.find("PRIVATE KEY"));
+
+    { comm::ConnServer server(SERVER_PORT_INTERCHANGE, server_config); }
+
+    ASSERT_EQ(first, read_cache());
+
+    server_config.certificate_key_type = comm::CertificateKeyType::Ed25519;
+
+    { comm::ConnServer server(SERVER_PORT_INTERCHANGE, server_config); }
+
+    auto second = read_cache();
+    ASSERT_NE(first, second);
+
+    ASSERT_EQ(0, ::chmod(cache_path.c_str(), 0622));
+
+    { comm::ConnServer server(SERVER_PORT_INTERCHANGE, server_config); }
+
+    ASSERT_NE(second, read_cache());
+
+    struct stat status;
+    ASSERT_EQ(0, ::stat(cache_path.c_str(), &status));
+    ASSERT_EQ(0600u, status.st_mode & 0777);
+
+    std::remove(cache_path.c_str());
+}
+
+// Both ends restricted to TLS 1.3 and ChaCha20 negotiate that suite.
+TEST_F(TLSConnectionTests, CipherPolicy)
+{
+    std::string message("cipher policy");
+
+    comm::TLSPolicy policy;
+    policy.min_version       = comm::TLSVersion::TLS1_3;
+    policy.cipher_preference = comm::CipherPreference::ChaCha20;
+
+    connServerConfig.tls_policy = policy;
+    connClientConfig.tls_policy = policy;
+
+    Barrier barrier(2);
+
+    std::thread server_thread([&]() {
+        comm::ConnServer server(SERVER_PORT_INTERCHANGE, connServerConfig);
+
+        barrier.wait();
+
+        auto server_conn = server.negotiate_protocol(server.accept());
+
+        BytesBuffer message_received = server_conn->recv_message();
+        server_conn->send_message(message_received.data(), message_received.size());
+    });
+
+    comm::ConnClient conn_client({"localhost", SERVER_PORT_INTERCHANGE}, connClientConfig);
+
+    barrier.wait();
+
+    auto connection = conn_client.connect();
+
+    connection->send_message(reinterpret_cast< const uint8_t* >(message.data()),
+                             message.length());
+    BytesBuffer message_received = connection->recv_message();
+    ASSERT_EQ(message, std::string(message_received.begin(), message_received.end()));
+
+    auto tls_connection = std::dynamic_pointer_cast< comm::TLSConnection >(connection);
+    ASSERT_NE(nullptr, tls_connection);
+    ASSERT_EQ("TLS_CHACHA20_POLY1305_SHA256", tls_connection->cipher());
+
+    server_thread.join();
+}
+
+// The handshake fails when the two ends share no cipher suite.
+TEST_F(TLSConnectionTests, CipherPolicyMismatch)
+{
+    connServerConfig.tls_policy.min_version   = comm::TLSVersion::TLS1_3;
+    connServerConfig.tls_policy.cipher_suites = "TLS_CHACHA20_POLY1305_SHA256";
+    connClientConfig.tls_policy.min_version   = comm::TLSVersion::TLS1_3;
+    connClientConfig.tls_policy.cipher_suites = "TLS_AES_128_GCM_SHA256";
+
+    Barrier barrier(2);
+
+    std::thread server_thread([&]() {
+        comm::ConnServer server(SERVER_PORT_INTERCHANGE, connServerConfig);
+
+        barrier.wait();
+
+        ASSERT_THROW(server.negotiate_protocol(server.accept()), comm::Exception);
+    });
+
+    comm::ConnClient conn_client({"localhost", SERVER_PORT_INTERCHANGE}, connClientConfig);
+
+    barrier.wait();
+
+    ASSERT_THROW(conn_client.connect(), comm::Exception);
+
+    server_thread.join();
+}
+
 TEST_F(TLSConnectionTests, Unreachable)
 {
     comm::ConnClient client_1({"unreachable.com.ar.something", 5555});
@@ -4,6 +4,7 @@
 
 #include "VDMSServer.h"
 #include "aperturedb/queryMessageWrapper.h"
+#include "comm/CompressionDictionary.h"
 #include "comm/Connection.h"
 #include "comm/ConnServer.h"
 #include "comm/Exception.h"
@@ -31,7 +32,20 @@ VDMSServer::VDMSServer(int port, comm::ConnServerConfig config)
             }
 
             protobufs::queryMessage protobuf_response;
-            protobuf_response.set_json(protobuf_request.json());
+
+            // Compressed json is echoed back compressed.
+            auto& dictionary = server_conn->dictionary();
+
+            if (dictionary && !protobuf_request.json_zstd().empty()) {
+                std::string json, compressed;
+                auto& request_json = protobuf_request.json_zstd();
+                dictionary->decompress(request_json.data(), request_json.size(), 1024 * 1024, json);
+                dictionary->compress(json.data(), json.size(), compressed);
+                protobuf_response.set_json_zstd(compressed);
+            } else {
+                protobuf_response.set_json(protobuf_request.json());
+            }
+            *protobuf_response.mutable_blobs() = protobuf_request.blobs();
 
             send_message(server_conn, protobuf_response);
         }
@@ -52,7 +66,8 @@ VDMSServer::~VDMSServer()
 protobufs::queryMessage VDMSServer::receive_message(
     const std::shared_ptr< comm::Connection >& connection)
 {
-    std::basic_string< uint8_t > message_received = connection->recv_message();
+    std::basic_string< uint8_t > message_received;
+    connection->recv_message(message_received);
 
     protobufs::queryMessage protobuf_request;
     bool ok = protobuf_request.ParseFromArray(message_received.data(), message_received.length());
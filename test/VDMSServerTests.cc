@@ -3,13 +3,21 @@
  */
 
 #include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <future>
 #include <string>
 #include <thread>
 
+#include <unistd.h>
+
 #include "gtest/gtest.h"
 
+#include "aperturedb/Exception.h"
 #include "aperturedb/VDMSClient.h"
+#include "aperturedb/VDMSClientPool.h"
 #include "AuthEnabledVDMSServer.h"
+#include "comm/CompressionDictionary.h"
 #include "comm/ConnServer.h"
 #include "comm/Exception.h"
 #include "comm/TLS.h"
@@ -18,6 +26,17 @@
 #define SERVER_PORT_INTERCHANGE 43444
 #define NUMBER_OF_MESSAGES      20
 
+// "[i]", which the test server echoes back. Appended piece by piece, as
+// GCC 12 at -O3 warns (-Wrestrict) on "[" + std::to_string(i) + "]".
+std::string numbered_json(int i)
+{
+    std::string json("[");
+    json += std::to_string(i);
+    json += "]";
+
+    return json;
+}
+
 class VDMSServerTests : public testing::Test
 {
    protected:
@@ -108,3 +127,370 @@ TEST_F(VDMSServerTests, SyncMessagesReAuthenticate)
     // Expect the same response
     ASSERT_EQ(0, response.json.compare(client_to_server));
 }
+
+TEST_F(VDMSServerTests, SyncMessagesWithBlobs)
+{
+    std::string client_to_server = "[{\"AddImage\": {}}, {\"AddImage\": {}}]";
+
+    std::string small_blob(100, 'a');
+    std::string large_blob(8 * 1024 * 1024, 'b');
+    std::string empty_blob;
+
+    VDMS::VDMSServer server(SERVER_PORT_INTERCHANGE, connServerConfig);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    VDMS::TokenBasedVDMSClient client(
+        VDMS::VDMSClientConfig("localhost", SERVER_PORT_INTERCHANGE, VDMS::Protocol::TLS, ""));
+
+    for (int i = 0; i < NUMBER_OF_MESSAGES; ++i) {
+        auto response = client.query(client_to_server, {&small_blob, &empty_blob, &large_blob});
+
+        // Expect the same query and blobs back
+        ASSERT_EQ(client_to_server, response.json);
+        ASSERT_EQ(3u, response.blobs.size());
+        ASSERT_EQ(small_blob, response.blobs[0]);
+        ASSERT_EQ(empty_blob, response.blobs[1]);
+        ASSERT_EQ(large_blob, response.blobs[2]);
+    }
+}
+
+TEST_F(VDMSServerTests, SyncMessagesWithBlobFiles)
+{
+    std::string client_to_server = "[{\"FindVideo\": {}}]";
+
+    std::vector< std::string > blobs{
+        std::string(100, 'a'), std::string(), std::string(8 * 1024 * 1024, 'b')};
+
+    VDMS::VDMSServer server(SERVER_PORT_INTERCHANGE, connServerConfig);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    VDMS::TokenBasedVDMSClient client(
+        VDMS::VDMSClientConfig("localhost", SERVER_PORT_INTERCHANGE, VDMS::Protocol::TLS, ""));
+
+    auto path = [](std::size_t index) {
+        return "/tmp/comm_test_blob_" + std::to_string(::getpid()) + "_" + std::to_string(index);
+    };
+
+    auto json = client.query_to_files(client_to_server, path, {&blobs[0], &blobs[1], &blobs[2]});
+
+    ASSERT_EQ(client_to_server, json);
+
+    for (size_t i = 0; i < blobs.size(); ++i) {
+        std::ifstream file(path(i), std::ios::binary);
+        std::string content((std::istreambuf_iterator< char >(file)),
+                            std::istreambuf_iterator< char >());
+
+        ASSERT_EQ(blobs[i], content);
+        std::remove(path(i).c_str());
+    }
+}
+
+// A blob file that cannot be written fails the query, but leaves the rest
+// of the response off the connection.
+TEST_F(VDMSServerTests, SyncMessagesWithBlobFilesFailure)
+{
+    std::string client_to_server = "[{\"FindVideo\": {}}]";
+
+    std::vector< std::string > blobs{std::string(100, 'a'), std::string(8 * 1024 * 1024, 'b')};
+
+    VDMS::VDMSServer server(SERVER_PORT_INTERCHANGE, connServerConfig);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    VDMS::TokenBasedVDMSClient client(
+        VDMS::VDMSClientConfig("localhost", SERVER_PORT_INTERCHANGE, VDMS::Protocol::TLS, ""));
+
+    auto path = [](std::size_t index) {
+        return "/nonexistent/comm_test_blob_" + std::to_string(index);
+    };
+
+    ASSERT_THROW(client.query_to_files(client_to_server, path, {&blobs[0], &blobs[1]}),
+                 VDMS::Exception);
+
+    auto response = client.query(client_to_server, {&blobs[1]});
+
+    ASSERT_EQ(client_to_server, response.json);
+    ASSERT_EQ(1u, response.blobs.size());
+    ASSERT_EQ(blobs[1], response.blobs[0]);
+}
+
+TEST_F(VDMSServerTests, SyncMessagesWithBlobViews)
+{
+    std::string client_to_server = "[{\"FindImage\": {}}]";
+
+    std::vector< std::string > blobs{std::string(100, 'a'), std::string(1024 * 1024, 'b')};
+
+    VDMS::VDMSServer server(SERVER_PORT_INTERCHANGE, connServerConfig);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    VDMS::TokenBasedVDMSClient client(
+        VDMS::VDMSClientConfig("localhost", SERVER_PORT_INTERCHANGE, VDMS::Protocol::TLS, ""));
+
+    VDMS::ResponseView first_response;
+
+    for (int i = 0; i < NUMBER_OF_MESSAGES; ++i) {
+        auto response = client.query_view(client_to_server, {&blobs[0], &blobs[1]});
+
+        ASSERT_EQ(client_to_server, response.json);
+        ASSERT_EQ(blobs.size(), response.blobs.size());
+
+        for (size_t j = 0; j < blobs.size(); ++j) {
+            ASSERT_EQ(blobs[j], response.blobs[j]);
+        }
+
+        if (i == 0) {
+            first_response = response;
+        }
+    }
+
+    // Views into earlier responses outlive later queries
+    ASSERT_EQ(client_to_server, first_response.json);
+    ASSERT_EQ(blobs[1], first_response.blobs[1]);
+
+    auto copied = first_response.to_response();
+    ASSERT_EQ(client_to_server, copied.json);
+    ASSERT_EQ(blobs, copied.blobs);
+}
+
+TEST_F(VDMSServerTests, PipelinedMessages)
+{
+    std::string blob(64 * 1024, 'c');
+
+    VDMS::VDMSServer server(SERVER_PORT_INTERCHANGE, connServerConfig);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    VDMS::VDMSClientConfig config("localhost", SERVER_PORT_INTERCHANGE, VDMS::Protocol::TLS, "");
+    config.max_queries_in_flight = 4;
+
+    VDMS::TokenBasedVDMSClient client(config);
+
+    std::vector< std::future< VDMS::ResponseView > > responses;
+
+    for (int i = 0; i < NUMBER_OF_MESSAGES; ++i) {
+        responses.push_back(client.query_async(numbered_json(i), {&blob}));
+    }
+
+    // Blocking queries keep their place in line
+    auto response = client.query("[{}]");
+    ASSERT_EQ("[{}]", response.json);
+
+    for (int i = 0; i < NUMBER_OF_MESSAGES; ++i) {
+        auto pipelined_response = responses[i].get();
+
+        ASSERT_EQ(numbered_json(i), pipelined_response.json);
+        ASSERT_EQ(1u, pipelined_response.blobs.size());
+        ASSERT_EQ(blob, pipelined_response.blobs[0]);
+    }
+}
+
+// Compressed both ways, while one thread sends and another receives.
+TEST_F(VDMSServerTests, PipelinedCompressedMessages)
+{
+    std::string blob(64 * 1024, 'c');
+
+    comm::ConnServerConfig server_config(comm::Protocol::TCP);
+    server_config.capabilities = comm::Capabilities(comm::Compression::LZ4);
+
+    VDMS::VDMSServer server(SERVER_PORT_INTERCHANGE, server_config);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    VDMS::VDMSClientConfig config("localhost", SERVER_PORT_INTERCHANGE, VDMS::Protocol::TCP, "");
+    config.max_queries_in_flight = 4;
+    config.compression           = comm::Compression::LZ4;
+
+    VDMS::TokenBasedVDMSClient client(config);
+
+    std::vector< std::future< VDMS::ResponseView > > responses;
+
+    for (int i = 0; i < 10 * NUMBER_OF_MESSAGES; ++i) {
+        responses.push_back(client.query_async(numbered_json(i), {&blob}));
+    }
+
+    for (int i = 0; i < 10 * NUMBER_OF_MESSAGES; ++i) {
+        auto pipelined_response = responses[i].get();
+
+        ASSERT_EQ(numbered_json(i), pipelined_response.json);
+        ASSERT_EQ(1u, pipelined_response.blobs.size());
+        ASSERT_EQ(blob, pipelined_response.blobs[0]);
+    }
+}
+
+// A query the server does not answer in time throws Timeout, and leaves
+// the connection shut down rather than out of step.
+TEST_F(VDMSServerTests, QueryTimeout)
+{
+    std::promise< void > done;
+
+    std::thread server_thread([this, &done]() {
+        comm::ConnServer server(SERVER_PORT_INTERCHANGE, connServerConfig);
+        auto server_conn = server.negotiate_protocol(server.accept());
+
+        // The first query is echoed back, as a response of the same shape.
+        auto query = server_conn->recv_message();
+        server_conn->send_message(query.data(), query.size());
+
+        // The second one is not.
+        server_conn->recv_message();
+        done.get_future().wait();
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    VDMS::VDMSClientConfig config("localhost", SERVER_PORT_INTERCHANGE, VDMS::Protocol::TLS, "");
+    config.query_timeout_ms = 100;
+
+    VDMS::TokenBasedVDMSClient client(config);
+
+    ASSERT_EQ("[{}]", client.query("[{}]").json);
+
+    auto start = std::chrono::steady_clock::now();
+
+    try {
+        client.query("[{}]");
+        FAIL() << "Received a response that was never sent";
+    } catch (const VDMS::Exception& e) {
+        ASSERT_EQ(VDMS::Timeout, e.num);
+    }
+
+    ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+
+    ASSERT_THROW(client.query("[{}]"), VDMS::Exception);
+
+    done.set_value();
+    server_thread.join();
+}
+
+// With a dictionary on both ends, query json travels compressed.
+TEST_F(VDMSServerTests, DictionaryCompressedJson)
+{
+    auto add_entity = [](int i) {
+        return R"([{"AddEntity": {"class": "Person", "properties": {"name": "person )" +
+               std::to_string(i) + R"(", "age": )" + std::to_string(i % 90) +
+               R"(, "email": "person)" + std::to_string(i) + R"(@example.com"}}}])";
+    };
+
+    std::vector< std::string > samples;
+
+    for (int i = 0; i < 1000; ++i) {
+        samples.push_back(add_entity(i));
+    }
+
+    std::string path = "/tmp/comm_test_dictionary_" + std::to_string(::getpid());
+
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << comm::CompressionDictionary::train(samples);
+    }
+
+    class ByteCounter : public comm::ConnMetrics
+    {
+       public:
+        void observe_bytes_sent(std::size_t bytes_sent) override { sent += bytes_sent; }
+
+        std::size_t sent{0};
+    } counter;
+
+    connServerConfig.dictionary = comm::CompressionDictionary::load(path);
+
+    VDMS::VDMSServer server(SERVER_PORT_INTERCHANGE, connServerConfig);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    VDMS::VDMSClientConfig config(
+        "localhost", SERVER_PORT_INTERCHANGE, VDMS::Protocol::TLS, "", &counter);
+    config.json_dictionary = path;
+
+    VDMS::TokenBasedVDMSClient client(config);
+
+    std::remove(path.c_str());
+
+    auto json     = add_entity(123456);
+    auto response = client.query(json);
+
+    ASSERT_EQ(json, response.json);
+    ASSERT_LT(counter.sent, json.size() / 2);
+}
+
+TEST_F(VDMSServerTests, PipelinedMessagesAuthenticated)
+{
+    std::string client_to_server = "[{}]";
+
+    VDMS::AuthEnabledVDMSServerConfig config{connServerConfig};
+
+    VDMS::AuthEnabledVDMSServer server(SERVER_PORT_INTERCHANGE, config);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    VDMS::VDMSClient client(
+        "username",
+        "password",
+        VDMS::VDMSClientConfig("localhost", SERVER_PORT_INTERCHANGE, VDMS::Protocol::TLS, ""));
+
+    std::vector< std::future< VDMS::ResponseView > > responses;
+
+    for (int i = 0; i < NUMBER_OF_MESSAGES; ++i) {
+        responses.push_back(client.query_async(client_to_server));
+    }
+
+    for (auto& response : responses) {
+        ASSERT_EQ(client_to_server, response.get().json);
+    }
+}
+
+TEST_F(VDMSServerTests, PoolMessagesAuthenticated)
+{
+    constexpr int pool_size         = 4;
+    constexpr int number_of_threads = 8;
+
+    struct PoolMetrics : public VDMS::VDMSClientPoolMetrics {
+        void observe_wait_time(std::chrono::nanoseconds) override { ++leases; }
+
+        std::atomic< int > leases{0};
+    } metrics;
+
+    VDMS::AuthEnabledVDMSServerConfig config{connServerConfig, 24 * 60 * 60, 60 * 60, pool_size};
+
+    VDMS::AuthEnabledVDMSServer server(SERVER_PORT_INTERCHANGE, config);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    VDMS::VDMSClientPool pool(
+        "username",
+        "password",
+        pool_size,
+        VDMS::VDMSClientConfig("localhost", SERVER_PORT_INTERCHANGE, VDMS::Protocol::TLS, ""),
+        &metrics);
+
+    ASSERT_EQ(pool_size, pool.size());
+
+    std::vector< std::thread > threads;
+
+    for (int t = 0; t < number_of_threads; ++t) {
+        threads.emplace_back([&pool, t]() {
+            for (int i = 0; i < NUMBER_OF_MESSAGES; ++i) {
+                std::string client_to_server = numbered_json(t * 1000 + i);
+
+                // Expect the same response, on whichever connection
+                auto response = pool.query(client_to_server);
+                ASSERT_EQ(client_to_server, response.json);
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    ASSERT_EQ(number_of_threads * NUMBER_OF_MESSAGES, metrics.leases);
+
+    auto lease = pool.lease();
+    auto moved = std::move(lease);
+
+    ASSERT_EQ("[{}]", moved.query("[{}]").json);
+    ASSERT_THROW(lease.query("[{}]"), VDMS::Exception);
+}